@@ -0,0 +1,69 @@
+#include "channel.h"
+#include "clock.h"
+#include "iomanager.h"
+#include "util.h"
+
+namespace sylar {
+static thread_local uint32_t t_select_seed = 0;
+
+int Select::tryWait() {
+    size_t n = m_cases.size();
+    if (n == 0) {
+        return -1;
+    }
+    if (t_select_seed == 0) {
+        t_select_seed = GetThreadID() | 1;
+    }
+    t_select_seed ^= t_select_seed << 13;
+    t_select_seed ^= t_select_seed >> 17;
+    t_select_seed ^= t_select_seed << 5;
+    // random start so one busy channel can't starve the others
+    size_t start = t_select_seed % n;
+    for (size_t i = 0; i < n; ++i) {
+        size_t idx = (start + i) % n;
+        if (m_cases[idx]->tryFire()) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+int Select::waitFor(uint64_t timeout_ms) {
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetMonotonicMS() + timeout_ms;
+    while (true) {
+        int idx = tryWait();
+        if (idx >= 0 || m_cases.empty()) {
+            return idx;
+        }
+        uint64_t now = deadline == ~0ull ? 0 : GetMonotonicMS();
+        if (now >= deadline) {
+            return -1;
+        }
+        FiberWaitQueue::Waiter::ptr waiter =
+            FiberWaitQueue::NewWaiter(deadline == ~0ull ? ~0ull : deadline - now);
+        size_t watched = 0;
+        bool ready = false;
+        for (; watched < m_cases.size(); ++watched) {
+            if (m_cases[watched]->watch(waiter)) {
+                ready = true;
+                break;
+            }
+        }
+        if (!ready) {
+            FiberWaitQueue::Park(waiter);
+        } else {
+            int expect = FiberWaitQueue::Waiter::WAITING;
+            if (!waiter->state.compare_exchange_strong(expect, FiberWaitQueue::Waiter::NOTIFIED)) {
+                // a channel or the timer already scheduled us, take that wakeup
+                Fiber::YeildToHold();
+            }
+            if (waiter->timer) {
+                waiter->iomanager->cancel(waiter->timer);
+            }
+        }
+        for (size_t i = 0; i < watched; ++i) {
+            m_cases[i]->unwatch(waiter);
+        }
+    }
+}
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "fiber_sync.h"
+#include "mutex.h"
+#include "util.h"
+
+namespace sylar {
+/**
+ * Channel between fibers. send() parks the fiber while the channel is full,
+ * recv() while it is empty; worker threads are never blocked. Values are moved
+ * in and out, so move-only payloads work. The default capacity is unbounded.
+ */
+template<typename T>
+class Channel : Noncopyable {
+template<typename> friend class ChannelRecvCase;
+template<typename> friend class ChannelSendCase;
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    Channel(size_t capacity = ~(size_t)0) : m_capacity(capacity) {
+        SYLAR_ASSERT(capacity > 0);
+    }
+
+    // false if the channel is closed
+    bool send(T&& v) {
+        Spinlock::Lock lock(m_mutex);
+        while (!m_closed) {
+            if (m_queue.size() < m_capacity) {
+                m_queue.push_back(std::move(v));
+                m_recvWaiters.notify();
+                return true;
+            }
+            m_sendWaiters.park(lock, m_sendWaiters.push());
+        }
+        return false;
+    }
+
+    bool send(const T& v) {
+        T tmp(v);
+        return send(std::move(tmp));
+    }
+
+    // false if the channel is closed and drained
+    bool recv(T& v) {
+        Spinlock::Lock lock(m_mutex);
+        while (m_queue.empty()) {
+            if (m_closed) {
+                return false;
+            }
+            m_recvWaiters.park(lock, m_recvWaiters.push());
+        }
+        v = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_sendWaiters.notify();
+        return true;
+    }
+
+    // v is only moved from on success
+    bool trySend(T&& v) {
+        Spinlock::Lock lock(m_mutex);
+        if (m_closed || m_queue.size() >= m_capacity) {
+            return false;
+        }
+        m_queue.push_back(std::move(v));
+        m_recvWaiters.notify();
+        return true;
+    }
+
+    bool trySend(const T& v) {
+        T tmp(v);
+        return trySend(std::move(tmp));
+    }
+
+    bool tryRecv(T& v) {
+        Spinlock::Lock lock(m_mutex);
+        if (m_queue.empty()) {
+            return false;
+        }
+        v = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_sendWaiters.notify();
+        return true;
+    }
+
+    // wake everyone, pending values can still be received
+    void close() {
+        Spinlock::Lock lock(m_mutex);
+        m_closed = true;
+        m_recvWaiters.notifyAll();
+        m_sendWaiters.notifyAll();
+    }
+
+    bool isClosed() {
+        Spinlock::Lock lock(m_mutex);
+        return m_closed;
+    }
+
+    size_t size() {
+        Spinlock::Lock lock(m_mutex);
+        return m_queue.size();
+    }
+
+    size_t getCapacity() const { return m_capacity; }
+
+private:
+    Spinlock m_mutex;
+    std::deque<T> m_queue;
+    FiberWaitQueue m_recvWaiters;
+    FiberWaitQueue m_sendWaiters;
+    size_t m_capacity;
+    bool m_closed = false;
+};
+
+class SelectCase {
+public:
+    typedef FiberWaitQueue::Waiter::ptr WaiterPtr;
+
+    virtual ~SelectCase() {}
+    // complete the operation if the channel is ready
+    virtual bool tryFire() = 0;
+    // true if already ready, otherwise start watching the channel
+    virtual bool watch(const WaiterPtr& waiter) = 0;
+    // stop watching, pass a wakeup we may have taken on to the next waiter
+    virtual void unwatch(const WaiterPtr& waiter) = 0;
+};
+
+template<typename T>
+class ChannelRecvCase : public SelectCase {
+public:
+    ChannelRecvCase(Channel<T>& ch, T& out, bool* ok)
+        : m_ch(ch), m_out(out), m_ok(ok) {}
+
+    bool tryFire() override {
+        Spinlock::Lock lock(m_ch.m_mutex);
+        if (!m_ch.m_queue.empty()) {
+            m_out = std::move(m_ch.m_queue.front());
+            m_ch.m_queue.pop_front();
+            m_ch.m_sendWaiters.notify();
+            setOk(true);
+            return true;
+        }
+        if (m_ch.m_closed) {
+            setOk(false);
+            return true;
+        }
+        return false;
+    }
+
+    bool watch(const WaiterPtr& waiter) override {
+        Spinlock::Lock lock(m_ch.m_mutex);
+        if (!m_ch.m_queue.empty() || m_ch.m_closed) {
+            return true;
+        }
+        m_ch.m_recvWaiters.add(waiter);
+        return false;
+    }
+
+    void unwatch(const WaiterPtr& waiter) override {
+        Spinlock::Lock lock(m_ch.m_mutex);
+        m_ch.m_recvWaiters.remove(waiter);
+        if (!m_ch.m_queue.empty()) {
+            m_ch.m_recvWaiters.notify();
+        }
+    }
+
+private:
+    void setOk(bool v) {
+        if (m_ok) {
+            *m_ok = v;
+        }
+    }
+
+private:
+    Channel<T>& m_ch;
+    T& m_out;
+    bool* m_ok;
+};
+
+template<typename T>
+class ChannelSendCase : public SelectCase {
+public:
+    ChannelSendCase(Channel<T>& ch, T&& v, bool* ok)
+        : m_ch(ch), m_value(std::move(v)), m_ok(ok) {}
+
+    bool tryFire() override {
+        Spinlock::Lock lock(m_ch.m_mutex);
+        if (m_ch.m_closed) {
+            setOk(false);
+            return true;
+        }
+        if (m_ch.m_queue.size() < m_ch.m_capacity) {
+            m_ch.m_queue.push_back(std::move(m_value));
+            m_ch.m_recvWaiters.notify();
+            setOk(true);
+            return true;
+        }
+        return false;
+    }
+
+    bool watch(const WaiterPtr& waiter) override {
+        Spinlock::Lock lock(m_ch.m_mutex);
+        if (m_ch.m_queue.size() < m_ch.m_capacity || m_ch.m_closed) {
+            return true;
+        }
+        m_ch.m_sendWaiters.add(waiter);
+        return false;
+    }
+
+    void unwatch(const WaiterPtr& waiter) override {
+        Spinlock::Lock lock(m_ch.m_mutex);
+        m_ch.m_sendWaiters.remove(waiter);
+        if (m_ch.m_queue.size() < m_ch.m_capacity) {
+            m_ch.m_sendWaiters.notify();
+        }
+    }
+
+private:
+    void setOk(bool v) {
+        if (m_ok) {
+            *m_ok = v;
+        }
+    }
+
+private:
+    Channel<T>& m_ch;
+    T m_value;
+    bool* m_ok;
+};
+
+/**
+ * Wait on several channel operations at once and complete exactly one of them.
+ * A receive from a closed channel or a send to one fires with *ok = false.
+ *
+ *   int a; std::string b;
+ *   Select sel;
+ *   sel.recv(ch_a, a).recv(ch_b, b);
+ *   switch (sel.wait()) { case 0: ...; case 1: ...; }
+ */
+class Select : Noncopyable {
+public:
+    template<typename T>
+    Select& recv(Channel<T>& ch, T& out, bool* ok = nullptr) {
+        m_cases.emplace_back(new ChannelRecvCase<T>(ch, out, ok));
+        return *this;
+    }
+
+    template<typename T>
+    Select& send(Channel<T>& ch, T&& v, bool* ok = nullptr) {
+        m_cases.emplace_back(new ChannelSendCase<T>(ch, std::move(v), ok));
+        return *this;
+    }
+
+    // index of the completed case
+    int wait() { return waitFor(~0ull); }
+    // index of the completed case, -1 on timeout
+    int waitFor(uint64_t timeout_ms);
+    // index of the completed case, -1 if none is ready
+    int tryWait();
+
+private:
+    std::vector<std::unique_ptr<SelectCase>> m_cases;
+};
+}
@@ -2,43 +2,96 @@
 #include "fiber.h"
 #include "log.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
 #include "util.h"
 
 #include <atomic>
+#include <vector>
 
 namespace sylar {
 static Logger::ptr g_logger = SYLAR_LOG_NAME("root");
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size = Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024 * 1024, "fiber shared stack size");
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count = Config::Lookup<uint32_t>("fiber.shared_stack_count", 4, "fiber shared stacks per thread");
 static std::atomic<uint64_t> s_fiber_id {0};
 static std::atomic<uint64_t> s_fiber_count {0};
+static std::atomic<size_t> s_local_slot {0};
 
 static thread_local Fiber *t_fiber = nullptr;              // current fiber
 static thread_local Fiber::ptr t_threadFiber = nullptr;    // the first fiber (main fiber)
 
+struct SharedStack {
+    typedef std::shared_ptr<SharedStack> ptr;
+    typedef Spinlock MutexType;
+
+    SharedStack(size_t s) : size(s) {
+        stack = StackAllocator::Alloc(size);
+        top = (char*)stack + size;
+    }
+
+    ~SharedStack() {
+        StackAllocator::Dealloc(stack, size);
+    }
+
+    void* stack;
+    size_t size;
+    char* top;
+    Fiber* occupant = nullptr;      // fiber whose frames are currently on the stack
+    MutexType mutex;
+};
+
+static thread_local std::vector<SharedStack::ptr> t_sharedStacks;
+static thread_local size_t t_sharedStackIndex = 0;
+
+static SharedStack::ptr GetSharedStack() {
+    if (t_sharedStacks.empty()) {
+        uint32_t count = g_fiber_shared_stack_count->getValue();
+        uint32_t size = g_fiber_shared_stack_size->getValue();
+        for (uint32_t i = 0; i < (count ? count : 1); ++i) {
+            t_sharedStacks.push_back(std::make_shared<SharedStack>(size));
+        }
+    }
+    return t_sharedStacks[t_sharedStackIndex++ % t_sharedStacks.size()];
+}
+
 Fiber::Fiber() : m_id(0), m_stackSize(0), m_stack(nullptr){
     m_state = EXEC;
     SetThis(this);
-    SYLAR_ASSERT(!getcontext(&m_ctx));
+    m_ctx.init();
     ++s_fiber_count;
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stackSize, bool use_caller)
-    : m_id(++s_fiber_id), m_useCaller(use_caller), m_state(INIT), m_cb(cb) {
+Fiber::Fiber(Task cb, size_t stackSize, bool use_caller, bool shared_stack)
+    : m_id(++s_fiber_id), m_useCaller(use_caller), m_state(INIT), m_stack(nullptr), m_cb(std::move(cb)) {
     ++s_fiber_count;
+#ifndef SYLAR_FIBER_CONTEXT_UCONTEXT
+    m_sharedMode = shared_stack && !use_caller;
+#endif
+    if (m_sharedMode) {
+        // the context is made on the shared stack at the first swapIn
+        m_stackSize = 0;
+        return;
+    }
     m_stackSize = stackSize ? stackSize : g_fiber_stack_size->getValue();
-    m_stack = malloc(m_stackSize);
-    SYLAR_ASSERT(!getcontext(&m_ctx));
-    m_ctx.uc_link = nullptr;                // The context of associated Fiber
-    m_ctx.uc_stack.ss_sp = m_stack;         // The pointer to stack of this Fiber
-    m_ctx.uc_stack.ss_size = m_stackSize;   // The size of this Fiber's stack
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    m_stack = StackAllocator::Alloc(m_stackSize);
+    m_ctx.make(m_stack, m_stackSize, &Fiber::MainFunc);
 }
 
 Fiber::~Fiber() {
     --s_fiber_count;
-    if (m_stack) {
+    clearLocals();
+    if (m_sharedMode) {
         SYLAR_ASSERT(m_state == TERM || m_state == EXECPT || m_state == INIT);
-        free(m_stack);
+        if (m_sharedStack) {
+            SharedStack::MutexType::Lock lock(m_sharedStack->mutex);
+            if (m_sharedStack->occupant == this) {
+                m_sharedStack->occupant = nullptr;
+            }
+        }
+        free(m_saveBuffer);
+    } else if (m_stack) {
+        SYLAR_ASSERT(m_state == TERM || m_state == EXECPT || m_state == INIT);
+        StackAllocator::Dealloc(m_stack, m_stackSize);
     } else {
         SYLAR_ASSERT(!m_cb && m_state == EXEC);
         if (t_fiber == this) {
@@ -47,35 +100,85 @@ Fiber::~Fiber() {
     }
 }
 
-void Fiber::reset(std::function<void()> cb) {
-    SYLAR_ASSERT(m_stack);
+void Fiber::reset(Task cb) {
+    SYLAR_ASSERT(m_stack || m_sharedMode);
     SYLAR_ASSERT(m_state == TERM || m_state == EXECPT || m_state == INIT);
-    m_cb = cb;
-    SYLAR_ASSERT(!getcontext(&m_ctx));
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stackSize;
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    clearLocals();
+    m_cb = std::move(cb);
+    if (!m_sharedMode) {
+        m_ctx.make(m_stack, m_stackSize, &Fiber::MainFunc);
+    }
     m_state = INIT;
 }
 
 void Fiber::swapIn() {
     SetThis(this);
     SYLAR_ASSERT(m_state != EXEC);
-    m_state = EXEC;
-    if (m_useCaller) {
-        SYLAR_ASSERT(!swapcontext(&t_threadFiber->m_ctx, &m_ctx));
-    } else {
-        SYLAR_ASSERT(!swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx));
+    if (m_sharedMode) {
+        switchSharedStack();
     }
+    m_state = EXEC;
+    m_running.store(true, std::memory_order_relaxed);
+    FiberContext::Swap(&GetMainFiber(m_useCaller)->m_ctx, &m_ctx);
+    m_running.store(false, std::memory_order_release);
 }
 
 void Fiber::swapOut() {
     SetThis(t_threadFiber.get());
-    if (m_useCaller) {
-        SYLAR_ASSERT(!swapcontext(&m_ctx, &t_threadFiber->m_ctx));
+    FiberContext::Swap(&m_ctx, &GetMainFiber(m_useCaller)->m_ctx);
+}
+
+Fiber* Fiber::GetMainFiber(bool use_caller) {
+    Fiber* main_fiber = use_caller ? nullptr : Scheduler::GetMainFiber();
+    // fibers swapped in outside of a scheduler return to the thread fiber
+    return main_fiber ? main_fiber : t_threadFiber.get();
+}
+
+void Fiber::switchSharedStack() {
+#ifndef SYLAR_FIBER_CONTEXT_UCONTEXT
+    if (!m_sharedStack) {
+        m_sharedStack = GetSharedStack();
+        m_thread = GetThreadID();
+    }
+    SYLAR_ASSERT(m_thread == GetThreadID());
+    SharedStack::MutexType::Lock lock(m_sharedStack->mutex);
+    Fiber* occupant = m_sharedStack->occupant;
+    if (occupant == this && m_state != INIT) {
+        return;
+    }
+    if (occupant && occupant != this) {
+        occupant->saveStack();
+    }
+    m_sharedStack->occupant = this;
+    if (m_state == INIT) {
+        m_saveSize = 0;
+        m_ctx.make(m_sharedStack->stack, m_sharedStack->size, &Fiber::MainFunc);
     } else {
-        SYLAR_ASSERT(!swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx));
+        restoreStack();
+    }
+#endif
+}
+
+void Fiber::saveStack() {
+#ifndef SYLAR_FIBER_CONTEXT_UCONTEXT
+    if (m_state != HOLD && m_state != READY) {
+        m_saveSize = 0;
+        return;
+    }
+    char* sp = (char*)m_ctx.getStackPointer();
+    m_saveSize = m_sharedStack->top - sp;
+    if (m_saveSize > m_saveCapacity) {
+        free(m_saveBuffer);
+        m_saveBuffer = (char*)malloc(m_saveSize);
+        m_saveCapacity = m_saveSize;
+    }
+    memcpy(m_saveBuffer, sp, m_saveSize);
+#endif
+}
+
+void Fiber::restoreStack() {
+    if (m_saveSize) {
+        memcpy(m_sharedStack->top - m_saveSize, m_saveBuffer, m_saveSize);
     }
 }
 
@@ -117,6 +220,48 @@ uint64_t Fiber::TotalFibers() {
     return s_fiber_count;
 }
 
+void Fiber::clearLocals() {
+    // a destructor may set other slots again, retry a few times like pthread keys
+    for (int round = 0; round < 4; ++round) {
+        bool destroyed = false;
+        for (auto& i : m_locals) {
+            if (i.value) {
+                void* value = i.value;
+                i.value = nullptr;
+                i.destroy(value);
+                destroyed = true;
+            }
+        }
+        if (!destroyed) {
+            break;
+        }
+    }
+}
+
+size_t Fiber::NewLocalSlot() {
+    return s_local_slot++;
+}
+
+void* Fiber::GetLocal(size_t slot) {
+    Fiber* cur = t_fiber ? t_fiber : GetThis().get();
+    return slot < cur->m_locals.size() ? cur->m_locals[slot].value : nullptr;
+}
+
+void Fiber::SetLocal(size_t slot, void* value, void (*destroy)(void*)) {
+    Fiber* cur = t_fiber ? t_fiber : GetThis().get();
+    if (slot >= cur->m_locals.size()) {
+        cur->m_locals.resize(slot + 1);
+    }
+    LocalSlot& local = cur->m_locals[slot];
+    void* old_value = local.value;
+    void (*old_destroy)(void*) = local.destroy;
+    local.value = value;
+    local.destroy = destroy;
+    if (old_value) {
+        old_destroy(old_value);
+    }
+}
+
 void Fiber::MainFunc() {
     Fiber::ptr cur = GetThis();
     SYLAR_ASSERT(cur);
@@ -124,10 +269,12 @@ void Fiber::MainFunc() {
     {
         cur->m_cb();
         cur->m_cb = nullptr;
+        cur->clearLocals();
         cur->m_state = TERM;
     }
     catch(const std::exception& e)
     {
+        cur->clearLocals();
         cur->m_state = EXECPT;
         SYLAR_LOG_ERROR(g_logger) << "Fiber Except: " << e.what() << " fiber id="
                                   << cur->getID() << std::endl << BacktraceToString();
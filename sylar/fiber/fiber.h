@@ -1,13 +1,28 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <stdint.h>
-#include <ucontext.h>
+#include <sys/types.h>
+#include <vector>
+
+#include "fiber_context.h"
+#include "task.h"
 
 namespace sylar {
+struct SharedStack;
+
+/**
+ * A fiber created with shared_stack runs on one of a few large per-thread stacks.
+ * Its live frames are copied to a right-sized heap buffer only when another fiber
+ * claims the same stack, and it is pinned to the thread of its first swapIn.
+ * Code running on a shared stack must not hand pointers to its stack objects to
+ * other fibers across a yield. Requires the asm context backend.
+ */
 class Fiber : public std::enable_shared_from_this<Fiber> {
 friend class Scheduler;
+template<typename> friend class FiberLocal;
 public:
     enum State { 
         INIT,
@@ -19,13 +34,18 @@ public:
     };
     typedef std::shared_ptr<Fiber> ptr;
 
-    Fiber(std::function<void()> cb, size_t stackSize = 0, bool use_caller = false);
+    Fiber(Task cb, size_t stackSize = 0, bool use_caller = false,
+          bool shared_stack = false);
     ~Fiber();
-    void reset(std::function<void()> cb);
+    void reset(Task cb);
     void swapIn();
     void swapOut();
     uint64_t getID() const { return m_id; }
     State getState() const { return m_state; }
+    bool isSharedStack() const { return m_sharedMode; }
+    pid_t getThread() const { return m_thread; }
+    // true until swapIn returns, a HOLD fiber may still be leaving its stack
+    bool isRunning() const { return m_running.load(std::memory_order_acquire); }
 
     static void SetThis(Fiber *f);
     static Fiber::ptr GetThis();
@@ -36,15 +56,38 @@ public:
     static uint64_t TotalFibers();
 
 private:
+    struct LocalSlot {
+        void* value = nullptr;
+        void (*destroy)(void*) = nullptr;
+    };
+
     Fiber();
+    static Fiber* GetMainFiber(bool use_caller);
+    void switchSharedStack();
+    void saveStack();
+    void restoreStack();
+    void clearLocals();
+
+    static size_t NewLocalSlot();
+    static void* GetLocal(size_t slot);
+    // destroys the previous value of the slot
+    static void SetLocal(size_t slot, void* value, void (*destroy)(void*));
 
 private:
     uint64_t m_id;
     uint32_t m_stackSize;
     bool m_useCaller;
     Fiber::State m_state;
-    ucontext_t m_ctx;
+    std::atomic<bool> m_running {false};
+    FiberContext m_ctx;
     void *m_stack;
-    std::function<void()> m_cb;
+    Task m_cb;
+    bool m_sharedMode = false;
+    pid_t m_thread = -1;                            // thread owning the shared stack
+    std::shared_ptr<SharedStack> m_sharedStack;
+    char* m_saveBuffer = nullptr;
+    uint32_t m_saveSize = 0;
+    uint32_t m_saveCapacity = 0;
+    std::vector<LocalSlot> m_locals;                // FiberLocal values by slot
 };
 }
\ No newline at end of file
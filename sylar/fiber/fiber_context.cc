@@ -0,0 +1,151 @@
+#include "fiber_context.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef SYLAR_FIBER_CONTEXT_UCONTEXT
+extern "C" void sylar_fiber_context_swap(void** from_sp, void* to_sp);
+
+#if defined(__x86_64__)
+// stack layout (low -> high): mxcsr/x87 cw, r15, r14, r13, r12, rbx, rbp, return address
+asm(R"(
+    .text
+    .globl sylar_fiber_context_swap
+    .hidden sylar_fiber_context_swap
+    .type sylar_fiber_context_swap, @function
+    .align 16
+sylar_fiber_context_swap:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size sylar_fiber_context_swap, .-sylar_fiber_context_swap
+    .section .note.GNU-stack,"",@progbits
+    .text
+)");
+#elif defined(__aarch64__)
+// stack layout (low -> high): d8-d15, x19-x28, x29, x30
+asm(R"(
+    .text
+    .globl sylar_fiber_context_swap
+    .hidden sylar_fiber_context_swap
+    .type sylar_fiber_context_swap, %function
+    .align 4
+sylar_fiber_context_swap:
+    sub sp, sp, #0xb0
+    stp d8, d9, [sp, #0x00]
+    stp d10, d11, [sp, #0x10]
+    stp d12, d13, [sp, #0x20]
+    stp d14, d15, [sp, #0x30]
+    stp x19, x20, [sp, #0x40]
+    stp x21, x22, [sp, #0x50]
+    stp x23, x24, [sp, #0x60]
+    stp x25, x26, [sp, #0x70]
+    stp x27, x28, [sp, #0x80]
+    stp x29, x30, [sp, #0x90]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0x00]
+    ldp d10, d11, [sp, #0x10]
+    ldp d12, d13, [sp, #0x20]
+    ldp d14, d15, [sp, #0x30]
+    ldp x19, x20, [sp, #0x40]
+    ldp x21, x22, [sp, #0x50]
+    ldp x23, x24, [sp, #0x60]
+    ldp x25, x26, [sp, #0x70]
+    ldp x27, x28, [sp, #0x80]
+    ldp x29, x30, [sp, #0x90]
+    add sp, sp, #0xb0
+    ret
+    .size sylar_fiber_context_swap, .-sylar_fiber_context_swap
+    .section .note.GNU-stack,"",%progbits
+    .text
+)");
+#endif
+#endif
+
+namespace sylar {
+#ifdef SYLAR_FIBER_CONTEXT_UCONTEXT
+FiberContext::FiberContext() {
+    memset(&m_ctx, 0, sizeof(m_ctx));
+}
+
+void FiberContext::init() {
+    SYLAR_ASSERT(!getcontext(&m_ctx));
+}
+
+void FiberContext::make(void* stack, size_t size, EntryFunc entry) {
+    SYLAR_ASSERT(!getcontext(&m_ctx));
+    m_ctx.uc_link = nullptr;                // The context of associated Fiber
+    m_ctx.uc_stack.ss_sp = stack;           // The pointer to stack of this Fiber
+    m_ctx.uc_stack.ss_size = size;          // The size of this Fiber's stack
+    makecontext(&m_ctx, entry, 0);
+}
+
+void FiberContext::Swap(FiberContext* from, FiberContext* to) {
+    SYLAR_ASSERT(!swapcontext(&from->m_ctx, &to->m_ctx));
+}
+
+const char* FiberContext::Backend() {
+    return "ucontext";
+}
+#else
+FiberContext::FiberContext() : m_sp(nullptr) {}
+
+void FiberContext::init() {
+    // the running context is saved on the first Swap
+    m_sp = nullptr;
+}
+
+void FiberContext::make(void* stack, size_t size, EntryFunc entry) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    void** sp = (void**)top;
+#if defined(__x86_64__)
+    *--sp = nullptr;                        // fake return address of entry, keeps the abi alignment
+    *--sp = (void*)entry;                   // ret jumps here
+    for (int i = 0; i < 6; ++i) {
+        *--sp = nullptr;                    // rbp rbx r12 r13 r14 r15
+    }
+    uint32_t* csr = (uint32_t*)--sp;
+    csr[0] = 0x1F80;                        // default mxcsr
+    csr[1] = 0x037F;                        // default x87 control word
+#elif defined(__aarch64__)
+    sp -= 0xb0 / sizeof(void*);
+    memset(sp, 0, 0xb0);
+    sp[0x98 / sizeof(void*)] = (void*)entry;    // x30, ret jumps here
+#endif
+    m_sp = sp;
+}
+
+void FiberContext::Swap(FiberContext* from, FiberContext* to) {
+    sylar_fiber_context_swap(&from->m_sp, to->m_sp);
+}
+
+const char* FiberContext::Backend() {
+#if defined(__x86_64__)
+    return "asm-x86_64";
+#else
+    return "asm-aarch64";
+#endif
+}
+#endif
+}
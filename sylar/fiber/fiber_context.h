@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+
+#if defined(SYLAR_FIBER_UCONTEXT) || !(defined(__x86_64__) || defined(__aarch64__))
+#define SYLAR_FIBER_CONTEXT_UCONTEXT 1
+#include <ucontext.h>
+#endif
+
+namespace sylar {
+/**
+ * Register context of a fiber. The asm backend only saves callee-saved registers
+ * and never touches the signal mask; ucontext is kept as fallback and is selected
+ * with -DSYLAR_FIBER_UCONTEXT=ON or on unsupported architectures.
+ */
+class FiberContext {
+public:
+    typedef void (*EntryFunc)();
+
+    FiberContext();
+    void init();
+    void make(void* stack, size_t size, EntryFunc entry);
+
+#ifndef SYLAR_FIBER_CONTEXT_UCONTEXT
+    void* getStackPointer() const { return m_sp; }
+#endif
+
+    static void Swap(FiberContext* from, FiberContext* to);
+    static const char* Backend();
+
+private:
+#ifdef SYLAR_FIBER_CONTEXT_UCONTEXT
+    ucontext_t m_ctx;
+#else
+    void* m_sp;
+#endif
+};
+}
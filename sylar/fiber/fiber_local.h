@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <utility>
+
+#include "fiber.h"
+#include "noncopyable.h"
+
+namespace sylar {
+/**
+ * Per-fiber variable, the fiber counterpart of thread_local. Values live in the
+ * current Fiber and follow it across worker threads. Each FiberLocal owns a slot
+ * index, so access is a vector lookup. Values are destroyed when the fiber
+ * terminates, is reset or is destroyed. Slots are never reused, so define
+ * FiberLocal objects as statics or long-lived members.
+ *
+ *   static FiberLocal<std::string> s_traceId;
+ *   s_traceId.set(request->getHeader("X-Trace-Id"));
+ *   ... any fiber-aware code later: s_traceId.get()
+ */
+template<typename T>
+class FiberLocal : Noncopyable {
+public:
+    FiberLocal() : m_slot(Fiber::NewLocalSlot()) {}
+
+    // default constructs the value on first access in this fiber
+    T& get() {
+        T* v = (T*)Fiber::GetLocal(m_slot);
+        if (!v) {
+            v = new T();
+            Fiber::SetLocal(m_slot, v, &Destroy);
+        }
+        return *v;
+    }
+
+    // nullptr if the current fiber has no value
+    T* tryGet() const {
+        return (T*)Fiber::GetLocal(m_slot);
+    }
+
+    void set(T v) {
+        T* cur = (T*)Fiber::GetLocal(m_slot);
+        if (cur) {
+            *cur = std::move(v);
+        } else {
+            Fiber::SetLocal(m_slot, new T(std::move(v)), &Destroy);
+        }
+    }
+
+    bool has() const { return tryGet() != nullptr; }
+
+    void reset() {
+        Fiber::SetLocal(m_slot, nullptr, nullptr);
+    }
+
+    T& operator*() { return get(); }
+    T* operator->() { return &get(); }
+
+private:
+    static void Destroy(void* v) {
+        delete (T*)v;
+    }
+
+private:
+    size_t m_slot;
+};
+}
@@ -0,0 +1,274 @@
+#include "clock.h"
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "util.h"
+
+namespace sylar {
+FiberWaitQueue::Waiter::ptr FiberWaitQueue::NewWaiter(uint64_t timeout_ms) {
+    Waiter::ptr waiter = std::make_shared<Waiter>();
+    waiter->scheduler = Scheduler::GetThis();
+    waiter->fiber = Fiber::GetThis();
+    SYLAR_ASSERT(waiter->scheduler);
+    if (timeout_ms != ~0ull) {
+        waiter->iomanager = IOManager::GetThis();
+        // timed waits rely on IOManager timers
+        SYLAR_ASSERT(waiter->iomanager);
+        std::weak_ptr<Waiter> weak_waiter(waiter);
+        waiter->timer = waiter->iomanager->addTimer(timeout_ms, [weak_waiter](){
+            Waiter::ptr waiter = weak_waiter.lock();
+            int expect = Waiter::WAITING;
+            // the parked fiber removes itself from the queue once it runs
+            if (waiter && waiter->state.compare_exchange_strong(expect, Waiter::TIMEOUT)) {
+                waiter->scheduler->schedule(waiter->fiber);
+            }
+        });
+    }
+    return waiter;
+}
+
+bool FiberWaitQueue::Park(const Waiter::ptr& waiter) {
+    Fiber::YeildToHold();
+    if (waiter->state == Waiter::TIMEOUT) {
+        return false;
+    }
+    if (waiter->timer) {
+        waiter->iomanager->cancel(waiter->timer);
+    }
+    return true;
+}
+
+uint64_t FiberWaitQueue::Deadline(uint64_t timeout_ms) {
+    if (timeout_ms == ~0ull) {
+        return ~0ull;
+    }
+    return GetMonotonicMS() + timeout_ms;
+}
+
+bool FiberWaitQueue::Remaining(uint64_t deadline, uint64_t& timeout_ms) {
+    if (deadline == ~0ull) {
+        timeout_ms = ~0ull;
+        return true;
+    }
+    uint64_t now = GetMonotonicMS();
+    if (now >= deadline) {
+        return false;
+    }
+    timeout_ms = deadline - now;
+    return true;
+}
+
+FiberWaitQueue::Waiter::ptr FiberWaitQueue::push(uint64_t timeout_ms) {
+    Waiter::ptr waiter = NewWaiter(timeout_ms);
+    waiter->it = m_waiters.insert(m_waiters.end(), waiter);
+    return waiter;
+}
+
+bool FiberWaitQueue::park(Spinlock::Lock& lock, const Waiter::ptr& waiter) {
+    lock.unlock();
+    bool rt = Park(waiter);
+    lock.lock();
+    if (!rt && waiter->queued) {
+        m_waiters.erase(waiter->it);
+        waiter->queued = false;
+    }
+    return rt;
+}
+
+void FiberWaitQueue::add(const Waiter::ptr& waiter) {
+    waiter->queued = false;
+    m_waiters.push_back(waiter);
+}
+
+void FiberWaitQueue::remove(const Waiter::ptr& waiter) {
+    for (auto it = m_waiters.begin(); it != m_waiters.end(); ++it) {
+        if (*it == waiter) {
+            m_waiters.erase(it);
+            return;
+        }
+    }
+}
+
+bool FiberWaitQueue::notify() {
+    while (!m_waiters.empty()) {
+        Waiter::ptr waiter = m_waiters.front();
+        m_waiters.pop_front();
+        waiter->queued = false;
+        int expect = Waiter::WAITING;
+        if (waiter->state.compare_exchange_strong(expect, Waiter::NOTIFIED)) {
+            waiter->scheduler->schedule(waiter->fiber);
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t FiberWaitQueue::notifyAll() {
+    size_t count = 0;
+    while (notify()) {
+        ++count;
+    }
+    return count;
+}
+
+void FiberMutex::lock() {
+    Spinlock::Lock lock(m_mutex);
+    if (!m_locked) {
+        m_locked = true;
+        return;
+    }
+    // unlock() hands the mutex over, no need to retry
+    m_waiters.park(lock, m_waiters.push());
+}
+
+bool FiberMutex::tryLock() {
+    Spinlock::Lock lock(m_mutex);
+    if (m_locked) {
+        return false;
+    }
+    m_locked = true;
+    return true;
+}
+
+void FiberMutex::unlock() {
+    Spinlock::Lock lock(m_mutex);
+    SYLAR_ASSERT(m_locked);
+    if (!m_waiters.notify()) {
+        m_locked = false;
+    }
+}
+
+void FiberRWMutex::rdlock() {
+    Spinlock::Lock lock(m_mutex);
+    // queue behind waiting writers so they can't starve
+    if (!m_writer && m_writeWaiters.empty()) {
+        ++m_readers;
+        return;
+    }
+    m_readWaiters.park(lock, m_readWaiters.push());
+}
+
+void FiberRWMutex::wrlock() {
+    Spinlock::Lock lock(m_mutex);
+    if (!m_writer && m_readers == 0) {
+        m_writer = true;
+        return;
+    }
+    m_writeWaiters.park(lock, m_writeWaiters.push());
+}
+
+void FiberRWMutex::unlock() {
+    Spinlock::Lock lock(m_mutex);
+    if (m_writer) {
+        m_writer = false;
+        // waiting readers go first after a writer, then the next writer
+        m_readers += m_readWaiters.notifyAll();
+        if (m_readers == 0 && m_writeWaiters.notify()) {
+            m_writer = true;
+        }
+    } else {
+        SYLAR_ASSERT(m_readers > 0);
+        if (--m_readers == 0 && m_writeWaiters.notify()) {
+            m_writer = true;
+        }
+    }
+}
+
+void FiberCondVar::wait(FiberMutex::Lock& lock) {
+    waitFor(lock, ~0ull);
+}
+
+bool FiberCondVar::waitFor(FiberMutex::Lock& lock, uint64_t timeout_ms) {
+    bool rt = false;
+    {
+        Spinlock::Lock spin_lock(m_mutex);
+        FiberWaitQueue::Waiter::ptr waiter = m_waiters.push(timeout_ms);
+        // queued before unlocking, so a notify in between is not lost
+        lock.unlock();
+        rt = m_waiters.park(spin_lock, waiter);
+    }
+    lock.lock();
+    return rt;
+}
+
+void FiberCondVar::notify() {
+    Spinlock::Lock lock(m_mutex);
+    m_waiters.notify();
+}
+
+void FiberCondVar::notifyAll() {
+    Spinlock::Lock lock(m_mutex);
+    m_waiters.notifyAll();
+}
+
+void FiberSemaphore::wait() {
+    waitFor(~0ull);
+}
+
+bool FiberSemaphore::waitFor(uint64_t timeout_ms) {
+    Spinlock::Lock lock(m_mutex);
+    if (m_count > 0) {
+        --m_count;
+        return true;
+    }
+    // notify() hands the count over instead of incrementing it
+    return m_waiters.park(lock, m_waiters.push(timeout_ms));
+}
+
+bool FiberSemaphore::tryWait() {
+    Spinlock::Lock lock(m_mutex);
+    if (m_count == 0) {
+        return false;
+    }
+    --m_count;
+    return true;
+}
+
+void FiberSemaphore::notify() {
+    Spinlock::Lock lock(m_mutex);
+    if (!m_waiters.notify()) {
+        ++m_count;
+    }
+}
+
+uint32_t FiberSemaphore::getCount() {
+    Spinlock::Lock lock(m_mutex);
+    return m_count;
+}
+
+void WaitGroup::add(uint32_t count) {
+    Spinlock::Lock lock(m_mutex);
+    m_count += count;
+}
+
+void WaitGroup::done() {
+    Spinlock::Lock lock(m_mutex);
+    SYLAR_ASSERT(m_count > 0);
+    if (--m_count == 0) {
+        m_waiters.notifyAll();
+    }
+}
+
+void WaitGroup::wait() {
+    waitFor(~0ull);
+}
+
+bool WaitGroup::waitFor(uint64_t timeout_ms) {
+    // a wakeup with work left waits only for the rest of the timeout
+    uint64_t deadline = FiberWaitQueue::Deadline(timeout_ms);
+    Spinlock::Lock lock(m_mutex);
+    while (m_count > 0) {
+        if (!FiberWaitQueue::Remaining(deadline, timeout_ms)
+                || !m_waiters.park(lock, m_waiters.push(timeout_ms))) {
+            return m_count == 0;
+        }
+    }
+    return true;
+}
+
+uint32_t WaitGroup::getCount() {
+    Spinlock::Lock lock(m_mutex);
+    return m_count;
+}
+}
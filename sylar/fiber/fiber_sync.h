@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <stdint.h>
+
+#include "fiber.h"
+#include "mutex.h"
+
+namespace sylar {
+class IOManager;
+class Scheduler;
+class Timer;
+
+/**
+ * Fibers parked on a fiber synchronization primitive. A parked fiber gives its
+ * thread back to the scheduler with YeildToHold and is rescheduled by notify()
+ * or by an IOManager timer for timed waits. Guarded by the owner's Spinlock.
+ */
+class FiberWaitQueue {
+public:
+    struct Waiter {
+        typedef std::shared_ptr<Waiter> ptr;
+        enum State {
+            WAITING,
+            NOTIFIED,
+            TIMEOUT,
+        };
+
+        Scheduler* scheduler = nullptr;
+        Fiber::ptr fiber;
+        std::atomic<int> state {WAITING};
+        bool queued = true;
+        std::list<ptr>::iterator it;
+        IOManager* iomanager = nullptr;
+        std::shared_ptr<Timer> timer;
+    };
+
+    // a waiter for the current fiber, timeout_ms = ~0ull waits forever
+    static Waiter::ptr NewWaiter(uint64_t timeout_ms = ~0ull);
+    // yield until notified, false on timeout
+    static bool Park(const Waiter::ptr& waiter);
+    // monotonic deadline of a timeout, ~0ull stays forever
+    static uint64_t Deadline(uint64_t timeout_ms);
+    // timeout left until deadline, false once it has passed
+    static bool Remaining(uint64_t deadline, uint64_t& timeout_ms);
+
+    // add the current fiber
+    Waiter::ptr push(uint64_t timeout_ms = ~0ull);
+    // Park() with lock released while parked, a timed out waiter leaves the queue
+    bool park(Spinlock::Lock& lock, const Waiter::ptr& waiter);
+    // for a waiter watching several queues, removed with remove()
+    void add(const Waiter::ptr& waiter);
+    void remove(const Waiter::ptr& waiter);
+    // wake the oldest waiter that has not timed out
+    bool notify();
+    size_t notifyAll();
+    bool empty() const { return m_waiters.empty(); }
+
+private:
+    std::list<Waiter::ptr> m_waiters;
+};
+
+class FiberMutex : Noncopyable {
+public:
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    void lock();
+    bool tryLock();
+    void unlock();
+
+private:
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+    bool m_locked = false;
+};
+
+class FiberRWMutex : Noncopyable {
+public:
+    typedef ReadScopedLockImpl<FiberRWMutex> ReadLock;
+    typedef WriteScopedLockImpl<FiberRWMutex> WriteLock;
+
+    void rdlock();
+    void wrlock();
+    void unlock();
+
+private:
+    Spinlock m_mutex;
+    FiberWaitQueue m_readWaiters;
+    FiberWaitQueue m_writeWaiters;
+    uint32_t m_readers = 0;
+    bool m_writer = false;
+};
+
+class FiberCondVar : Noncopyable {
+public:
+    void wait(FiberMutex::Lock& lock);
+    // false if timeout_ms passed, the lock is held again either way
+    bool waitFor(FiberMutex::Lock& lock, uint64_t timeout_ms);
+    void notify();
+    void notifyAll();
+
+private:
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+class FiberSemaphore : Noncopyable {
+public:
+    FiberSemaphore(uint32_t count = 0) : m_count(count) {}
+
+    void wait();
+    bool waitFor(uint64_t timeout_ms);
+    bool tryWait();
+    void notify();
+    uint32_t getCount();
+
+private:
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+    uint32_t m_count;
+};
+
+/**
+ * Counts outstanding work, wait() parks until the count drops to zero.
+ * add() before starting the work, done() when it finishes.
+ */
+class WaitGroup : Noncopyable {
+public:
+    WaitGroup(uint32_t count = 0) : m_count(count) {}
+
+    void add(uint32_t count = 1);
+    void done();
+    void wait();
+    // false on timeout
+    bool waitFor(uint64_t timeout_ms);
+    uint32_t getCount();
+
+private:
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+    uint32_t m_count;
+};
+}
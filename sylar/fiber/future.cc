@@ -0,0 +1,104 @@
+#include "future.h"
+#include "util.h"
+
+namespace sylar {
+bool FutureStateBase::isReady() {
+    Spinlock::Lock lock(m_mutex);
+    return m_state != PENDING;
+}
+
+void FutureStateBase::wait() {
+    Spinlock::Lock lock(m_mutex);
+    while (m_state == PENDING) {
+        m_waiters.park(lock, m_waiters.push());
+    }
+}
+
+bool FutureStateBase::waitFor(uint64_t timeout_ms) {
+    uint64_t deadline = FiberWaitQueue::Deadline(timeout_ms);
+    Spinlock::Lock lock(m_mutex);
+    while (m_state == PENDING) {
+        if (!FiberWaitQueue::Remaining(deadline, timeout_ms)
+                || !m_waiters.park(lock, m_waiters.push(timeout_ms))) {
+            break;
+        }
+    }
+    return m_state != PENDING;
+}
+
+void FutureStateBase::onReady(Task cb) {
+    {
+        Spinlock::Lock lock(m_mutex);
+        if (m_state == PENDING) {
+            m_callbacks.push_back(std::move(cb));
+            return;
+        }
+    }
+    cb();
+}
+
+bool FutureStateBase::setException(std::exception_ptr error) {
+    Spinlock::Lock lock(m_mutex);
+    if (m_state != PENDING) {
+        return false;
+    }
+    m_error = error;
+    finish(lock, ERROR);
+    return true;
+}
+
+void FutureStateBase::check() {
+    if (m_state == ERROR) {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void FutureStateBase::releasePromise() {
+    if (--m_promises == 0) {
+        setException(std::make_exception_ptr(
+                    std::future_error(std::future_errc::broken_promise)));
+    }
+}
+
+void FutureStateBase::finish(Spinlock::Lock& lock, State state) {
+    m_state = state;
+    m_waiters.notifyAll();
+    std::vector<Task> callbacks;
+    callbacks.swap(m_callbacks);
+    lock.unlock();
+    for (auto& cb : callbacks) {
+        cb();
+    }
+}
+
+Future<void> WhenAll(const std::vector<FutureStateBase::ptr>& states) {
+    Promise<void> promise;
+    Future<void> future = promise.getFuture();
+    if (states.empty()) {
+        promise.setValue();
+        return future;
+    }
+    std::shared_ptr<std::atomic<size_t>> left = std::make_shared<std::atomic<size_t>>(states.size());
+    for (auto& i : states) {
+        i->onReady([promise, left](){
+            if (--*left == 0) {
+                promise.setValue();
+            }
+        });
+    }
+    return future;
+}
+
+Future<size_t> WhenAny(const std::vector<FutureStateBase::ptr>& states) {
+    SYLAR_ASSERT(!states.empty());
+    Promise<size_t> promise;
+    Future<size_t> future = promise.getFuture();
+    for (size_t i = 0; i < states.size(); ++i) {
+        // later completions find the promise already set
+        states[i]->onReady([promise, i](){
+            promise.setValue(i);
+        });
+    }
+    return future;
+}
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <future>
+#include <memory>
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fiber_sync.h"
+#include "scheduler.h"
+#include "task.h"
+
+namespace sylar {
+/**
+ * State shared by a Promise and its Futures. Waiting parks the fiber, so
+ * wait() and get() must be called from a fiber running in a Scheduler.
+ */
+class FutureStateBase : Noncopyable {
+public:
+    typedef std::shared_ptr<FutureStateBase> ptr;
+    enum State {
+        PENDING,
+        VALUE,
+        ERROR,
+    };
+
+    virtual ~FutureStateBase() {}
+
+    bool isReady();
+    void wait();
+    // false on timeout
+    bool waitFor(uint64_t timeout_ms);
+    // cb runs once the state is ready, right away if it already is. It runs in
+    // the fiber that completes the promise and must not block.
+    void onReady(Task cb);
+    bool setException(std::exception_ptr error);
+    // rethrow the stored exception, if any
+    void check();
+
+    void addPromise() { ++m_promises; }
+    // the last promise gone with no result breaks the future
+    void releasePromise();
+
+protected:
+    // called with m_mutex held, unlocks it
+    void finish(Spinlock::Lock& lock, State state);
+
+protected:
+    Spinlock m_mutex;
+    State m_state = PENDING;
+
+private:
+    std::exception_ptr m_error;
+    FiberWaitQueue m_waiters;
+    std::vector<Task> m_callbacks;
+    std::atomic<uint32_t> m_promises {0};
+};
+
+template<typename T>
+class FutureState : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    ~FutureState() {
+        if (m_state == VALUE) {
+            value().~T();
+        }
+    }
+
+    // false if a result was already set
+    bool setValue(T&& v) {
+        Spinlock::Lock lock(m_mutex);
+        if (m_state != PENDING) {
+            return false;
+        }
+        new (&m_storage) T(std::move(v));
+        finish(lock, VALUE);
+        return true;
+    }
+
+    T& value() { return *(T*)&m_storage; }
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+};
+
+template<>
+class FutureState<void> : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    bool setValue() {
+        Spinlock::Lock lock(m_mutex);
+        if (m_state != PENDING) {
+            return false;
+        }
+        finish(lock, VALUE);
+        return true;
+    }
+
+    void value() {}
+};
+
+/**
+ * Read side of a result produced by another fiber. Copies share the result.
+ */
+template<typename T>
+class Future {
+public:
+    Future() {}
+    explicit Future(typename FutureState<T>::ptr state) : m_state(std::move(state)) {}
+
+    bool valid() const { return m_state != nullptr; }
+    bool isReady() const { return m_state->isReady(); }
+    void wait() const { m_state->wait(); }
+    bool waitFor(uint64_t timeout_ms) const { return m_state->waitFor(timeout_ms); }
+
+    // parks until ready, rethrows the producer's exception
+    typename std::add_lvalue_reference<T>::type get() const {
+        m_state->wait();
+        m_state->check();
+        return m_state->value();
+    }
+
+    void onReady(Task cb) const { m_state->onReady(std::move(cb)); }
+    FutureStateBase::ptr getState() const { return m_state; }
+
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+/**
+ * Write side of a Future. Copies share the state, once the last copy is
+ * destroyed without a result the future fails with broken_promise.
+ */
+template<typename T>
+class PromiseBase {
+public:
+    PromiseBase() : m_state(std::make_shared<FutureState<T>>()) {
+        m_state->addPromise();
+    }
+
+    PromiseBase(const PromiseBase& other) : m_state(other.m_state) {
+        m_state->addPromise();
+    }
+
+    PromiseBase& operator=(const PromiseBase& other) {
+        if (m_state != other.m_state) {
+            other.m_state->addPromise();
+            m_state->releasePromise();
+            m_state = other.m_state;
+        }
+        return *this;
+    }
+
+    ~PromiseBase() {
+        m_state->releasePromise();
+    }
+
+    Future<T> getFuture() const { return Future<T>(m_state); }
+    // false if a result was already set
+    bool setException(std::exception_ptr error) const { return m_state->setException(error); }
+
+protected:
+    typename FutureState<T>::ptr m_state;
+};
+
+template<typename T>
+class Promise : public PromiseBase<T> {
+public:
+    bool setValue(T&& v) const { return this->m_state->setValue(std::move(v)); }
+    bool setValue(const T& v) const {
+        T tmp(v);
+        return this->m_state->setValue(std::move(tmp));
+    }
+};
+
+template<>
+class Promise<void> : public PromiseBase<void> {
+public:
+    bool setValue() const { return m_state->setValue(); }
+};
+
+template<typename R>
+struct AsyncCall {
+    template<typename F>
+    static void Run(const Promise<R>& promise, F& f) { promise.setValue(f()); }
+};
+
+template<>
+struct AsyncCall<void> {
+    template<typename F>
+    static void Run(const Promise<void>& promise, F& f) {
+        f();
+        promise.setValue();
+    }
+};
+
+/**
+ * Run f as a fiber on the scheduler and return a Future of its result.
+ * Exceptions thrown by f are stored in the future instead of reaching
+ * Fiber::MainFunc.
+ */
+template<typename F>
+Future<typename std::result_of<F()>::type> Async(Scheduler* scheduler, F f, pid_t thread = -1) {
+    typedef typename std::result_of<F()>::type R;
+    Promise<R> promise;
+    Future<R> future = promise.getFuture();
+    scheduler->schedule([promise, f]() mutable {
+        try {
+            AsyncCall<R>::Run(promise, f);
+        } catch (...) {
+            promise.setException(std::current_exception());
+        }
+    }, thread);
+    return future;
+}
+
+// ready once every state is ready, results are read from the inputs
+Future<void> WhenAll(const std::vector<FutureStateBase::ptr>& states);
+// index of the first state to become ready
+Future<size_t> WhenAny(const std::vector<FutureStateBase::ptr>& states);
+
+template<typename T>
+Future<void> WhenAll(const std::vector<Future<T>>& futures) {
+    std::vector<FutureStateBase::ptr> states;
+    for (auto& i : futures) {
+        states.push_back(i.getState());
+    }
+    return WhenAll(states);
+}
+
+template<typename T>
+Future<size_t> WhenAny(const std::vector<Future<T>>& futures) {
+    std::vector<FutureStateBase::ptr> states;
+    for (auto& i : futures) {
+        states.push_back(i.getState());
+    }
+    return WhenAny(states);
+}
+
+// futures of mixed types, e.g. WhenAll(user_future, order_future)
+template<typename... Ts>
+Future<void> WhenAll(const Future<Ts>&... futures) {
+    return WhenAll(std::vector<FutureStateBase::ptr>{futures.getState()...});
+}
+
+template<typename... Ts>
+Future<size_t> WhenAny(const Future<Ts>&... futures) {
+    return WhenAny(std::vector<FutureStateBase::ptr>{futures.getState()...});
+}
+}
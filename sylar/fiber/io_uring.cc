@@ -0,0 +1,186 @@
+#include "io_uring.h"
+#include "log.h"
+#include "util.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sylar {
+static Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static int io_uring_setup(uint32_t entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, uint32_t opcode, void* arg, uint32_t nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static const uint8_t s_required_ops[] = {
+    IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV, IORING_OP_WRITEV,
+    IORING_OP_RECV, IORING_OP_SEND, IORING_OP_RECVMSG, IORING_OP_SENDMSG,
+    IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL,
+};
+
+IoUring* IoUring::Create(uint32_t entries) {
+    IoUring* ring = new IoUring;
+    if (!ring->init(entries)) {
+        delete ring;
+        return nullptr;
+    }
+    return ring;
+}
+
+bool IoUring::init(uint32_t entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // completions of parked fibers must not be dropped when the cq is full
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    m_fd = io_uring_setup(entries, &params);
+    if (m_fd < 0) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno
+            << " errstr=" << strerror(errno);
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_NODROP)) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring lacks IORING_FEAT_NODROP";
+        return false;
+    }
+
+    size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    std::unique_ptr<char[]> probe_buf(new char[probe_size]());
+    io_uring_probe* probe = (io_uring_probe*)probe_buf.get();
+    if (io_uring_register(m_fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring probe errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    for (uint8_t op : s_required_ops) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            SYLAR_LOG_WARN(g_logger) << "io_uring lacks opcode " << (int)op;
+            return false;
+        }
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        m_sqes = nullptr;
+        return false;
+    }
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (uint32_t*)(sq + params.sq_off.head);
+    m_sqTail = (uint32_t*)(sq + params.sq_off.tail);
+    m_sqFlags = (uint32_t*)(sq + params.sq_off.flags);
+    m_sqArray = (uint32_t*)(sq + params.sq_off.array);
+    m_sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (uint32_t*)(cq + params.cq_off.head);
+    m_cqTail = (uint32_t*)(cq + params.cq_off.tail);
+    m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    m_cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+    return true;
+}
+
+IoUring::~IoUring() {
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+uint32_t IoUring::submit(const io_uring_sqe* sqes, uint32_t count) {
+    MutexType::Lock lock(m_sqMutex);
+    // the kernel consumes sqes inside io_uring_enter, so the ring is empty here
+    uint32_t tail = *m_sqTail;
+    SYLAR_ASSERT(tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) + count <= m_sqEntries);
+    for (uint32_t i = 0; i < count; ++i, ++tail) {
+        uint32_t index = tail & m_sqMask;
+        m_sqes[index] = sqes[i];
+        m_sqArray[index] = index;
+    }
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+    uint32_t done = 0;
+    bool flushed = false;
+    while (done < count) {
+        int rt = io_uring_enter(m_fd, count - done, 0, 0);
+        if (rt > 0) {
+            done += rt;
+            continue;
+        }
+        if (rt < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rt == 0) {
+            errno = EAGAIN;
+        }
+        // EBUSY: the cq overflow backlog is not empty, EAGAIN: short of memory.
+        // Flushing the backlog may make room, only reaping the cq is sure to,
+        // and that takes the caller's completion callback
+        if ((errno == EBUSY || errno == EAGAIN) && !flushed) {
+            flushed = true;
+            flushOverflow();
+            continue;
+        }
+        if (errno != EBUSY && errno != EAGAIN) {
+            SYLAR_LOG_ERROR(g_logger) << "io_uring_enter(" << m_fd << ", " << count - done
+                << ") errno=" << errno << " errstr=" << strerror(errno);
+        }
+        // nothing reads the ring outside io_uring_enter, so sqes left there
+        // can be taken back, they would otherwise go in later with dangling user_data
+        int err = errno;
+        __atomic_store_n(m_sqTail, tail - (count - done), __ATOMIC_RELEASE);
+        errno = err;
+        break;
+    }
+    return done;
+}
+
+bool IoUring::flushOverflow() {
+    if (!(__atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)) {
+        return false;
+    }
+    io_uring_enter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+    return true;
+}
+}
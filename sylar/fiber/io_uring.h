@@ -0,0 +1,90 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <memory>
+#include <stdint.h>
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace sylar {
+/**
+ * Minimal io_uring ring on the raw syscalls, liburing is not required.
+ * Submission and completion sides each take their own Spinlock, so the
+ * worker threads of one IOManager can share the ring.
+ */
+class IoUring : Noncopyable {
+public:
+    typedef std::unique_ptr<IoUring> ptr;
+    typedef Spinlock MutexType;
+
+    // nullptr if the kernel lacks io_uring or one of the opcodes we use
+    static IoUring* Create(uint32_t entries);
+    ~IoUring();
+
+    int getFd() const { return m_fd; }
+    /**
+     * copy count prepared sqes into the ring and submit them, returns how many
+     * the kernel took. The rest are taken back out of the ring, errno tells why.
+     */
+    uint32_t submit(const io_uring_sqe* sqes, uint32_t count);
+
+    /**
+     * call f(user_data, res) for every completion, returns the number reaped.
+     * With wait = false it returns at once if another thread is reaping.
+     */
+    template<typename F>
+    size_t reap(F f, bool wait = true) {
+        if (wait) {
+            m_cqMutex.lock();
+        } else if (!m_cqMutex.tryLock()) {
+            return 0;
+        }
+        size_t count = 0;
+        while (true) {
+            uint32_t head = *m_cqHead;
+            uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+            if (head == tail) {
+                if (!flushOverflow()) {
+                    break;
+                }
+                continue;
+            }
+            for (; head != tail; ++head, ++count) {
+                const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+                f(cqe.user_data, cqe.res);
+            }
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        }
+        m_cqMutex.unlock();
+        return count;
+    }
+
+private:
+    IoUring() {}
+    bool init(uint32_t entries);
+    // move completions the kernel kept aside when the cq was full
+    bool flushOverflow();
+
+private:
+    int m_fd = -1;
+    MutexType m_sqMutex;
+    MutexType m_cqMutex;
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+    uint32_t* m_sqHead = nullptr;
+    uint32_t* m_sqTail = nullptr;
+    uint32_t* m_sqFlags = nullptr;
+    uint32_t* m_sqArray = nullptr;
+    uint32_t m_sqMask = 0;
+    uint32_t m_sqEntries = 0;
+    uint32_t* m_cqHead = nullptr;
+    uint32_t* m_cqTail = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+    uint32_t m_cqMask = 0;
+};
+}
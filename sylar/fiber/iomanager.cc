@@ -1,16 +1,30 @@
+#include "clock.h"
+#include "config.h"
+#include "io_uring.h"
 #include "iomanager.h"
 #include "log.h"
 #include "util.h"
 
-#include <fcntl.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 namespace sylar {
 static Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+static ConfigVar<std::string>::ptr g_iomanager_backend =
+    Config::Lookup<std::string>("iomanager.backend", "epoll", "iomanager backend, epoll or io_uring");
+static ConfigVar<uint32_t>::ptr g_iomanager_uring_entries =
+    Config::Lookup<uint32_t>("iomanager.uring_entries", 256, "io_uring submission queue size");
+static ConfigVar<bool>::ptr g_iomanager_persistent_epoll =
+    Config::Lookup<bool>("iomanager.persistent_epoll", false, "register fds once, edge triggered for both directions");
+static ConfigVar<bool>::ptr g_iomanager_sharded =
+    Config::Lookup<bool>("iomanager.sharded", false, "one epoll set per thread, fds stay on the thread owning them");
 static const uint64_t MAX_EVENT = 256;
 static const int MAX_TIMEOUT = 3000;
+// user_data tags, waiters are at least 4 byte aligned
+static const uint64_t URING_IGNORE = 0;
+static const uint64_t URING_TIMEOUT_TAG = 1;
 
 enum EpollCtlOp {
 
@@ -22,6 +36,8 @@ IOManager::FdContext::EventContext& IOManager::FdContext::getContext(Event event
             return read;
         case IOManager::WRITE:
             return write;
+        case IOManager::ERROR:
+            return error;
         default:
             SYLAR_ASSERT(false);
     }
@@ -34,6 +50,10 @@ void IOManager::FdContext::resetContext(EventContext& ctx) {
 }
 
 void IOManager::FdContext::triggerEvent(Event event) {
+    triggerEvent(event, owner);
+}
+
+void IOManager::FdContext::triggerEvent(Event event, pid_t thread) {
     if (!(events & event)) {
         SYLAR_LOG_ERROR(g_logger) << "fd=" << fd << " triggerEvent event=" << event << " events="
             << events << "\nbacktrace:\n" << BacktraceToString(100, 2, "    ");
@@ -42,75 +62,95 @@ void IOManager::FdContext::triggerEvent(Event event) {
     events = (Event)(events & ~event);
     EventContext& ctx = getContext(event);
     if (ctx.cb) {
-        ctx.scheduler->schedule(&ctx.cb);
+        ctx.scheduler->schedule(&ctx.cb, thread);
     } else {
-        ctx.scheduler->schedule(&ctx.fiber);
+        ctx.scheduler->schedule(&ctx.fiber, thread);
     }
     ctx.scheduler = nullptr;
 }
 
 IOManager::IOManager(size_t thread, bool use_caller, const std::string& name)
-    : Scheduler(thread, use_caller, name) {
-    m_epfd = epoll_create(1);
-    SYLAR_ASSERT(m_epfd != -1);
+    : Scheduler(thread, use_caller, name)
+    , TimerManager(g_iomanager_sharded->getValue() ? getThreadCount() : 1) {
+    m_sharded = g_iomanager_sharded->getValue();
+    m_reactors.resize(m_sharded ? getThreadCount() : 1);
+    for (auto& i : m_reactors) {
+        i.reset(new Reactor);
+        Reactor& reactor = *i;
+        reactor.epfd = epoll_create(1);
+        SYLAR_ASSERT(reactor.epfd != -1);
 
-    int rt = pipe(m_tickleFds);
-    SYLAR_ASSERT(rt != -1);
+        reactor.tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(reactor.tickleFd != -1);
 
-    epoll_event event;
-    // memset(&event, 0, sizeof(epoll_event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
+        epoll_event event;
+        // memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = &reactor;
 
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    SYLAR_ASSERT(rt != -1);
+        int rt = epoll_ctl(reactor.epfd, EPOLL_CTL_ADD, reactor.tickleFd, &event);
+        SYLAR_ASSERT(rt != -1);
+    }
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    SYLAR_ASSERT(rt != -1);
+    if (g_iomanager_backend->getValue() == "io_uring") {
+        m_uring.reset(IoUring::Create(g_iomanager_uring_entries->getValue()));
+        if (m_uring) {
+            for (auto& i : m_reactors) {
+                epoll_event event;
+                event.events = EPOLLIN | EPOLLET;
+                event.data.ptr = m_uring.get();
+                int rt = epoll_ctl(i->epfd, EPOLL_CTL_ADD, m_uring->getFd(), &event);
+                SYLAR_ASSERT(rt != -1);
+            }
+        } else {
+            SYLAR_LOG_WARN(g_logger) << "io_uring unavailable, " << name << " falls back to epoll";
+        }
+    }
 
-    contextResize(32);
+    m_persistent = g_iomanager_persistent_epoll->getValue();
     start();
 }
 
 IOManager::~IOManager() {
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (m_fdContexts[i]) {
-            delete m_fdContexts[i];
-        }
+    for (auto& i : m_reactors) {
+        close(i->epfd);
+        close(i->tickleFd);
     }
 }
 
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock lock_r(m_mutex);
-    if ((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock_r.unlock();
-    } else {
-        lock_r.unlock();
-        RWMutexType::WriteLock lock_w(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
-    }
+IOManager::FdContext* IOManager::getFdContext(int fd) {
+    FdContext* fd_ctx = m_fdContexts.getOrCreate(fd, [](FdContext& ctx, size_t index){
+        ctx.fd = index;
+    });
+    SYLAR_ASSERT(fd_ctx);
+    return fd_ctx;
+}
 
+int IOManager::addEvent(int fd, Event event, Task cb) {
+    FdContext* fd_ctx = getFdContext(fd);
     FdContext::MutexType::Lock lock(fd_ctx->mutex);
     if (fd_ctx->events & event) {
         SYLAR_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd << " event="
             << (EPOLL_EVENTS)event << " fd_ctx.event=" << (EPOLL_EVENTS)fd_ctx->events;
         SYLAR_ASSERT(!(fd_ctx->events & event));
     }
+    if (fd_ctx->reactor == -1) {
+        int index = m_sharded ? getThreadIndex() : 0;
+        setReactor(fd_ctx, index == -1 ? nextReactor() : index);
+    }
+    if (m_persistent) {
+        return addPersistentEvent(fd_ctx, event, std::move(cb));
+    }
+    int epfd = m_reactors[fd_ctx->reactor]->epfd;
     int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
     epoll_event ep_event;
     ep_event.events = EPOLLET | fd_ctx->events | event;
     ep_event.data.ptr = fd_ctx;
-    int rt = epoll_ctl(m_epfd, op, fd, &ep_event);
+    int rt = epoll_ctl(epfd, op, fd, &ep_event);
+    addSyscallCount();
     if (rt == -1) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op  << ", "
+        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << (EpollCtlOp)op  << ", "
             << fd << ", " << (EPOLL_EVENTS)ep_event.events << "):" << rt << " (" << errno
             << ")(" << strerror(errno) << ") fd_ctx->envents=" << (EPOLL_EVENTS)fd_ctx->events;
         return -1;
@@ -121,33 +161,124 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     SYLAR_ASSERT(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
     event_ctx.scheduler = Scheduler::GetThis();
     if (cb) {
-        event_ctx.cb.swap(cb);
+        event_ctx.cb = std::move(cb);
+    } else {
+        event_ctx.fiber = Fiber::GetThis();
+        SYLAR_ASSERT(event_ctx.fiber->getState() == Fiber::EXEC);
+    }
+    return 0;
+}
+
+int IOManager::waitEvent(int fd, Event event, uint64_t timeout_ms) {
+    FdContext* fd_ctx = getFdContext(fd);
+    uint64_t seq = 0;
+    Timer::ptr timer;
+    if (timeout_ms != ~0ull) {
+        {
+            FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+            seq = ++event_ctx.waitSeq;
+            event_ctx.timedOut = false;
+            timer = std::move(event_ctx.timer);
+        }
+        // the callback fits in Task's inline storage and the fd context never goes away
+        timer = addTimer(std::move(timer), timeout_ms, [this, fd, event, seq](){
+            onWaitTimeout(fd, event, seq);
+        });
+    }
+    if (addEvent(fd, event)) {
+        if (timer) {
+            cancel(timer);
+        }
+        return -1;
+    }
+    Fiber::YeildToHold();
+    if (!timer) {
+        return 0;
+    }
+    cancel(timer);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+    event_ctx.timer = std::move(timer);
+    return event_ctx.timedOut ? -ETIMEDOUT : 0;
+}
+
+void IOManager::onWaitTimeout(int fd, Event event, uint64_t seq) {
+    FdContext* fd_ctx = m_fdContexts.get(fd);
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+        // the wait it was armed for is over
+        if (event_ctx.waitSeq != seq || event_ctx.timedOut) {
+            return;
+        }
+        event_ctx.timedOut = true;
+    }
+    cancelEvent(fd, event);
+}
+
+int IOManager::addPersistentEvent(FdContext* fd_ctx, Event event, Task cb) {
+    if (!fd_ctx->registered) {
+        int epfd = m_reactors[fd_ctx->reactor]->epfd;
+        epoll_event ep_event;
+        ep_event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ep_event.data.ptr = fd_ctx;
+        int rt = epoll_ctl(epfd, EPOLL_CTL_ADD, fd_ctx->fd, &ep_event);
+        addSyscallCount();
+        // EEXIST: cancelAll forgot the fd but it was never closed
+        if (rt == -1 && errno != EEXIST) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << (EpollCtlOp)EPOLL_CTL_ADD
+                << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)ep_event.events << "):" << rt << " ("
+                << errno << ")(" << strerror(errno) << ")";
+            return -1;
+        }
+        fd_ctx->registered = true;
+    }
+    ++m_pendingEventCount;
+    fd_ctx->events = (Event)(fd_ctx->events | event);
+    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+    SYLAR_ASSERT(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
+    event_ctx.scheduler = Scheduler::GetThis();
+    if (cb) {
+        event_ctx.cb = std::move(cb);
     } else {
         event_ctx.fiber = Fiber::GetThis();
         SYLAR_ASSERT(event_ctx.fiber->getState() == Fiber::EXEC);
     }
+    if (fd_ctx->ready & event) {
+        // the edge came before the waiter, a fiber is requeued once it holds
+        fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+        fd_ctx->triggerEvent(event);
+        --m_pendingEventCount;
+    }
     return 0;
 }
 
 bool IOManager::delEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock_r(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock_r.unlock();
     FdContext::MutexType::Lock lock(fd_ctx->mutex);
     if (!(fd_ctx->events & event)) {
         return false;
     }
+    if (m_persistent) {
+        --m_pendingEventCount;
+        fd_ctx->events = (Event)(fd_ctx->events & ~event);
+        fd_ctx->resetContext(fd_ctx->getContext(event));
+        return true;
+    }
     Event new_event = (Event)(fd_ctx->events & ~event);
     int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
     epoll_event ep_event;
     ep_event.events = EPOLLET | new_event;
     ep_event.data.ptr = fd_ctx;
-    int rt = epoll_ctl(m_epfd, op, fd, &ep_event);
+    int epfd = m_reactors[fd_ctx->reactor]->epfd;
+    int rt = epoll_ctl(epfd, op, fd, &ep_event);
+    addSyscallCount();
     if (rt == -1) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op  << ", "
+        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << (EpollCtlOp)op  << ", "
             << fd << ", " << (EPOLL_EVENTS)ep_event.events << "):" << rt << " (" << errno
             << ")(" << strerror(errno) << ") fd_ctx->envents=" << (EPOLL_EVENTS)fd_ctx->events;
         return false;
@@ -160,24 +291,29 @@ bool IOManager::delEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock_r(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock_r.unlock();
     FdContext::MutexType::Lock lock(fd_ctx->mutex);
     if (!(fd_ctx->events & event)) {
-        return false;
+        return cancelUring(fd_ctx, event);
+    }
+    if (m_persistent) {
+        fd_ctx->triggerEvent(event);
+        --m_pendingEventCount;
+        return true;
     }
     Event new_event = (Event)(fd_ctx->events & ~event);
     int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
     epoll_event ep_event;
     ep_event.events = EPOLLET | new_event;
     ep_event.data.ptr = fd_ctx;
-    int rt = epoll_ctl(m_epfd, op, fd, &ep_event);
+    int epfd = m_reactors[fd_ctx->reactor]->epfd;
+    int rt = epoll_ctl(epfd, op, fd, &ep_event);
+    addSyscallCount();
     if (rt == -1) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op  << ", "
+        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << (EpollCtlOp)op  << ", "
             << fd << ", " << (EPOLL_EVENTS)ep_event.events << "):" << rt << " (" << errno
             << ")(" << strerror(errno) << ") fd_ctx->envents=" << (EPOLL_EVENTS)fd_ctx->events;
         return false;
@@ -188,49 +324,253 @@ bool IOManager::cancelEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelAll(int fd) {
-    RWMutexType::ReadLock lock_r(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock_r.unlock();
     FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    bool cancelled = cancelUring(fd_ctx, READ);
+    cancelled = cancelUring(fd_ctx, WRITE) || cancelled;
+    if (m_persistent) {
+        // closing the fd drops it from the epoll set, no need to DEL it
+        fd_ctx->registered = false;
+        fd_ctx->ready = NONE;
+    }
+    // waiters are woken on the old owner, a reused fd is pinned again
+    int reactor = fd_ctx->reactor;
+    pid_t owner = fd_ctx->owner;
+    fd_ctx->reactor = -1;
+    fd_ctx->owner = -1;
     if (!fd_ctx->events) {
-        return false;
+        return cancelled;
+    }
+    if (m_persistent) {
+        if (fd_ctx->events & Event::READ) {
+            fd_ctx->triggerEvent(Event::READ, owner);
+            --m_pendingEventCount;
+        }
+        if (fd_ctx->events & Event::WRITE) {
+            fd_ctx->triggerEvent(Event::WRITE, owner);
+            --m_pendingEventCount;
+        }
+        if (fd_ctx->events & Event::ERROR) {
+            fd_ctx->triggerEvent(Event::ERROR, owner);
+            --m_pendingEventCount;
+        }
+        return true;
     }
     int op = EPOLL_CTL_DEL;
     epoll_event ep_event;
     ep_event.events = Event::NONE;
     ep_event.data.ptr = fd_ctx;
-    int rt = epoll_ctl(m_epfd, op, fd, &ep_event);
+    int epfd = m_reactors[reactor]->epfd;
+    int rt = epoll_ctl(epfd, op, fd, &ep_event);
+    addSyscallCount();
     if (rt == -1) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op  << ", "
+        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << (EpollCtlOp)op  << ", "
             << fd << ", " << (EPOLL_EVENTS)ep_event.events << "):" << rt << " (" << errno
             << ")(" << strerror(errno) << ") fd_ctx->envents=" << (EPOLL_EVENTS)fd_ctx->events;
         return false;
     }
     if (fd_ctx->events & Event::READ) {
-        fd_ctx->triggerEvent(Event::READ);
+        fd_ctx->triggerEvent(Event::READ, owner);
         --m_pendingEventCount;
     }
     if (fd_ctx->events & Event::WRITE) {
-        fd_ctx->triggerEvent(Event::WRITE);
+        fd_ctx->triggerEvent(Event::WRITE, owner);
+        --m_pendingEventCount;
+    }
+    if (fd_ctx->events & Event::ERROR) {
+        fd_ctx->triggerEvent(Event::ERROR, owner);
         --m_pendingEventCount;
     }
     SYLAR_ASSERT(fd_ctx->events == Event::NONE);
     return true;
 }
 
+int IOManager::submitIO(int fd, Event event, io_uring_sqe& sqe, uint64_t timeout_ms) {
+    SYLAR_ASSERT(m_uring);
+    FdContext* fd_ctx = getFdContext(fd);
+    io_uring_sqe sqes[2];
+    uint32_t count = 1;
+    // the kernel copies the timeout while it takes the sqe, the stack is fine
+    __kernel_timespec ts;
+    UringWaiter* waiter = nullptr;
+    uint32_t submitted;
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+        SYLAR_ASSERT(!event_ctx.uring);
+        waiter = &event_ctx.uringWaiter;
+        waiter->scheduler = Scheduler::GetThis();
+        waiter->fiber = Fiber::GetThis();
+        waiter->fdCtx = fd_ctx;
+        waiter->event = event;
+        waiter->res = -ECANCELED;
+        waiter->timedOut = false;
+        waiter->cqes = 1;
+        sqes[0] = sqe;
+        sqes[0].user_data = (uint64_t)waiter;
+        if (timeout_ms != ~0ull) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = timeout_ms % 1000 * 1000000;
+            sqes[0].flags |= IOSQE_IO_LINK;
+            memset(&sqes[1], 0, sizeof(sqes[1]));
+            sqes[1].opcode = IORING_OP_LINK_TIMEOUT;
+            sqes[1].fd = -1;
+            sqes[1].addr = (uint64_t)&ts;
+            sqes[1].len = 1;
+            sqes[1].user_data = (uint64_t)waiter | URING_TIMEOUT_TAG;
+            waiter->cqes = 2;
+            count = 2;
+        }
+        event_ctx.uring = waiter;
+        ++m_pendingEventCount;
+        submitted = m_uring->submit(sqes, count);
+        addSyscallCount();
+        if (submitted == 0) {
+            event_ctx.uring = nullptr;
+            waiter->fiber.reset();
+            --m_pendingEventCount;
+        } else if (submitted < count) {
+            // the operation went in without its link timeout, completions
+            // take the fd lock first so nothing has counted cqes yet
+            SYLAR_LOG_WARN(g_logger) << "io_uring fd=" << fd << " submitted without timeout errno="
+                << errno << " errstr=" << strerror(errno);
+            waiter->cqes = submitted;
+        }
+    }
+    // the kernel tries the operation inline, pick up an immediate completion
+    // here rather than after an epoll_wait round trip. A refused submission
+    // most likely means a full cq, reaping it makes room for the next one
+    m_uring->reap([this](uint64_t user_data, int32_t res){
+        onUringComplete(user_data, res);
+    }, false);
+    if (submitted == 0) {
+        // the caller falls back to readiness events
+        return -EAGAIN;
+    }
+    Fiber::YeildToHold();
+    // the waiter stays claimed until here, so nothing reuses it before we read it
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    fd_ctx->getContext(event).uring = nullptr;
+    return waiter->timedOut ? -ETIMEDOUT : waiter->res;
+}
+
+bool IOManager::cancelUring(FdContext* fd_ctx, Event event) {
+    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+    if (!event_ctx.uring) {
+        return false;
+    }
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = -1;
+    sqe.addr = (uint64_t)event_ctx.uring;
+    sqe.user_data = URING_IGNORE;
+    // the operation completes with -ECANCELED and clears event_ctx.uring
+    bool rt = m_uring->submit(&sqe, 1);
+    addSyscallCount();
+    if (!rt) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring cancel fd=" << fd_ctx->fd << " errno=" << errno
+            << " errstr=" << strerror(errno);
+    }
+    return rt;
+}
+
+void IOManager::onUringComplete(uint64_t user_data, int32_t res) {
+    if (user_data == URING_IGNORE) {
+        return;
+    }
+    UringWaiter* waiter = (UringWaiter*)(user_data & ~URING_TIMEOUT_TAG);
+    FdContext::MutexType::Lock lock(waiter->fdCtx->mutex);
+    if (user_data & URING_TIMEOUT_TAG) {
+        waiter->timedOut = res == -ETIME;
+    } else {
+        waiter->res = res;
+    }
+    if (--waiter->cqes == 0) {
+        Scheduler* scheduler = waiter->scheduler;
+        Fiber::ptr fiber;
+        fiber.swap(waiter->fiber);
+        --m_pendingEventCount;
+        scheduler->schedule(std::move(fiber));
+    }
+}
+
 IOManager* IOManager::GetThis() {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
 
 void IOManager::tickle() {
+    ++m_tickleRequested;
     if (!hasIdleThreads()) {
         return;
     }
-    int rt = write(m_tickleFds[1], "T", 1);
-    SYLAR_ASSERT(rt == 1);
+    if (!m_sharded) {
+        wakeReactor(*m_reactors[0]);
+        return;
+    }
+    // one idle thread is enough, except that stop() has to reach them all
+    size_t count = m_reactors.size();
+    size_t start = m_nextTickle++;
+    for (size_t i = 0; i < count; ++i) {
+        Reactor& reactor = *m_reactors[(start + i) % count];
+        if (reactor.idle) {
+            wakeReactor(reactor);
+            if (!m_stopping) {
+                return;
+            }
+        }
+    }
+}
+
+void IOManager::tickle(pid_t thread) {
+    int index = m_sharded && thread != -1 ? getThreadIndex(thread) : -1;
+    if (index == -1) {
+        tickle();
+        return;
+    }
+    ++m_tickleRequested;
+    Reactor& reactor = *m_reactors[index];
+    if (reactor.idle) {
+        wakeReactor(reactor);
+    }
+}
+
+void IOManager::wakeReactor(Reactor& reactor) {
+    // the reactor has not consumed the last wakeup yet, it will see our work too
+    if (reactor.wakePending.exchange(true)) {
+        return;
+    }
+    uint64_t one = 1;
+    int rt = write(reactor.tickleFd, &one, sizeof(one));
+    addSyscallCount();
+    ++m_tickleSent;
+    SYLAR_ASSERT(rt == sizeof(one));
+}
+
+pid_t IOManager::pinFd(int fd) {
+    if (!m_sharded) {
+        return -1;
+    }
+    FdContext* fd_ctx = getFdContext(fd);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if (fd_ctx->reactor == -1) {
+        setReactor(fd_ctx, nextReactor());
+    }
+    return fd_ctx->owner;
+}
+
+size_t IOManager::nextReactor() {
+    // the caller thread only runs the scheduler inside stop()
+    size_t first = m_rootThread != -1 && m_reactors.size() > 1 ? 1 : 0;
+    return first + m_nextReactor++ % (m_reactors.size() - first);
+}
+
+void IOManager::setReactor(FdContext* fd_ctx, int index) {
+    fd_ctx->reactor = index;
+    fd_ctx->owner = m_sharded ? getThreadAt(index) : -1;
 }
 
 bool IOManager::stopping() {
@@ -240,6 +580,8 @@ bool IOManager::stopping() {
 
 void IOManager::idle() {
     SYLAR_LOG_INFO(g_logger) << "idle";
+    Reactor& reactor = *m_reactors[m_sharded ? getThreadIndex() : 0];
+    bindShard(getThreadIndex());
     epoll_event* events = new epoll_event[MAX_EVENT];
     std::shared_ptr<epoll_event> shared_event(events, [](epoll_event* ptr){
         delete[] ptr;
@@ -249,6 +591,10 @@ void IOManager::idle() {
         uint64_t next_timeout = 0;
         if (stopping(next_timeout)) {
             SYLAR_LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
+            // a coalesced wakeup reached one thread, pass it on to the others
+            tickle();
+            unbindShard();
+            ClearLoopMS();
             break;
         }
         int event_num;
@@ -258,13 +604,22 @@ void IOManager::idle() {
             } else {
                 next_timeout = MAX_TIMEOUT;
             }
-            event_num = epoll_wait(m_epfd, events, MAX_EVENT, next_timeout);
+            reactor.idle = true;
+            // a push that raced with the scheduler's last look saw us busy and did not tickle
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (hasQueuedWork()) {
+                next_timeout = 0;
+            }
+            event_num = epoll_wait(reactor.epfd, events, MAX_EVENT, next_timeout);
+            reactor.idle = false;
+            UpdateLoopMS();
+            addSyscallCount();
             if (event_num >= 0 || errno == EINTR) {
                 break;
             }
         } while (true);
         // timer callbacks
-        std::vector<std::function<void()>> cbs;
+        std::vector<Task> cbs;
         listExpiredCb(cbs);
         if (!cbs.empty()) {
             schedule(cbs.begin(), cbs.end());
@@ -273,13 +628,28 @@ void IOManager::idle() {
         // epoll event
         for (int i = 0; i < event_num; ++i) {
             epoll_event& event = events[i];
-            if (event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy[256];
-                while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+            if (m_uring && event.data.ptr == m_uring.get()) {
+                m_uring->reap([this](uint64_t user_data, int32_t res){
+                    onUringComplete(user_data, res);
+                });
+                continue;
+            }
+            if (event.data.ptr == &reactor) {
+                // clear first, a tickle racing with the read then just costs a spare wakeup
+                reactor.wakePending = false;
+                uint64_t dummy;
+                addSyscallCount();
+                if (read(reactor.tickleFd, &dummy, sizeof(dummy)) < 0) {
+                    SYLAR_ASSERT(errno == EAGAIN);
+                }
                 continue;
             }
             FdContext* fd_ctx = (FdContext*)event.data.ptr;
             FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            if (m_persistent) {
+                triggerPersistent(fd_ctx, event.events);
+                continue;
+            }
             if (event.events & (EPOLLERR | EPOLLHUP)) {
                 event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
             }
@@ -290,15 +660,19 @@ void IOManager::idle() {
             if (event.events & EPOLLOUT) {
                 real_event |= EPOLLOUT;
             }
+            if (event.events & (EPOLLERR | EPOLLHUP)) {
+                real_event |= EPOLLERR;
+            }
             if ((fd_ctx->events & real_event) == NONE) {
                 continue;
             }
             int left_event = fd_ctx->events & ~real_event;
             int op = left_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
             event.events = EPOLLET | left_event;
-            int rt = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            int rt = epoll_ctl(reactor.epfd, op, fd_ctx->fd, &event);
+            addSyscallCount();
             if (rt == -1) {
-                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op  << ", "
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << reactor.epfd << ", " << (EpollCtlOp)op  << ", "
                     << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):" << rt << " (" << errno
                     << ")(" << strerror(errno) << ") fd_ctx->envents=" << (EPOLL_EVENTS)fd_ctx->events;
                 continue;
@@ -311,27 +685,57 @@ void IOManager::idle() {
                 fd_ctx->triggerEvent(Event::WRITE);
                 --m_pendingEventCount;
             }
+            if (real_event & fd_ctx->events & Event::ERROR) {
+                fd_ctx->triggerEvent(Event::ERROR);
+                --m_pendingEventCount;
+            }
         }
         Fiber::YeildToHold();
     }
 }
 
+void IOManager::triggerPersistent(FdContext* fd_ctx, uint32_t epoll_events) {
+    if (!fd_ctx->registered) {
+        // cancelAll ran after epoll_wait returned
+        return;
+    }
+    int real_event = NONE;
+    if (epoll_events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        real_event |= READ;
+    }
+    if (epoll_events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+        real_event |= WRITE;
+    }
+    if (epoll_events & (EPOLLERR | EPOLLHUP)) {
+        real_event |= ERROR;
+    }
+    fd_ctx->ready = (Event)(fd_ctx->ready | (real_event & ~fd_ctx->events));
+    if (real_event & fd_ctx->events & READ) {
+        fd_ctx->triggerEvent(READ);
+        --m_pendingEventCount;
+    }
+    if (real_event & fd_ctx->events & WRITE) {
+        fd_ctx->triggerEvent(WRITE);
+        --m_pendingEventCount;
+    }
+    if (real_event & fd_ctx->events & ERROR) {
+        fd_ctx->triggerEvent(ERROR);
+        --m_pendingEventCount;
+    }
+}
+
 void IOManager::onTimerInsertedAtFront() {
     tickle();
 }
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
-        }
-    }
+void IOManager::wakeShard(size_t index) {
+    // unconditional, the owner may be about to sleep with its old timeout
+    ++m_tickleRequested;
+    wakeReactor(*m_reactors[index]);
 }
 
 bool IOManager::stopping(uint64_t& timeout) {
     timeout = getNextTimer();
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    return timeout == ~0ull && !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 }
\ No newline at end of file
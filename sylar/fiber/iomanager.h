@@ -1,69 +1,176 @@
 #pragma once
 
 #include <atomic>
+#include <errno.h>
+#include <memory>
 #include <stdint.h>
 #include <vector>
 
 #include "mutex.h"
 #include "scheduler.h"
+#include "segmented_array.h"
 #include "timer.h"
 
+struct io_uring_sqe;
+
 namespace sylar {
+class IoUring;
 
+/**
+ * Backends, selected by iomanager.backend:
+ *   epoll     readiness events, the I/O itself is done by the hooked calls
+ *   io_uring  hooked calls that would block are submitted as sqes and the
+ *             fiber resumes with the result. The ring fd sits in the epoll
+ *             set, so addEvent keeps working. Falls back to epoll when the
+ *             kernel lacks io_uring.
+ * With iomanager.persistent_epoll each fd is added once with
+ * EPOLLIN|EPOLLOUT|EPOLLET on its first wait and stays registered until
+ * cancelAll (the hooked close). Edges that arrive while nobody waits are
+ * latched in FdContext::ready, so waits cost no epoll_ctl. Fds must then be
+ * closed through the hooked close or after cancelAll.
+ * With iomanager.sharded every thread waits on its own epoll set. An fd is
+ * owned by the thread that first waits on it (or the one pinFd picked) and
+ * its waiters always resume there, other threads hand work over through
+ * that thread's inbox.
+ */
 class IOManager : public Scheduler, public TimerManager {
 public:
-    typedef RWMutex RWMutexType;
-
     enum Event {
         NONE  = 0x0,
         READ  = 0x1,
         WRITE = 0x4,
+        // EPOLLERR, e.g. MSG_ZEROCOPY completions in the socket error queue
+        ERROR = 0x8,
     };
 
 private:
+    struct FdContext;
+
+    /**
+     * An io_uring operation in flight, its address is the user_data. It lives
+     * in the fd's EventContext rather than on the fiber's stack, a fiber on a
+     * shared stack has its frame swapped out while parked.
+     */
+    struct UringWaiter {
+        Scheduler* scheduler = nullptr;
+        Fiber::ptr fiber;
+        FdContext* fdCtx = nullptr;
+        Event event = NONE;
+        int32_t res = -ECANCELED;
+        bool timedOut = false;
+        std::atomic<int> cqes {1};              // the fiber resumes after the last one
+    };
+
+    struct Reactor {
+        int epfd = -1;
+        int tickleFd = -1;                      // eventfd
+        std::atomic<bool> idle {false};         // blocked in epoll_wait
+        std::atomic<bool> wakePending {false};  // tickleFd written, not read yet
+    };
+
     struct FdContext {
         typedef Spinlock MutexType;
 
         struct EventContext {
             Scheduler* scheduler = nullptr;
             Fiber::ptr fiber = nullptr;
-            std::function<void()> cb = nullptr;
+            Task cb;
+            UringWaiter* uring = nullptr;       // in flight io_uring operation, until its fiber resumes
+            UringWaiter uringWaiter;
+            // waitEvent state, kept across waits so a timed wait allocates nothing
+            uint64_t waitSeq = 0;
+            bool timedOut = false;
+            Timer::ptr timer;
         };
 
         EventContext& getContext(Event event);
         void resetContext(EventContext& ctx);
         void triggerEvent(Event event);
+        void triggerEvent(Event event, pid_t thread);
 
         EventContext read;
         EventContext write;
+        EventContext error;
         int fd = 0;
         Event events = NONE;
+        Event ready = NONE;                     // edges seen with no waiter, persistent mode
+        bool registered = false;                // in the epoll set, persistent mode
+        int reactor = -1;                       // index in m_reactors
+        pid_t owner = -1;                       // thread of the reactor, sharded mode
         MutexType mutex;
     };
 
 public:
     IOManager(size_t thread = 1, bool use_caller = true, const std::string& name = "");
     ~IOManager();
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    int addEvent(int fd, Event event, Task cb = nullptr);
     bool delEvent(int fd, Event event);
     bool cancelEvent(int fd, Event event);
     bool cancelAll(int fd);
+    /**
+     * Park the fiber until event fires on fd or timeout_ms passes. Returns 0
+     * when the event fired, -ETIMEDOUT on timeout and -1 if the event could
+     * not be added. Does not allocate once the fd has waited before.
+     */
+    int waitEvent(int fd, Event event, uint64_t timeout_ms = ~0ull);
+
+    bool hasUring() const { return m_uring != nullptr; }
+    bool isPersistent() const { return m_persistent; }
+    bool isSharded() const { return m_sharded; }
+    /**
+     * Pin fd to the next reactor round robin unless it already has one and
+     * return the owning thread, e.g. to schedule a new connection's handler.
+     * -1 unless sharded.
+     */
+    pid_t pinFd(int fd);
+    /**
+     * Submit sqe for fd with an optional linked timeout and park the fiber until
+     * it completes. sqe.user_data is overwritten. Returns the completion result:
+     * -ETIMEDOUT on timeout, -ECANCELED if cancelEvent/cancelAll stopped it,
+     * -EAGAIN without parking if the ring refused the submission.
+     */
+    int submitIO(int fd, Event event, io_uring_sqe& sqe, uint64_t timeout_ms = ~0ull);
+    // syscalls issued by the backend and by hooked I/O, for benchmarks
+    uint64_t getSyscallCount() const { return m_syscallCount; }
+    void addSyscallCount(uint64_t count = 1) {
+        m_syscallCount.fetch_add(count, std::memory_order_relaxed);
+    }
+    // tickle() calls vs eventfd writes left after coalescing
+    uint64_t getTickleRequested() const { return m_tickleRequested; }
+    uint64_t getTickleSent() const { return m_tickleSent; }
 
     static IOManager* GetThis();
 
 protected:
     void tickle() override;
+    void tickle(pid_t thread) override;
+    void wakeReactor(Reactor& reactor);
+    size_t nextReactor();
+    void setReactor(FdContext* fd_ctx, int index);
     bool stopping() override;
     void idle() override;
     void onTimerInsertedAtFront() override;
-    void contextResize(size_t size);
+    void wakeShard(size_t index) override;
+    FdContext* getFdContext(int fd);
+    void onWaitTimeout(int fd, Event event, uint64_t seq);
+    int addPersistentEvent(FdContext* fd_ctx, Event event, Task cb);
+    // wake the waiters of a persistent fd and latch the rest as ready
+    void triggerPersistent(FdContext* fd_ctx, uint32_t epoll_events);
+    bool cancelUring(FdContext* fd_ctx, Event event);
+    void onUringComplete(uint64_t user_data, int32_t res);
     bool stopping(uint64_t& timeout);
 
 private:
-    int m_epfd = 0;
-    int m_tickleFds[2];
+    std::vector<std::unique_ptr<Reactor>> m_reactors;
+    std::atomic<size_t> m_nextReactor {0};
+    std::atomic<size_t> m_nextTickle {0};
+    bool m_sharded = false;
     std::atomic<size_t> m_pendingEventCount = {0};
-    RWMutexType m_mutex;
-    std::vector<FdContext*> m_fdContexts;
+    SegmentedArray<FdContext> m_fdContexts;
+    std::unique_ptr<IoUring> m_uring;
+    bool m_persistent = false;
+    std::atomic<uint64_t> m_syscallCount {0};
+    std::atomic<uint64_t> m_tickleRequested {0};
+    std::atomic<uint64_t> m_tickleSent {0};
 };
 }
\ No newline at end of file
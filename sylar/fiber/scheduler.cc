@@ -1,3 +1,4 @@
+#include "config.h"
 #include "hook.h"
 #include "log.h"
 #include "scheduler.h"
@@ -5,8 +6,14 @@
 
 namespace sylar {
 static Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+static ConfigVar<bool>::ptr g_fiber_shared_stack =
+    Config::Lookup<bool>("fiber.shared_stack", false, "run scheduled callbacks on shared stacks");
 static thread_local Scheduler* t_scheduler = nullptr;
 static thread_local Fiber* t_fiber = nullptr;
+static thread_local size_t t_runQueue = 0;         // index in m_runQueues of t_scheduler
+static thread_local uint32_t t_tick = 0;
+static thread_local uint32_t t_seed = 0;
+static thread_local RingQueue<FiberAndFunction> t_stolen;
 
 void FiberAndFunction::reset() {
     fiber = nullptr;
@@ -16,6 +23,10 @@ void FiberAndFunction::reset() {
 
 Scheduler::Scheduler(size_t thread, bool use_caller, const std::string& name) : m_name(name) {
     SYLAR_ASSERT(thread > 0);
+    m_runQueues.resize(thread);
+    for (auto& i : m_runQueues) {
+        i.reset(new RunQueue);
+    }
     if (use_caller) {
         Fiber::GetThis();
         --thread;
@@ -25,6 +36,9 @@ Scheduler::Scheduler(size_t thread, bool use_caller, const std::string& name) :
         t_fiber = m_callerFiber.get();
         m_rootThread = GetThreadID();
         m_threadIDs.push_back(m_rootThread);
+        m_runQueues[0]->thread = m_rootThread;
+        m_nextRunQueue = 1;
+        t_runQueue = 0;
     } else {
         m_rootThread = -1;
     }
@@ -102,6 +116,7 @@ std::ostream& Scheduler::dump(std::ostream& os) {
        << " size=" << m_threadCount
        << " active_count=" << m_activeThreadCount
        << " idle_count=" << m_idleThreadCount
+       << " task_count=" << m_taskCount
        << " stopping=" << m_stopping
        << " ]" << std::endl << "    ";
     for(size_t i = 0; i < m_threadIDs.size(); ++i) {
@@ -113,6 +128,19 @@ std::ostream& Scheduler::dump(std::ostream& os) {
     return os;
 }
 
+std::vector<pid_t> Scheduler::getWorkerThreads() const {
+    std::vector<pid_t> threads;
+    for (pid_t i : m_threadIDs) {
+        if (i != m_rootThread) {
+            threads.push_back(i);
+        }
+    }
+    if (threads.empty() && m_rootThread != -1) {
+        threads.push_back(m_rootThread);
+    }
+    return threads;
+}
+
 Scheduler* Scheduler::GetThis() {
     return t_scheduler;
 }
@@ -124,36 +152,35 @@ Fiber* Scheduler::GetMainFiber() {
 void Scheduler::run() {
     SYLAR_LOG_INFO(g_logger) << m_name << " run";
     set_hook_enable(true);
-    setThis();
     if (GetThreadID() != m_rootThread) {
+        t_runQueue = m_nextRunQueue++;
+        SYLAR_ASSERT(t_runQueue < m_runQueues.size());
+        m_runQueues[t_runQueue]->thread = GetThreadID();
         t_fiber = Fiber::GetThis().get();
+    } else {
+        t_runQueue = 0;
     }
+    setThis();
+    t_seed = GetThreadID();
     Fiber::ptr idle_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this));
     Fiber::ptr cb_fiber;
     FiberAndFunction fiberfunc;
+    bool use_shared_stack = g_fiber_shared_stack->getValue();
     while (true) {
         fiberfunc.reset();
-        bool tickle_me = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            for (auto it = m_fibers.begin(); it != m_fibers.end(); ++it) {
-                if (it->thread != -1 && it->thread != GetThreadID()) {
-                    tickle_me = true;
-                    continue;
-                }
-                SYLAR_ASSERT(it->fiber || it->cb);
-                if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    continue;
-                }
-                fiberfunc = *it;
-                m_fibers.erase(it);
-                m_activeThreadCount += 1;
-                break;
-            }
-            tickle_me |= !m_fibers.empty();
+        // work pinned to other threads was tickled to them when it was queued
+        if (dequeue(fiberfunc)) {
+            m_activeThreadCount += 1;
+            --m_taskCount;
         }
-        if (tickle_me) {
-            tickle();
+        if (fiberfunc.fiber && fiberfunc.fiber->isRunning()) {
+            // woken before it finished swapping out on another thread
+            pid_t thread = fiberfunc.thread;
+            if (enqueue(fiberfunc)) {
+                tickle(thread);
+            }
+            m_activeThreadCount -= 1;
+            continue;
         }
         if (fiberfunc.fiber && fiberfunc.fiber->getState() != Fiber::TERM
                             && fiberfunc.fiber->getState() != Fiber::EXECPT) {
@@ -165,9 +192,9 @@ void Scheduler::run() {
             fiberfunc.reset();
         } else if (fiberfunc.cb) {
             if (cb_fiber) {
-                cb_fiber->reset(fiberfunc.cb);
+                cb_fiber->reset(std::move(fiberfunc.cb));
             } else {
-                cb_fiber = std::make_shared<Fiber>(fiberfunc.cb);
+                cb_fiber = std::make_shared<Fiber>(std::move(fiberfunc.cb), 0, false, use_shared_stack);
             }
             fiberfunc.reset();
             cb_fiber->swapIn();
@@ -180,6 +207,8 @@ void Scheduler::run() {
             } else {
                 cb_fiber.reset();
             }
+        } else if (fiberfunc.fiber) {
+            m_activeThreadCount -= 1;
         } else {
             if (idle_fiber->getState() == Fiber::TERM) {
                 SYLAR_LOG_INFO(g_logger) << "idle fiber term";
@@ -192,6 +221,157 @@ void Scheduler::run() {
     }
 }
 
+Scheduler::RunQueue* Scheduler::getRunQueue(pid_t thread) {
+    for (auto& i : m_runQueues) {
+        if (i->thread == thread) {
+            return i.get();
+        }
+    }
+    return nullptr;
+}
+
+int Scheduler::getThreadIndex() const {
+    return GetThis() == this ? (int)t_runQueue : -1;
+}
+
+int Scheduler::getThreadIndex(pid_t thread) const {
+    for (size_t i = 0; i < m_runQueues.size(); ++i) {
+        if (m_runQueues[i]->thread == thread) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+Scheduler::RunQueue* Scheduler::getLocalRunQueue() {
+    return GetThis() == this ? m_runQueues[t_runQueue].get() : nullptr;
+}
+
+bool Scheduler::enqueue(FiberAndFunction& ft) {
+    RunQueue* local = getLocalRunQueue();
+    RunQueue* target = local;
+    if (ft.thread != -1 && (!local || local->thread != ft.thread)) {
+        target = getRunQueue(ft.thread);
+    }
+    ++m_taskCount;
+    if (target) {
+        target->inbox.push(std::move(ft));
+        // the owner drains its own inbox before it looks for work
+        return target != local;
+    }
+    // pinned tasks in the global queue are forwarded by whoever pops them
+    MutexType::Lock lock(m_globalQueue.mutex);
+    m_globalQueue.tasks.push(std::move(ft));
+    return true;
+}
+
+bool Scheduler::hasQueuedWork() {
+    RunQueue* local = getLocalRunQueue();
+    if (local && !local->inbox.empty()) {
+        return true;
+    }
+    MutexType::Lock lock(m_globalQueue.mutex);
+    return !m_globalQueue.tasks.empty();
+}
+
+void Scheduler::drainInbox(RunQueue& local) {
+    if (local.inbox.empty()) {
+        return;
+    }
+    size_t size = 0;
+    {
+        MutexType::Lock lock(local.mutex);
+        local.inbox.drain([&local](FiberAndFunction&& ft){
+            if (ft.thread != -1) {
+                local.pinned.push(std::move(ft));
+            } else {
+                local.tasks.push(std::move(ft));
+            }
+        });
+        size = local.tasks.size();
+    }
+    // more than this thread is about to run, let idle threads steal
+    if (size > 1 && hasIdleThreads()) {
+        tickle();
+    }
+}
+
+bool Scheduler::dequeue(FiberAndFunction& ft) {
+    RunQueue& local = *m_runQueues[t_runQueue];
+    ++t_tick;
+    drainInbox(local);
+    bool got = false;
+    // look at the global queue now and then so busy threads don't starve it
+    if (t_tick % 61 == 0) {
+        MutexType::Lock lock(m_globalQueue.mutex);
+        got = m_globalQueue.tasks.pop(ft);
+    }
+    if (!got) {
+        MutexType::Lock lock(local.mutex);
+        if (t_tick & 1) {
+            got = local.tasks.pop(ft) || local.pinned.pop(ft);
+        } else {
+            got = local.pinned.pop(ft) || local.tasks.pop(ft);
+        }
+    }
+    if (!got) {
+        MutexType::Lock lock(m_globalQueue.mutex);
+        got = m_globalQueue.tasks.pop(ft);
+    }
+    if (got) {
+        if (ft.thread != -1 && ft.thread != local.thread) {
+            pid_t thread = ft.thread;
+            if (enqueue(ft)) {
+                tickle(thread);
+            }
+            --m_taskCount;
+            ft.reset();
+            return false;
+        }
+        return true;
+    }
+    return steal(local, ft);
+}
+
+bool Scheduler::steal(RunQueue& local, FiberAndFunction& ft) {
+    size_t n = m_runQueues.size();
+    if (n < 2) {
+        return false;
+    }
+    t_seed ^= t_seed << 13;
+    t_seed ^= t_seed >> 17;
+    t_seed ^= t_seed << 5;
+    size_t start = t_seed % n;
+    for (size_t i = 0; i < n; ++i) {
+        RunQueue& victim = *m_runQueues[(start + i) % n];
+        if (&victim == &local) {
+            continue;
+        }
+        {
+            // take the newer half, the owner keeps popping from the front
+            MutexType::Lock lock(victim.mutex);
+            for (size_t count = (victim.tasks.size() + 1) / 2; count > 0; --count) {
+                FiberAndFunction task;
+                victim.tasks.popBack(task);
+                t_stolen.push(std::move(task));
+            }
+        }
+        // t_stolen holds them newest first, drain it from the back to keep their order
+        if (!t_stolen.popBack(ft)) {
+            continue;
+        }
+        if (!t_stolen.empty()) {
+            MutexType::Lock lock(local.mutex);
+            FiberAndFunction task;
+            while (t_stolen.popBack(task)) {
+                local.tasks.push(std::move(task));
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
 void Scheduler::setThis() {
     t_scheduler = this;
 }
@@ -201,8 +381,7 @@ void Scheduler::tickle() {
 }
 
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mutex);
-    return m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    return m_stopping && m_taskCount == 0 && m_activeThreadCount == 0;
 }
 
 void Scheduler::idle() {
@@ -1,25 +1,37 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "fiber.h"
+#include "mpsc_queue.h"
 #include "mutex.h"
+#include "ring_queue.h"
+#include "task.h"
 #include "thread.h"
 
 namespace sylar {
 struct FiberAndFunction {
     Fiber::ptr fiber;
-    std::function<void()> cb;
+    Task cb;
     pid_t thread;
 
-    FiberAndFunction(Fiber::ptr f, pid_t thr) : fiber(f), thread(thr) {}
-    FiberAndFunction(Fiber::ptr* f, pid_t thr) : thread(thr) { fiber.swap(*f); }
-    FiberAndFunction(std::function<void()> f, pid_t thr) : cb(f), thread(thr) {}
-    FiberAndFunction(std::function<void()>* f, pid_t thr) : thread(thr) { cb.swap(*f); }
+    FiberAndFunction(Fiber::ptr f, pid_t thr) : fiber(f), thread(thr) { pin(); }
+    FiberAndFunction(Fiber::ptr* f, pid_t thr) : thread(thr) { fiber.swap(*f); pin(); }
+    FiberAndFunction(Task&& f, pid_t thr) : cb(std::move(f)), thread(thr) {}
+    FiberAndFunction(Task* f, pid_t thr) : thread(thr) { cb.swap(*f); }
+    FiberAndFunction(std::function<void()>* f, pid_t thr) : cb(std::move(*f)), thread(thr) { *f = nullptr; }
     FiberAndFunction() : thread(-1) {}
     void reset();
+
+    // a shared stack fiber can only resume on the thread owning its stack
+    void pin() {
+        if (fiber && fiber->getThread() != -1) {
+            thread = fiber->getThread();
+        }
+    }
 };
 
 class Scheduler {
@@ -34,6 +46,8 @@ public:
     void switchTo(pid_t thread = -1);
     std::ostream& dump(std::ostream& os);
     const std::string& getName() const { return m_name; }
+    // threads that run tasks before stop(), the caller thread only if it is the only one
+    std::vector<pid_t> getWorkerThreads() const;
     static Scheduler *GetThis();
     static Fiber *GetMainFiber();
 
@@ -44,29 +58,45 @@ protected:
     virtual bool stopping();
     virtual void idle();
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
+    // work queued for the calling thread that a tickle may have skipped, idle() looks before it blocks
+    bool hasQueuedWork();
+    // wake the given thread, -1 for any idle one
+    virtual void tickle(pid_t thread) { tickle(); }
+    // threads are numbered by their run queue, the caller thread is 0
+    size_t getThreadCount() const { return m_runQueues.size(); }
+    // index of the calling thread, -1 outside this scheduler
+    int getThreadIndex() const;
+    int getThreadIndex(pid_t thread) const;
+    // -1 until the thread has started
+    pid_t getThreadAt(size_t index) const { return m_runQueues[index]->thread; }
 
 public:
     template<typename FiberOrFunc>
     void schedule(FiberOrFunc fc, pid_t thread = -1) {
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
-        }
-        if (need_tickle) {
-            tickle();
+        FiberAndFunction ft(std::move(fc), thread);
+        thread = ft.thread;
+        if ((ft.fiber || ft.cb) && enqueue(ft)) {
+            tickle(thread);
         }
     }
 
     template<typename InputIterator>
     void schedule(InputIterator begin, InputIterator end) {
         bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            while(begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                ++begin;
+        RunQueue* local = getLocalRunQueue();
+        Inbox::Batch batch;
+        while(begin != end) {
+            FiberAndFunction ft(&*begin, -1);
+            if (local && ft.thread == -1 && (ft.fiber || ft.cb)) {
+                batch.push(std::move(ft));
+            } else if (ft.fiber || ft.cb) {
+                need_tickle = enqueue(ft) || need_tickle;
             }
+            ++begin;
+        }
+        if (!batch.empty()) {
+            m_taskCount += batch.size();
+            local->inbox.push(batch);
         }
         if (need_tickle) {
             tickle();
@@ -74,20 +104,35 @@ public:
     }
 
 private:
-    template<typename FiberOrFunc>
-    bool scheduleNoLock(FiberOrFunc fc, pid_t thread) {
-        bool need_tickle = m_fibers.empty();
-            FiberAndFunction ft(fc, thread);
-            if(ft.fiber || ft.cb) {
-                m_fibers.push_back(ft);
-            }
-            return need_tickle;
-    }
+    typedef MpscQueue<FiberAndFunction> Inbox;
+
+    /**
+     * Run queue of one scheduler thread. tasks can be stolen by idle threads,
+     * pinned only holds tasks that must run on the owner thread. Wakeups from
+     * any thread land in the lock free inbox, which only the owner drains.
+     */
+    struct RunQueue {
+        MutexType mutex;
+        RingQueue<FiberAndFunction> tasks;
+        RingQueue<FiberAndFunction> pinned;
+        Inbox inbox;
+        std::atomic<pid_t> thread {-1};
+    };
+
+    RunQueue* getRunQueue(pid_t thread);
+    RunQueue* getLocalRunQueue();
+    void drainInbox(RunQueue& local);
+    bool enqueue(FiberAndFunction& ft);
+    bool dequeue(FiberAndFunction& ft);
+    bool steal(RunQueue& local, FiberAndFunction& ft);
 
 private:
     MutexType m_mutex;
     std::vector<Thread::ptr> m_threads;         // thread pool
-    std::vector<FiberAndFunction> m_fibers;     // function is same as fiber to use
+    std::vector<std::unique_ptr<RunQueue>> m_runQueues;    // one per thread, caller thread first
+    RunQueue m_globalQueue;                     // schedule() from threads outside the scheduler
+    std::atomic<size_t> m_nextRunQueue {0};
+    std::atomic<size_t> m_taskCount {0};
     Fiber::ptr m_callerFiber;
     std::string m_name;
 
@@ -0,0 +1,244 @@
+#include "config.h"
+#include "log.h"
+#include "mutex.h"
+#include "stack_allocator.h"
+#include "util.h"
+
+#include <atomic>
+#include <fstream>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+namespace sylar {
+static Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+static ConfigVar<uint32_t>::ptr g_stack_cache_size =
+    Config::Lookup<uint32_t>("fiber.stack_cache_size", 64, "fiber stacks cached per thread");
+static ConfigVar<int>::ptr g_stack_hugepage =
+    Config::Lookup<int>("fiber.stack_hugepage", 0, "fiber stack huge page, 0:none 1:thp 2:hugetlb");
+
+static std::atomic<uint64_t> s_cached {0};
+static std::atomic<uint64_t> s_in_use {0};
+static std::atomic<uint64_t> s_high_water {0};
+static std::atomic<uint64_t> s_mapped {0};
+static std::atomic<uint64_t> s_reused {0};
+static std::atomic<uint64_t> s_hugetlb {0};
+
+static uint32_t s_cache_size = 64;
+static int s_hugepage = StackAllocator::NONE;
+static size_t s_page_size = 4096;
+
+// stacks backed by MAP_HUGETLB, they are unmapped in two parts
+static Spinlock s_huge_mutex;
+static std::unordered_set<void*> s_huge_stacks;
+
+// read on first use, the hooked open and read are not set up during static init
+static size_t ReadHugePageSize() {
+    std::ifstream ifs("/proc/meminfo");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        size_t kb = 0;
+        if (sscanf(line.c_str(), "Hugepagesize: %zu kB", &kb) == 1 && kb) {
+            return kb * 1024;
+        }
+    }
+    return 2 * 1024 * 1024;
+}
+
+static size_t HugePageSize() {
+    static size_t s_huge_page_size = ReadHugePageSize();
+    return s_huge_page_size;
+}
+
+struct _StackAllocatorIniter {
+    _StackAllocatorIniter() {
+        s_page_size = sysconf(_SC_PAGESIZE);
+        s_cache_size = g_stack_cache_size->getValue();
+        s_hugepage = g_stack_hugepage->getValue();
+        g_stack_cache_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_cache_size = new_value;
+        });
+        g_stack_hugepage->addListener([](const int& old_value, const int& new_value){
+            s_hugepage = new_value;
+        });
+    }
+};
+static _StackAllocatorIniter s_stack_allocator_initer;
+
+static size_t MapSize(size_t size) {
+    return ((size + s_page_size - 1) & ~(s_page_size - 1)) + s_page_size;
+}
+
+static size_t HugeSize(size_t size) {
+    size_t huge = HugePageSize();
+    return (size + huge - 1) & ~(huge - 1);
+}
+
+/**
+ * Huge pages can't be mprotected or unmapped in 4KiB pieces, so the guard
+ * is a normal PROT_NONE page right below the huge mapping. Reserves the
+ * range first to get a huge page aligned address. nullptr when the pool
+ * has no free huge pages.
+ */
+static void* MapHugeStack(size_t size) {
+    size_t huge = HugePageSize();
+    size_t len = HugeSize(size);
+    size_t reserve = len + huge;
+    char* base = (char*)mmap(nullptr, reserve, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+    char* stack = (char*)(((uintptr_t)base + s_page_size + huge - 1) & ~(huge - 1));
+    // no MAP_NORESERVE, an empty pool fails here instead of with SIGBUS later
+    if (mmap(stack, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        munmap(base, reserve);
+        return nullptr;
+    }
+    char* guard = stack - s_page_size;
+    if (guard > base) {
+        munmap(base, guard - base);
+    }
+    if (stack + len < base + reserve) {
+        munmap(stack + len, base + reserve - stack - len);
+    }
+    {
+        Spinlock::Lock lock(s_huge_mutex);
+        s_huge_stacks.insert(stack);
+    }
+    ++s_hugetlb;
+    return stack;
+}
+
+static void* MapStack(size_t size) {
+    if (s_hugepage == StackAllocator::HUGETLB) {
+        void* stack = MapHugeStack(size);
+        if (stack) {
+            ++s_mapped;
+            return stack;
+        }
+    }
+    size_t len = MapSize(size);
+    void* base = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        SYLAR_LOG_ERROR(g_logger) << "mmap fiber stack size=" << len << " errno=" << errno
+            << " errstr=" << strerror(errno);
+        throw std::bad_alloc();
+    }
+    if (s_hugepage == StackAllocator::THP) {
+        madvise(base, len, MADV_HUGEPAGE);
+    }
+    // overflow hits the guard page instead of the neighbour
+    SYLAR_ASSERT(!mprotect(base, s_page_size, PROT_NONE));
+    ++s_mapped;
+    return (char*)base + s_page_size;
+}
+
+static void UnmapStack(void* stack, size_t size) {
+    if (s_hugetlb) {
+        Spinlock::Lock lock(s_huge_mutex);
+        if (s_huge_stacks.erase(stack)) {
+            lock.unlock();
+            munmap((char*)stack - s_page_size, s_page_size);
+            munmap(stack, HugeSize(size));
+            return;
+        }
+    }
+    munmap((char*)stack - s_page_size, MapSize(size));
+}
+
+static thread_local bool t_stack_cache_destroyed = false;
+
+struct StackCache {
+    struct FreeList {
+        size_t size;
+        std::vector<void*> stacks;
+    };
+
+    ~StackCache() {
+        t_stack_cache_destroyed = true;
+        for (auto& i : lists) {
+            for (auto& stack : i.stacks) {
+                UnmapStack(stack, i.size);
+            }
+            s_cached -= i.stacks.size();
+        }
+    }
+
+    FreeList& get(size_t size) {
+        for (auto& i : lists) {
+            if (i.size == size) {
+                return i;
+            }
+        }
+        lists.push_back(FreeList{size, std::vector<void*>()});
+        return lists.back();
+    }
+
+    std::vector<FreeList> lists;
+};
+
+static thread_local StackCache t_stack_cache;
+
+void* StackAllocator::Alloc(size_t size) {
+    void* stack = nullptr;
+    StackCache::FreeList& list = t_stack_cache.get(size);
+    if (!list.stacks.empty()) {
+        stack = list.stacks.back();
+        list.stacks.pop_back();
+        --s_cached;
+        ++s_reused;
+    } else {
+        stack = MapStack(size);
+    }
+    uint64_t in_use = ++s_in_use;
+    uint64_t high = s_high_water;
+    while (in_use > high && !s_high_water.compare_exchange_weak(high, in_use));
+    return stack;
+}
+
+void StackAllocator::Dealloc(void* stack, size_t size) {
+    if (!stack) {
+        return;
+    }
+    --s_in_use;
+    if (t_stack_cache_destroyed) {
+        UnmapStack(stack, size);
+        return;
+    }
+    StackCache::FreeList& list = t_stack_cache.get(size);
+    if (list.stacks.size() < s_cache_size) {
+        list.stacks.push_back(stack);
+        ++s_cached;
+    } else {
+        UnmapStack(stack, size);
+    }
+}
+
+StackAllocator::Stats StackAllocator::GetStats() {
+    Stats stats;
+    stats.cached = s_cached;
+    stats.in_use = s_in_use;
+    stats.high_water = s_high_water;
+    stats.mapped = s_mapped;
+    stats.reused = s_reused;
+    stats.hugetlb = s_hugetlb;
+    return stats;
+}
+
+std::ostream& StackAllocator::Dump(std::ostream& os) {
+    Stats stats = GetStats();
+    os << "[StackAllocator cached=" << stats.cached
+       << " in_use=" << stats.in_use
+       << " high_water=" << stats.high_water
+       << " mapped=" << stats.mapped
+       << " reused=" << stats.reused
+       << " hugetlb=" << stats.hugetlb
+       << "]";
+    return os;
+}
+}
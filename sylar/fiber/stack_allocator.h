@@ -0,0 +1,35 @@
+#pragma once
+
+#include <ostream>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace sylar {
+/**
+ * mmap backed fiber stacks with a PROT_NONE guard page below the usable area.
+ * Released stacks are kept in a per-thread free list and reused by the next
+ * fiber of the same size instead of being returned to the OS.
+ */
+class StackAllocator {
+public:
+    enum HugePage {
+        NONE    = 0,    // normal pages
+        THP     = 1,    // madvise(MADV_HUGEPAGE)
+        HUGETLB = 2,    // MAP_HUGETLB rounded up to whole huge pages, falls back to normal pages
+    };
+
+    struct Stats {
+        uint64_t cached = 0;        // stacks sitting in free lists
+        uint64_t in_use = 0;        // stacks owned by fibers
+        uint64_t high_water = 0;    // max of in_use
+        uint64_t mapped = 0;        // total mmap calls
+        uint64_t reused = 0;        // allocations served from a free list
+        uint64_t hugetlb = 0;       // mmap calls that got MAP_HUGETLB pages
+    };
+
+    static void* Alloc(size_t size);
+    static void Dealloc(void* stack, size_t size);
+    static Stats GetStats();
+    static std::ostream& Dump(std::ostream& os);
+};
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+
+namespace sylar {
+/**
+ * Move-only void() callable with inline storage. Lambdas, std::bind results and
+ * std::function up to INLINE_SIZE bytes are stored without a heap allocation,
+ * larger callables fall back to new. Moving a Task never copies the callable.
+ */
+class Task {
+public:
+    enum {
+        INLINE_SIZE = 64,
+    };
+
+    Task() {}
+    Task(std::nullptr_t) {}
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type,
+        typename = decltype(std::declval<typename std::decay<F>::type&>()())>
+    Task(F&& f) {
+        typedef typename std::decay<F>::type Func;
+        if (IsNull(f)) {
+            return;
+        }
+        init<Func>(std::forward<F>(f), std::integral_constant<bool,
+                sizeof(Func) <= INLINE_SIZE && alignof(Func) <= alignof(Storage)
+                && std::is_nothrow_move_constructible<Func>::value>());
+    }
+
+    Task(Task&& other) {
+        moveFrom(other);
+    }
+
+    Task& operator=(Task&& other) {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        reset();
+    }
+
+    void operator()() {
+        m_ops->call(&m_storage);
+    }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    void swap(Task& other) {
+        Task tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    typedef std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+    struct Ops {
+        void (*call)(void* storage);
+        void (*move)(void* dst, void* src);     // leaves src destroyed
+        void (*destroy)(void* storage);
+    };
+
+    template<typename Func>
+    struct InlineOps {
+        static void Call(void* storage) { (*(Func*)storage)(); }
+        static void Move(void* dst, void* src) {
+            new (dst) Func(std::move(*(Func*)src));
+            ((Func*)src)->~Func();
+        }
+        static void Destroy(void* storage) { ((Func*)storage)->~Func(); }
+        static const Ops s_ops;
+    };
+
+    template<typename Func>
+    struct HeapOps {
+        static void Call(void* storage) { (**(Func**)storage)(); }
+        static void Move(void* dst, void* src) { *(Func**)dst = *(Func**)src; }
+        static void Destroy(void* storage) { delete *(Func**)storage; }
+        static const Ops s_ops;
+    };
+
+    template<typename F>
+    static bool IsNull(const F&) { return false; }
+    template<typename F>
+    static bool IsNull(F* const& f) { return f == nullptr; }
+    template<typename R, typename... Args>
+    static bool IsNull(const std::function<R(Args...)>& f) { return !f; }
+
+    template<typename Func, typename F>
+    void init(F&& f, std::true_type) {
+        new (&m_storage) Func(std::forward<F>(f));
+        m_ops = &InlineOps<Func>::s_ops;
+    }
+
+    template<typename Func, typename F>
+    void init(F&& f, std::false_type) {
+        *(Func**)&m_storage = new Func(std::forward<F>(f));
+        m_ops = &HeapOps<Func>::s_ops;
+    }
+
+    void moveFrom(Task& other) {
+        if (other.m_ops) {
+            other.m_ops->move(&m_storage, &other.m_storage);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+private:
+    Storage m_storage;
+    const Ops* m_ops = nullptr;
+};
+
+template<typename Func>
+const Task::Ops Task::InlineOps<Func>::s_ops = {
+    &Task::InlineOps<Func>::Call, &Task::InlineOps<Func>::Move, &Task::InlineOps<Func>::Destroy
+};
+
+template<typename Func>
+const Task::Ops Task::HeapOps<Func>::s_ops = {
+    &Task::HeapOps<Func>::Call, &Task::HeapOps<Func>::Move, &Task::HeapOps<Func>::Destroy
+};
+}
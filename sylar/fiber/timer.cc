@@ -1,9 +1,20 @@
+#include "clock.h"
+#include "config.h"
 #include "log.h"
 #include "timer.h"
 #include "util.h"
 
+#include <string.h>
+
 namespace sylar {
 static Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+static ConfigVar<bool>::ptr g_timer_wheel =
+    Config::Lookup<bool>("timer.wheel", false, "keep timers in a hierarchical timing wheel instead of a set");
+static ConfigVar<bool>::ptr g_timer_per_thread =
+    Config::Lookup<bool>("timer.per_thread", false, "every IOManager thread owns its timers, needs iomanager.sharded");
+
+static thread_local TimerManager* t_timers = nullptr;      // manager whose shard this thread owns
+static thread_local size_t t_timerShard = 0;
 
 bool Timer::Compare::operator()(const Timer::ptr lhs, const Timer::ptr rhs) const {
     if (!rhs) return false;
@@ -13,166 +24,522 @@ bool Timer::Compare::operator()(const Timer::ptr lhs, const Timer::ptr rhs) cons
     return lhs.get() < rhs.get();
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring)
-    : m_recurring(recurring), m_ms(ms), m_cb(cb) {
-    m_next = GetCurrentMS() + m_ms;
+Timer::Timer(uint64_t ms, Task cb, bool recurring)
+    : m_recurring(recurring), m_ms(ms) {
+    if (recurring) {
+        m_recurringCb = std::make_shared<Task>(std::move(cb));
+    } else {
+        m_cb = std::move(cb);
+    }
+    m_next = GetMonotonicMS() + m_ms;
 }
 
 Timer::Timer(uint64_t next) : m_next(next) {}
 
-TimerManager::TimerManager() {
-    m_previousTime = GetCurrentMS();
+void Timer::clearCallback() {
+    m_cb = nullptr;
+    m_recurringCb.reset();
+}
+
+TimingWheel::TimingWheel(uint64_t now_ms) : m_current(now_ms) {
+    memset(m_root, 0, sizeof(m_root));
+    memset(m_levels, 0, sizeof(m_levels));
+}
+
+TimingWheel::~TimingWheel() {
+    std::vector<Timer::ptr> timers;
+    clear(timers);
+}
+
+void TimingWheel::add(Timer::ptr timer) {
+    SYLAR_ASSERT(!timer->m_slot);
+    Timer* t = timer.get();
+    t->m_self = std::move(timer);
+    link(t);
+    ++m_size;
+}
+
+bool TimingWheel::remove(Timer* timer) {
+    if (!timer->m_slot) {
+        return false;
+    }
+    unlink(timer);
+    --m_size;
+    timer->m_self.reset();
+    return true;
+}
+
+void TimingWheel::link(Timer* timer) {
+    uint64_t expires = timer->m_next;
+    uint64_t delta = expires - m_current;
+    Timer** slot = nullptr;
+    if ((int64_t)delta < 0) {
+        // already due, runs on the next tick
+        slot = &m_root[m_current & (ROOT_SIZE - 1)];
+    } else if (delta < ROOT_SIZE) {
+        slot = &m_root[expires & (ROOT_SIZE - 1)];
+    } else {
+        if (delta > 0xffffffffull) {
+            // parked in the last level, moves down as it gets closer
+            expires = m_current + 0xffffffffull;
+        }
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= 1ull << (ROOT_BITS + (level + 1) * LEVEL_BITS)) {
+            ++level;
+        }
+        slot = &m_levels[level][(expires >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1)];
+    }
+    timer->m_slot = slot;
+    timer->m_prevLink = nullptr;
+    timer->m_nextLink = *slot;
+    if (*slot) {
+        (*slot)->m_prevLink = timer;
+    }
+    *slot = timer;
+}
+
+void TimingWheel::unlink(Timer* timer) {
+    if (timer->m_prevLink) {
+        timer->m_prevLink->m_nextLink = timer->m_nextLink;
+    } else {
+        *timer->m_slot = timer->m_nextLink;
+    }
+    if (timer->m_nextLink) {
+        timer->m_nextLink->m_prevLink = timer->m_prevLink;
+    }
+    timer->m_prevLink = nullptr;
+    timer->m_nextLink = nullptr;
+    timer->m_slot = nullptr;
 }
 
-TimerManager::~TimerManager() {}
+size_t TimingWheel::cascade(int level, size_t index) {
+    Timer* timer = m_levels[level][index];
+    m_levels[level][index] = nullptr;
+    while (timer) {
+        Timer* next = timer->m_nextLink;
+        link(timer);
+        timer = next;
+    }
+    return index;
+}
+
+void TimingWheel::advance(uint64_t now_ms, std::vector<Timer::ptr>& expired) {
+    if (m_size == 0) {
+        if (now_ms >= m_current) {
+            m_current = now_ms + 1;
+        }
+        return;
+    }
+    while (m_current <= now_ms && m_size > 0) {
+        size_t index = m_current & (ROOT_SIZE - 1);
+        if (index == 0) {
+            // the root wrapped, refill it from the level above and so on up
+            for (int level = 0; level < LEVELS; ++level) {
+                size_t i = (m_current >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+                if (cascade(level, i) != 0) {
+                    break;
+                }
+            }
+        }
+        ++m_current;
+        Timer* timer = m_root[index];
+        m_root[index] = nullptr;
+        while (timer) {
+            Timer* next = timer->m_nextLink;
+            timer->m_prevLink = nullptr;
+            timer->m_nextLink = nullptr;
+            timer->m_slot = nullptr;
+            --m_size;
+            expired.push_back(std::move(timer->m_self));
+            timer = next;
+        }
+    }
+    if (m_size == 0 && now_ms >= m_current) {
+        m_current = now_ms + 1;
+    }
+}
 
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring));
-    RWMutexType::WriteLock lock(m_mutex);
-    addTimer(timer, lock);
+void TimingWheel::clear(std::vector<Timer::ptr>& timers) {
+    auto take = [this, &timers](Timer*& slot){
+        Timer* timer = slot;
+        slot = nullptr;
+        while (timer) {
+            Timer* next = timer->m_nextLink;
+            timer->m_prevLink = nullptr;
+            timer->m_nextLink = nullptr;
+            timer->m_slot = nullptr;
+            --m_size;
+            timers.push_back(std::move(timer->m_self));
+            timer = next;
+        }
+    };
+    for (auto& i : m_root) {
+        take(i);
+    }
+    for (auto& level : m_levels) {
+        for (auto& i : level) {
+            take(i);
+        }
+    }
+}
+
+uint64_t TimingWheel::getNextTimeout(uint64_t now_ms) const {
+    if (m_size == 0) {
+        return ~0ull;
+    }
+    uint64_t next = ~0ull;
+    for (size_t k = 0; k < ROOT_SIZE; ++k) {
+        if (m_root[(m_current + k) & (ROOT_SIZE - 1)]) {
+            next = m_current + k;
+            break;
+        }
+    }
+    // a slot of a higher level can't hold anything due before its span starts
+    for (int level = 0; level < LEVELS; ++level) {
+        int shift = ROOT_BITS + level * LEVEL_BITS;
+        uint64_t block = m_current >> shift;
+        // on a block boundary the current slot has not been cascaded yet
+        size_t first = (m_current & ((1ull << shift) - 1)) == 0 ? 0 : 1;
+        for (size_t k = first; k < first + LEVEL_SIZE; ++k) {
+            uint64_t start = (block + k) << shift;
+            if (start >= next) {
+                break;
+            }
+            if (m_levels[level][(block + k) & (LEVEL_SIZE - 1)]) {
+                next = start;
+                break;
+            }
+        }
+    }
+    return next > now_ms ? next - now_ms : 0;
+}
+
+TimerManager::Shard::Shard(uint64_t now_ms, bool wheel) {
+    if (wheel) {
+        this->wheel.reset(new TimingWheel(now_ms));
+    }
+}
+
+TimerManager::TimerManager(size_t threads) {
+    m_perThread = g_timer_per_thread->getValue() && threads > 1;
+    uint64_t now_ms = GetMonotonicMS();
+    m_shards.resize(m_perThread ? threads : 1);
+    for (auto& i : m_shards) {
+        i.reset(new Shard(now_ms, g_timer_wheel->getValue()));
+    }
+}
+
+TimerManager::~TimerManager() {
+    if (t_timers == this) {
+        t_timers = nullptr;
+    }
+}
+
+Timer::ptr TimerManager::addTimer(uint64_t ms, Task cb, bool recurring) {
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring));
+    queueTimer(timer);
+    return timer;
+}
+
+Timer::ptr TimerManager::addTimer(Timer::ptr timer, uint64_t ms, Task cb) {
+    // an inbox op or the shard still holds it otherwise
+    if (!timer || timer.use_count() != 1) {
+        return addTimer(ms, std::move(cb));
+    }
+    timer->m_recurring = false;
+    timer->m_recurringCb.reset();
+    timer->m_cb = std::move(cb);
+    timer->m_ms = ms;
+    timer->m_next = GetMonotonicMS() + ms;
+    timer->m_state = Timer::PENDING;
+    queueTimer(timer);
     return timer;
 }
 
-static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
+static void OnTimer(std::weak_ptr<void> weak_cond, Task& cb) {
     std::shared_ptr<void> temp = weak_cond.lock();
     if (temp) {
         cb();
     }
 }
 
-Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb,
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, Task cb,
                                            std::weak_ptr<void> weak_cond, bool recurring) {
-    return addTimer(ms, std::bind(OnTimer, weak_cond, cb), recurring);
+    return addTimer(ms, std::bind(OnTimer, weak_cond, std::move(cb)), recurring);
 }
 
 uint64_t TimerManager::getNextTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    m_tickled = false;
-    if (m_timers.empty()) {
-        return ~0ull;
+    if (!m_perThread) {
+        RWMutexType::ReadLock lock(m_mutex);
+        return nextTimeout(*m_shards[0]);
     }
-    const Timer::ptr next = *m_timers.begin();
-    uint64_t now_ms = GetCurrentMS();
-    if (now_ms >= next->m_next) {
-        return 0;
-    } else {
-        return next->m_next - now_ms;
+    int local = getLocalShard();
+    if (local == -1) {
+        return ~0ull;
     }
+    Shard& shard = *m_shards[local];
+    drain(shard);
+    return nextTimeout(shard);
 }
 
-void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
-    uint64_t now_ms = GetCurrentMS();
-    std::vector<Timer::ptr> expired;
-    {
-        RWMutexType::ReadLock lcok(m_mutex);
-        if (m_timers.empty()) {
+void TimerManager::listExpiredCb(std::vector<Task>& cbs) {
+    if (!m_perThread) {
+        if (!hasTimer()) {
             return;
         }
-    }
-    RWMutexType::WriteLock lock(m_mutex);
-    if (m_timers.empty()) {
+        RWMutexType::WriteLock lock(m_mutex);
+        expire(*m_shards[0], cbs);
         return;
     }
-    bool rollover = detectClockRollover(now_ms);
-    if (!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+    int local = getLocalShard();
+    if (local == -1) {
         return;
     }
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while (it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
-    for (Timer::ptr timer : expired) {
-        cbs.push_back(timer->m_cb);
-        if (timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
-        } else {
-            timer->m_cb = nullptr;
-        }
+    Shard& shard = *m_shards[local];
+    drain(shard);
+    if (shard.size > 0) {
+        expire(shard, cbs);
     }
 }
 
 bool TimerManager::hasTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    for (auto& i : m_shards) {
+        if (i->size > 0 || !i->inbox.empty()) {
+            return true;
+        }
+    }
+    return false;
 }
 
 bool TimerManager::cancel(Timer::ptr timer) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if (!timer->m_cb) {
-        return false;
-    }
-    timer->m_cb = nullptr;
-    auto it = m_timers.find(timer);
-    if (it == m_timers.end()) {
-        return false;
+    if (m_perThread) {
+        // settles the race with the owner firing it, the owner unlinks it later
+        int pending = Timer::PENDING;
+        if (!timer->m_state.compare_exchange_strong(pending, Timer::CANCELLED)) {
+            return false;
+        }
+        submit({Op::CANCEL, std::move(timer), 0, false});
+        return true;
     }
-    m_timers.erase(it);
-    return true;
+    return submit({Op::CANCEL, std::move(timer), 0, false});
 }
 
 bool TimerManager::refresh(Timer::ptr timer) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if (!timer->m_cb) {
-        return false;
+    return submit({Op::REFRESH, std::move(timer), 0, false});
+}
+
+bool TimerManager::reset(Timer::ptr timer, uint64_t ms, bool from_now) {
+    return submit({Op::RESET, std::move(timer), ms, from_now});
+}
+
+void TimerManager::queueTimer(const Timer::ptr& timer) {
+    if (m_perThread) {
+        int local = getLocalShard();
+        timer->m_shard = local != -1 ? local : pickShard();
     }
-    auto it = m_timers.find(timer);
-    if (it == m_timers.end()) {
-        return false;
+    submit({Op::ADD, timer, 0, false});
+}
+
+void TimerManager::bindShard(size_t index) {
+    if (!m_perThread) {
+        return;
     }
-    m_timers.erase(it);
-    timer->m_next = GetCurrentMS() + timer->m_ms;
-    addTimer(timer, lock);
-    return true;
+    t_timers = this;
+    t_timerShard = index;
+    m_shards[index]->bound = true;
 }
 
-bool TimerManager::reset(Timer::ptr timer, uint64_t ms, bool from_now) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if (timer->m_ms == ms && !from_now) {
-        return true;
+void TimerManager::unbindShard() {
+    if (t_timers != this) {
+        return;
     }
-    if (!timer->m_cb) {
-        return false;
+    m_shards[t_timerShard]->bound = false;
+    t_timers = nullptr;
+}
+
+int TimerManager::getLocalShard() const {
+    return t_timers == this ? (int)t_timerShard : -1;
+}
+
+size_t TimerManager::pickShard() {
+    size_t count = m_shards.size();
+    size_t start = m_nextShard++;
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = (start + i) % count;
+        if (m_shards[index]->bound) {
+            return index;
+        }
     }
-    auto it = m_timers.find(timer);
-    if (it == m_timers.end()) {
-        return false;
+    // no thread runs yet, the last one is never the use_caller thread
+    return count - 1;
+}
+
+bool TimerManager::submit(Op op) {
+    bool at_front = false;
+    if (!m_perThread) {
+        RWMutexType::WriteLock lock(m_mutex);
+        bool rt = apply(*m_shards[0], op, at_front);
+        lock.unlock();
+        if (at_front) {
+            onTimerInsertedAtFront();
+        }
+        return rt;
     }
-    m_timers.erase(it);
-    uint64_t start = 0;
-    if (from_now) {
-        start = GetCurrentMS();
+    size_t index = op.timer->m_shard;
+    if ((int)index == getLocalShard()) {
+        // the owner is awake, it looks at its timers again before it sleeps
+        return apply(*m_shards[index], op, at_front);
+    }
+    bool rt = op.type == Op::ADD || op.timer->m_state == Timer::PENDING;
+    if (m_shards[index]->inbox.push(std::move(op))) {
+        wakeShard(index);
+    }
+    return rt;
+}
+
+bool TimerManager::apply(Shard& shard, const Op& op, bool& at_front) {
+    const Timer::ptr& timer = op.timer;
+    switch (op.type) {
+        case Op::ADD:
+            // cancelled while it was in the inbox
+            if (timer->m_state != Timer::PENDING) {
+                return false;
+            }
+            at_front = insert(shard, timer);
+            return true;
+        case Op::CANCEL:
+            if (!timer->hasCallback()) {
+                return false;
+            }
+            timer->clearCallback();
+            return unlink(shard, timer);
+        case Op::REFRESH:
+            if (!timer->isPending() || !unlink(shard, timer)) {
+                return false;
+            }
+            timer->m_next = GetMonotonicMS() + timer->m_ms;
+            at_front = insert(shard, timer);
+            return true;
+        case Op::RESET: {
+            if (timer->m_ms == op.ms && !op.fromNow) {
+                return true;
+            }
+            if (!timer->isPending() || !unlink(shard, timer)) {
+                return false;
+            }
+            uint64_t start = 0;
+            if (op.fromNow) {
+                start = GetMonotonicMS();
+            } else {
+                start = timer->m_next - timer->m_ms;
+            }
+            timer->m_ms = op.ms;
+            timer->m_next = start + op.ms;
+            at_front = insert(shard, timer);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TimerManager::drain(Shard& shard) {
+    if (shard.inbox.empty()) {
+        return;
+    }
+    shard.inbox.drain([this, &shard](Op&& op){
+        bool at_front = false;
+        apply(shard, op, at_front);
+    });
+}
+
+bool TimerManager::insert(Shard& shard, const Timer::ptr& timer) {
+    bool at_front = false;
+    if (shard.wheel) {
+        // sooner than any idle thread plans to wake up
+        at_front = timer->m_next < shard.sleepUntil && !shard.tickled;
+        shard.wheel->add(timer);
     } else {
-        start = timer->m_next - timer->m_ms;
+        auto it = shard.timers.insert(timer).first;
+        at_front = (it == shard.timers.begin()) && !shard.tickled;
     }
-    timer->m_ms = ms;
-    timer->m_next = start + ms;
-    addTimer(timer, lock);
-    return true;
+    if (at_front) {
+        shard.tickled = true;
+    }
+    shard.size = shard.count();
+    return at_front;
 }
 
-void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-    auto it = m_timers.insert(val).first;
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
-    if(at_front) {
-        m_tickled = true;
+bool TimerManager::unlink(Shard& shard, const Timer::ptr& timer) {
+    bool rt = false;
+    if (shard.wheel) {
+        rt = shard.wheel->remove(timer.get());
+    } else {
+        rt = shard.timers.erase(timer) > 0;
     }
-    lock.unlock();
-    if(at_front) {
-        onTimerInsertedAtFront();
+    shard.size = shard.count();
+    return rt;
+}
+
+uint64_t TimerManager::nextTimeout(Shard& shard) {
+    shard.tickled = false;
+    if (shard.wheel) {
+        uint64_t now_ms = GetMonotonicMS();
+        uint64_t timeout = shard.wheel->getNextTimeout(now_ms);
+        shard.sleepUntil = timeout == ~0ull ? ~0ull : now_ms + timeout;
+        return timeout;
+    }
+    if (shard.timers.empty()) {
+        return ~0ull;
+    }
+    const Timer::ptr next = *shard.timers.begin();
+    uint64_t now_ms = GetMonotonicMS();
+    if (now_ms >= next->m_next) {
+        return 0;
+    } else {
+        return next->m_next - now_ms;
     }
 }
 
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    if (now_ms < m_previousTime && now_ms < (m_previousTime - 60 * 60 * 1000)) {
-        rollover = true;
+void TimerManager::expire(Shard& shard, std::vector<Task>& cbs) {
+    // the loop clock was just updated after epoll_wait
+    uint64_t now_ms = GetLoopMS();
+    std::vector<Timer::ptr> expired;
+    if (shard.wheel) {
+        shard.wheel->advance(now_ms, expired);
+    } else {
+        if (shard.timers.empty() || (*shard.timers.begin())->m_next > now_ms) {
+            return;
+        }
+        Timer::ptr now_timer(new Timer(now_ms));
+        auto it = shard.timers.lower_bound(now_timer);
+        while (it != shard.timers.end() && (*it)->m_next == now_ms) {
+            ++it;
+        }
+        expired.insert(expired.begin(), shard.timers.begin(), it);
+        shard.timers.erase(shard.timers.begin(), it);
+    }
+    cbs.reserve(expired.size());
+    for (Timer::ptr& timer : expired) {
+        int pending = Timer::PENDING;
+        if (timer->m_recurring ? timer->m_state != Timer::PENDING
+                : !timer->m_state.compare_exchange_strong(pending, Timer::FIRED)) {
+            // cancelled by another thread, its CANCEL op is still in the inbox
+            timer->clearCallback();
+            continue;
+        }
+        if (timer->m_recurring) {
+            std::shared_ptr<Task> cb = timer->m_recurringCb;
+            cbs.push_back([cb](){ (*cb)(); });
+            timer->m_next = now_ms + timer->m_ms;
+            if (shard.wheel) {
+                shard.wheel->add(timer);
+            } else {
+                shard.timers.insert(timer);
+            }
+        } else {
+            cbs.push_back(std::move(timer->m_cb));
+        }
     }
-    m_previousTime = now_ms;
-    return rollover;
+    shard.size = shard.count();
 }
 }
\ No newline at end of file
@@ -1,22 +1,38 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <set>
 #include <stdint.h>
 #include <vector>
 
+#include "cached_allocator.h"
+#include "mpsc_queue.h"
 #include "mutex.h"
+#include "noncopyable.h"
+#include "task.h"
 
 namespace sylar {
 class Timer {
 friend class TimerManager;
+friend class TimingWheel;
 public:
     typedef std::shared_ptr<Timer> ptr;
 
 private:
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring);
+    // per thread timers: cancel() from another thread races with the owner firing it
+    enum State {
+        PENDING,
+        CANCELLED,
+        FIRED,
+    };
+
+    Timer(uint64_t ms, Task cb, bool recurring);
     Timer(uint64_t next);
+    bool hasCallback() const { return m_cb || m_recurringCb; }
+    bool isPending() const { return hasCallback() && m_state == PENDING; }
+    void clearCallback();
 
     struct Compare {
         bool operator()(const Timer::ptr lhs, const Timer::ptr rhs) const;
@@ -26,34 +42,150 @@ private:
     bool m_recurring = false;
     uint64_t m_ms = 0;
     uint64_t m_next = 0;
-    std::function<void()> m_cb;
+    Task m_cb;
+    std::shared_ptr<Task> m_recurringCb;    // shared by every fire of a recurring timer
+    // timing wheel slot list, a queued timer keeps itself alive through m_self
+    Timer* m_prevLink = nullptr;
+    Timer* m_nextLink = nullptr;
+    Timer** m_slot = nullptr;
+    Timer::ptr m_self;
+    std::atomic<int> m_state {PENDING};
+    int m_shard = 0;            // index of the owning shard in TimerManager
+};
+
+/**
+ * Hierarchical timing wheel with 1ms ticks: 256 slots for the next 256ms,
+ * then four levels of 64 slots, each level 64 times coarser, covering 2^32ms.
+ * Timers move down a level when time reaches their slot. add and remove are
+ * O(1) list operations. Not thread safe.
+ */
+class TimingWheel : Noncopyable {
+public:
+    TimingWheel(uint64_t now_ms);
+    ~TimingWheel();
+    void add(Timer::ptr timer);
+    // false if the timer is not queued
+    bool remove(Timer* timer);
+    // take the timers due at now_ms
+    void advance(uint64_t now_ms, std::vector<Timer::ptr>& expired);
+    // take every timer
+    void clear(std::vector<Timer::ptr>& timers);
+    // ms until the earliest slot that may hold a due timer, ~0ull if empty
+    uint64_t getNextTimeout(uint64_t now_ms) const;
+    size_t size() const { return m_size; }
+
+private:
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int LEVELS = 4;
+    static const size_t ROOT_SIZE = 1 << ROOT_BITS;
+    static const size_t LEVEL_SIZE = 1 << LEVEL_BITS;
+
+    void link(Timer* timer);
+    void unlink(Timer* timer);
+    // re-link the timers of one slot, returns the slot index
+    size_t cascade(int level, size_t index);
+
+private:
+    Timer* m_root[ROOT_SIZE];
+    Timer* m_levels[LEVELS][LEVEL_SIZE];
+    uint64_t m_current;         // next tick to process
+    size_t m_size = 0;
 };
 
+/**
+ * Timers for an IOManager. timer.wheel selects the TimingWheel, otherwise
+ * timers are kept ordered in a std::set.
+ *
+ * With timer.per_thread and more than one thread, every thread that called
+ * bindShard() owns a shard of timers and touches it without locking. Timers
+ * added by a bound thread go to its own shard, others are posted to a lock
+ * free inbox that the owner drains before it computes its next timeout. From
+ * a thread that does not own the timer, refresh and reset are applied later
+ * and report success if the timer had not fired or been cancelled yet.
+ */
 class TimerManager {
 public:
     typedef RWMutex RWMutexType;
 
-    TimerManager();
+    // threads: how many threads may bind a shard of their own
+    TimerManager(size_t threads = 1);
     virtual ~TimerManager();
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb,
+    Timer::ptr addTimer(uint64_t ms, Task cb, bool recurring = false);
+    /**
+     * addTimer that reuses timer if it is neither queued nor referenced by
+     * anyone but the caller (move it in), e.g. a timeout armed over and over.
+     */
+    Timer::ptr addTimer(Timer::ptr timer, uint64_t ms, Task cb);
+    Timer::ptr addConditionTimer(uint64_t ms, Task cb,
                                  std::weak_ptr<void> weak_cond, bool recurring = false);
+    // for the shard of the calling thread if it is bound, ~0ull if it has no timers
     uint64_t getNextTimer();
-    void listExpiredCb(std::vector<std::function<void()>>& cbs);
+    void listExpiredCb(std::vector<Task>& cbs);
+    // timers of every shard
     bool hasTimer();
     bool cancel(Timer::ptr timer);
     bool refresh(Timer::ptr timer);
     bool reset(Timer::ptr timer, uint64_t ms, bool from_now);
+    bool isPerThread() const { return m_perThread; }
+    size_t getShardCount() const { return m_shards.size(); }
 
 protected:
-    void addTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
-    bool detectClockRollover(uint64_t now_ms);
+    struct Op {
+        enum Type {
+            ADD,
+            CANCEL,
+            REFRESH,
+            RESET,
+        };
+        Type type;
+        Timer::ptr timer;
+        uint64_t ms;
+        bool fromNow;
+    };
+
+    struct Shard {
+        Shard(uint64_t now_ms, bool wheel);
+
+        std::set<Timer::ptr, Timer::Compare, CachedAllocator<Timer::ptr>> timers;
+        std::unique_ptr<TimingWheel> wheel;
+        bool tickled = false;
+        uint64_t sleepUntil = ~0ull;    // deadline last handed out by getNextTimer
+        MpscQueue<Op> inbox;            // from threads that do not own the shard
+        std::atomic<size_t> size {0};
+        std::atomic<bool> bound {false};
+
+        size_t count() const { return wheel ? wheel->size() : timers.size(); }
+    };
+
     virtual void onTimerInsertedAtFront() = 0;
+    // an op was posted to the empty inbox of a shard, its thread has to look at it
+    virtual void wakeShard(size_t index) { onTimerInsertedAtFront(); }
+    // the calling thread owns shard index until unbindShard()
+    void bindShard(size_t index);
+    void unbindShard();
+
+private:
+    // index of the shard owned by the calling thread, -1 if none
+    int getLocalShard() const;
+    // shard for a timer added by a thread that owns none
+    size_t pickShard();
+    void queueTimer(const Timer::ptr& timer);
+    // runs op on the shard of its timer, or posts it to the owner's inbox
+    bool submit(Op op);
+    bool apply(Shard& shard, const Op& op, bool& at_front);
+    void drain(Shard& shard);
+    // true if the timer is the new earliest one
+    bool insert(Shard& shard, const Timer::ptr& timer);
+    // take a queued timer out before it is re-added, false if not queued
+    bool unlink(Shard& shard, const Timer::ptr& timer);
+    uint64_t nextTimeout(Shard& shard);
+    void expire(Shard& shard, std::vector<Task>& cbs);
 
 private:
-    RWMutexType m_mutex;
-    std::set<Timer::ptr, Timer::Compare> m_timers;
-    bool m_tickled = false;
-    uint64_t m_previousTime = 0;
+    RWMutexType m_mutex;        // guards the only shard when not per thread
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    bool m_perThread = false;
+    std::atomic<size_t> m_nextShard {0};
 };
 }
\ No newline at end of file
@@ -1,8 +1,30 @@
 #include "http.h"
 #include "util.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace sylar {
 namespace http {
+FileBody::~FileBody() {
+    if (owner && fd != -1) {
+        close(fd);
+    }
+}
+
+FileBody::ptr FileBody::Open(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return nullptr;
+    }
+    return std::make_shared<FileBody>(fd, 0, st.st_size, true);
+}
 
 HttpRequest::HttpRequest(uint8_t version, bool close) : m_method(HttpMethod::GET)
     , m_version(version), m_close(close), m_websocket(false), m_parserParamFlag(0), m_path("/") {}
@@ -256,7 +278,10 @@ std::ostream& HttpResponse::dump(std::ostream& os) const {
     if(!m_websocket) {
         os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
     }
-    if(!m_body.empty()) {
+    if(m_fileBody) {
+        // only the head, the file follows it on the socket
+        os << "content-length: " << m_fileBody->length << "\r\n\r\n";
+    } else if(!m_body.empty()) {
         os << "content-length: " << m_body.size() << "\r\n\r\n"
            << m_body;
     } else {
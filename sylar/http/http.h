@@ -2,13 +2,34 @@
 
 #include <map>
 #include <memory>
+#include <sys/types.h>
 
 #include "http_util.h"
+#include "noncopyable.h"
 
 namespace sylar {
 namespace http {
 class HttpResponse;
 
+/**
+ * Response body sent from a file with sendfile, it never passes through a
+ * user space buffer. The fd is closed with the body if owner is set.
+ */
+struct FileBody : Noncopyable {
+    typedef std::shared_ptr<FileBody> ptr;
+
+    FileBody(int fd, off_t offset, size_t length, bool owner = false)
+        : fd(fd), offset(offset), length(length), owner(owner) {}
+    ~FileBody();
+    // the whole file, nullptr if path is not a readable regular file
+    static ptr Open(const std::string& path);
+
+    int fd;
+    off_t offset;
+    size_t length;
+    bool owner;
+};
+
 class HttpRequest {
 public:
     typedef std::shared_ptr<HttpRequest> ptr;
@@ -143,9 +164,13 @@ public:
     void setWebsocket(bool v) { m_websocket = v; }
     bool isWebsocket() const { return m_websocket; }
 
-    void setBody(const std::string& v) { m_body = v; }
+    void setBody(const std::string& v) { m_body = v; m_fileBody.reset(); }
     const std::string& getBody() const { return m_body; }
 
+    // replaces the string body, HttpSession sends it after the head
+    void setFileBody(FileBody::ptr v) { m_fileBody = v; m_body.clear(); }
+    FileBody::ptr getFileBody() const { return m_fileBody; }
+
     void setReason(const std::string& v) { m_reason = v; }
     const std::string& getReason() const { return m_reason; }
 
@@ -178,6 +203,7 @@ private:
     bool m_close;
     bool m_websocket;
     std::string m_body;
+    FileBody::ptr m_fileBody;
     std::string m_reason;
     MapType m_headers;
     std::vector<std::string> m_cookies;
@@ -1,3 +1,4 @@
+#include "clock.h"
 #include "http_connection.h"
 #include "http_parser.h"
 #include "log.h"
@@ -303,7 +304,7 @@ HttpConnectionPool::HttpConnectionPool(const std::string& host
 }
 
 HttpConnection::ptr HttpConnectionPool::getConnection() {
-    uint64_t now_ms = sylar::GetCurrentMS();
+    uint64_t now_ms = sylar::GetCoarseMonotonicMS();
     std::vector<HttpConnection*> invalid_conns;
     HttpConnection* ptr = nullptr;
     MutexType::Lock lock(m_mutex);
@@ -314,7 +315,7 @@ HttpConnection::ptr HttpConnectionPool::getConnection() {
             invalid_conns.push_back(conn);
             continue;
         }
-        if((conn->m_createTime + m_maxAliveTime) > now_ms) {
+        if((conn->m_createTime + m_maxAliveTime) <= now_ms) {
             invalid_conns.push_back(conn);
             continue;
         }
@@ -345,6 +346,7 @@ HttpConnection::ptr HttpConnectionPool::getConnection() {
         }
 
         ptr = new HttpConnection(sock);
+        ptr->m_createTime = now_ms;
         ++m_total;
     }
     return HttpConnection::ptr(ptr, std::bind(&HttpConnectionPool::ReleasePtr
@@ -354,7 +356,7 @@ HttpConnection::ptr HttpConnectionPool::getConnection() {
 void HttpConnectionPool::ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool) {
     ++ptr->m_request;
     if(!ptr->isConnected()
-            || ((ptr->m_createTime + pool->m_maxAliveTime) >= sylar::GetCurrentMS())
+            || ((ptr->m_createTime + pool->m_maxAliveTime) <= sylar::GetCoarseMonotonicMS())
             || (ptr->m_request >= pool->m_maxRequest)) {
         delete ptr;
         --pool->m_total;
@@ -32,7 +32,9 @@ void HttpServer::handleClient(Socket::ptr client) {
         rsp->setHeader("Server", getName());
         // rsp->setBody("hello sylar");
         m_dispatch->handle(req, rsp, session);
-        session->sendResponse(rsp);
+        if(session->sendResponse(rsp) <= 0) {
+            break;
+        }
 
         if(!m_isKeepalive || req->isClose()) {
             break;
@@ -15,7 +15,7 @@ HttpRequest::ptr HttpSession::recvRequest() {
     int offset = 0;
     do {
         int len = read(data + offset, buff_size - offset);
-        if (len < 0) {
+        if (len <= 0) {
             close();
             return nullptr;
         }
@@ -63,7 +63,15 @@ int HttpSession::sendResponse(HttpResponse::ptr rsp) {
     std::stringstream ss;
     ss << *rsp;
     std::string data = ss.str();
-    return writeFixSize(data.c_str(), data.size());
+    int rt = writeFixSize(data.c_str(), data.size());
+    FileBody::ptr file = rsp->getFileBody();
+    if (rt <= 0 || !file) {
+        return rt;
+    }
+    if (sendFile(file->fd, file->offset, file->length) != (int64_t)file->length) {
+        return -1;
+    }
+    return rt;
 }
 }   // http
 }   // sylar
\ No newline at end of file
@@ -1,100 +1,134 @@
 #include "fd_manager.h"
 #include "hook.h"
 
+#include <sched.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 namespace sylar {
-FdCtx::FdCtx(int fd): m_isInit(false), m_isSocket(false), m_sysNonblock(false),
-    m_userNonblock(false), m_fd(fd), m_recvTimeout(-1), m_sendTimeout(-1) {
-    init();
-}
-
-FdCtx::~FdCtx() {}
-
 void FdCtx::setTimeout(int type, uint64_t v) {
     if (type == SO_RCVTIMEO) {
-        m_recvTimeout = v;
+        m_recvTimeout.store(v, std::memory_order_relaxed);
     } else {
-        m_sendTimeout = v;
+        m_sendTimeout.store(v, std::memory_order_relaxed);
     }
 }
 
-uint64_t FdCtx::getTimeout(int type) {
+uint64_t FdCtx::getTimeout(int type) const {
     if (type == SO_RCVTIMEO) {
-        return m_recvTimeout;
+        return m_recvTimeout.load(std::memory_order_relaxed);
     } else {
-        return m_sendTimeout;
+        return m_sendTimeout.load(std::memory_order_relaxed);
     }
 }
 
-bool FdCtx::init() {
-    if (m_isInit) {
-        return true;
+void FdCtx::setFlag(uint64_t flag, bool on) {
+    if (on) {
+        m_state.fetch_or(flag, std::memory_order_relaxed);
+    } else {
+        m_state.fetch_and(~flag, std::memory_order_relaxed);
     }
-    m_recvTimeout = -1;
-    m_sendTimeout = -1;
+}
+
+void FdCtx::init() {
+    m_recvTimeout.store(~0ull, std::memory_order_relaxed);
+    m_sendTimeout.store(~0ull, std::memory_order_relaxed);
+    uint64_t flags = CREATED;
     struct stat fd_stat;
-    if (-1 == fstat(m_fd, &fd_stat)) {
-        m_isInit = false;
-        m_isSocket = false;
-    } else {
-        m_isInit = true;
-        m_isSocket = S_ISSOCK(fd_stat.st_mode);
+    if (-1 != fstat(m_fd, &fd_stat)) {
+        flags |= INIT;
+        if (S_ISSOCK(fd_stat.st_mode)) {
+            flags |= SOCKET;
+        }
     }
-    if (m_isSocket) {
-        int flags = fcntl_f(m_fd, F_GETFL, 0);
-        if (!(flags & O_NONBLOCK)) {
-            fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
+    if (flags & SOCKET) {
+        int fl = fcntl_f(m_fd, F_GETFL, 0);
+        if (!(fl & O_NONBLOCK)) {
+            fcntl_f(m_fd, F_SETFL, fl | O_NONBLOCK);
         }
-        m_sysNonblock = true;
-    } else {
-        m_sysNonblock = false;
+        flags |= SYS_NONBLOCK;
+    }
+    uint64_t generation = getState() >> 32;
+    m_state.store(generation << 32 | flags, std::memory_order_release);
+}
+
+void FdCtx::initSocket(bool user_nonblock) {
+    m_recvTimeout.store(~0ull, std::memory_order_relaxed);
+    m_sendTimeout.store(~0ull, std::memory_order_relaxed);
+    uint64_t flags = CREATED | INIT | SOCKET | SYS_NONBLOCK;
+    if (user_nonblock) {
+        flags |= USER_NONBLOCK;
     }
-    m_userNonblock = false;
-    m_isClose = false;
-    return m_isInit;
+    uint64_t generation = getState() >> 32;
+    m_state.store(generation << 32 | flags, std::memory_order_release);
 }
 
 FdManager* FdManager::GetInstance() {
     return Singleton<FdManager>::GetInstance();
 }
 
-FdManager::FdManager() {
-    m_datas.resize(64);
-}
+FdManager::FdManager() {}
 
 FdCtx::ptr FdManager::get(int fd, bool auto_creat) {
-    if (fd == -1) {
+    if (fd < 0) {
         return nullptr;
     }
-    RWMutexType::ReadLock lock_r(m_mutex);
-    if ((int)m_datas.size() <= fd) {
-        if (auto_creat == false) {
-            return nullptr;
-        }
-    } else {
-        if (m_datas[fd] || !auto_creat) {
-            return m_datas[fd];
-        }
+    FdCtx* ctx = auto_creat ? m_datas.getOrCreate(fd, [](FdCtx& ctx, size_t index){
+        ctx.m_fd = index;
+    }) : m_datas.get(fd);
+    if (!ctx) {
+        return nullptr;
+    }
+    uint64_t state = ctx->getState();
+    if ((state & FdCtx::CREATED) || !auto_creat) {
+        return (state & FdCtx::CREATED) ? ctx : nullptr;
+    }
+    if (claim(ctx)) {
+        ctx->init();
     }
-    lock_r.unlock();
+    return ctx;
+}
 
-    RWMutexType::WriteLock lock_w(m_mutex);
-    FdCtx::ptr ctx = std::make_shared<FdCtx>(fd);
-    if (fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+FdCtx::ptr FdManager::createSocket(int fd, bool user_nonblock) {
+    if (fd < 0) {
+        return nullptr;
+    }
+    FdCtx* ctx = m_datas.getOrCreate(fd, [](FdCtx& ctx, size_t index){
+        ctx.m_fd = index;
+    });
+    if (ctx && claim(ctx)) {
+        ctx->initSocket(user_nonblock);
     }
-    m_datas[fd] = ctx;
     return ctx;
 }
 
+bool FdManager::claim(FdCtx* ctx) {
+    // a thread creating the same fd at once waits for us
+    while (true) {
+        uint64_t state = ctx->m_state.load(std::memory_order_acquire);
+        if (state & FdCtx::CREATED) {
+            return false;
+        }
+        if (!(state & FdCtx::BUSY) && ctx->m_state.compare_exchange_weak(state,
+                    state | FdCtx::BUSY, std::memory_order_acquire)) {
+            return true;
+        }
+        sched_yield();
+    }
+}
+
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock_r(m_mutex);
-    if ((int)m_datas.size() <= fd) {
+    FdCtx* ctx = fd < 0 ? nullptr : m_datas.get(fd);
+    if (!ctx) {
         return;
     }
-    m_datas[fd].reset();
+    uint64_t state = ctx->getState();
+    do {
+        if (!(state & FdCtx::CREATED)) {
+            return;
+        }
+    } while (!ctx->m_state.compare_exchange_weak(state, ((state >> 32) + 1) << 32,
+                std::memory_order_release, std::memory_order_relaxed));
+}
 }
-}
\ No newline at end of file
@@ -1,57 +1,80 @@
 #pragma once
 
-#include <memory>
+#include <atomic>
 #include <stdint.h>
-#include <vector>
 
-#include "mutex.h"
+#include "segmented_array.h"
 #include "singleton.h"
 
 namespace sylar {
+/**
+ * Hook state of one fd. Flags and a generation share one atomic word, so
+ * the hooks learn everything they need from a single relaxed load. The
+ * record is reused when the kernel hands out the fd number again, the
+ * generation tells a waiter that its fd was closed in the meantime.
+ */
 class FdCtx {
+friend class FdManager;
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
-
-    FdCtx(int fd);
-    ~FdCtx();
-    bool isInit() const { return m_isInit; }
-    bool isSocket() const { return m_isSocket; }
-    bool isClose() const { return m_isClose; }
-    void setUserNonblock(bool flag) { m_userNonblock = flag; }
-    bool getUserNonblock() { return m_userNonblock; }
-    void setSysNonblock(bool flag) { m_sysNonblock = flag; }
-    bool getSysNonblock() { return m_sysNonblock; }
+    // records live as long as the FdManager
+    typedef FdCtx* ptr;
+
+    bool isInit() const { return getState() & INIT; }
+    bool isSocket() const { return getState() & SOCKET; }
+    // deleted and not created again yet
+    bool isClose() const { return !(getState() & CREATED); }
+    void setUserNonblock(bool flag) { setFlag(USER_NONBLOCK, flag); }
+    bool getUserNonblock() const { return getState() & USER_NONBLOCK; }
+    void setSysNonblock(bool flag) { setFlag(SYS_NONBLOCK, flag); }
+    bool getSysNonblock() const { return getState() & SYS_NONBLOCK; }
     void setTimeout(int type, uint64_t v);
-    uint64_t getTimeout(int type);
+    uint64_t getTimeout(int type) const;
+    // bumped by FdManager::del
+    uint32_t getGeneration() const { return getState() >> 32; }
 
 private:
-    bool init();
+    enum Flag {
+        CREATED         = 0x1,
+        INIT            = 0x2,
+        SOCKET          = 0x4,
+        SYS_NONBLOCK    = 0x8,
+        USER_NONBLOCK   = 0x10,
+        BUSY            = 0x20,     // being created
+    };
+
+    uint64_t getState() const { return m_state.load(std::memory_order_relaxed); }
+    void setFlag(uint64_t flag, bool on);
+    void init();
+    // for sockets created nonblocking, no fstat or fcntl
+    void initSocket(bool user_nonblock);
 
 private:
-    bool m_isInit: 1;
-    bool m_isSocket: 1;
-    bool m_sysNonblock: 1;
-    bool m_userNonblock: 1;
-    bool m_isClose: 1;
-    int m_fd;
-    uint64_t m_recvTimeout;
-    uint64_t m_sendTimeout;
+    int m_fd = -1;
+    std::atomic<uint64_t> m_state {0};      // generation << 32 | flags
+    std::atomic<uint64_t> m_recvTimeout {~0ull};
+    std::atomic<uint64_t> m_sendTimeout {~0ull};
 };
 
+/**
+ * FdCtx of every fd seen by the hooks, kept in a SegmentedArray indexed by
+ * fd. Lookups take no lock and touch no reference count.
+ */
 class FdManager {
 friend class Singleton<FdManager>;
 public:
-    typedef RWMutex RWMutexType;
-
     static FdManager* GetInstance();
+    // nullptr unless fd was created and not deleted since
     FdCtx::ptr get(int fd, bool auto_creat = false);
+    // registers a socket the caller created with O_NONBLOCK, e.g. by accept4
+    FdCtx::ptr createSocket(int fd, bool user_nonblock = false);
     void del(int fd);
 
 private:
     FdManager();
+    // BUSY claim on a record that is not created, false if it already is
+    bool claim(FdCtx* ctx);
 
 private:
-    RWMutexType m_mutex;
-    std::vector<FdCtx::ptr> m_datas;
+    SegmentedArray<FdCtx> m_datas;
 };
-}
\ No newline at end of file
+}
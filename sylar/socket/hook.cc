@@ -7,7 +7,9 @@
 
 #include <dlfcn.h>
 #include <cerrno>
+#include <linux/io_uring.h>
 #include <memory>
+#include <string.h>
 #include <utility>
 
 #define XX(name) name ## _fun name ## _f = nullptr;
@@ -54,68 +56,112 @@ void set_hook_enable(bool flag) {
 }
 }   // sylar
 
-struct TimerInfo {
-    int cancelled = 0;
+// errno is thread local and __errno_location() is declared const, so after a
+// yield the fiber may resume on another thread while the compiler reuses the
+// errno address it computed before. Access errno through these after yields.
+static __attribute__((noinline)) int get_errno() {
+    return errno;
+}
+
+static __attribute__((noinline)) void set_errno(int err) {
+    errno = err;
+}
+
+// the kernel writes the caller's buffers and addresses after the fiber parks,
+// a fiber on a shared stack has its frame swapped out by then
+static bool use_uring_here(sylar::IOManager* ioManager) {
+    return ioManager->hasUring() && !sylar::Fiber::GetThis()->isSharedStack();
+}
+
+// prepares the io_uring equivalent of a hooked call, false if there is none
+struct NoUringOp {
+    bool operator()(io_uring_sqe&) const { return false; }
 };
 
-template<typename OriginFun, typename... Args>
+static void prep_sqe(io_uring_sqe& sqe, uint8_t opcode, int fd, const void* addr,
+                     uint32_t len, uint64_t off) {
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)addr;
+    sqe.len = len;
+    sqe.off = off;
+}
+
+template<typename OriginFun, typename UringOp, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
-                     uint32_t event, int timeout_type, Args&&... args) {
+                     uint32_t event, int timeout_type, UringOp uring_op, Args&&... args) {
     if (!sylar::is_hook_enable()) {
         return fun(fd, std::forward<Args>(args)...);
     }
+    // no lock and no reference count, only records of open fds come back
     sylar::FdCtx::ptr ctx = sylar::FdManager::GetInstance()->get(fd);
     if (!ctx) {
         return fun(fd, std::forward<Args>(args)...);
     }
-    if (ctx->isClose()) {
-        errno = EBADF;
-        return -1;
-    }
     if (!ctx->isSocket() || ctx->getUserNonblock()) {
         return fun(fd, std::forward<Args>(args)...);
     }
     uint64_t timeout = ctx->getTimeout(timeout_type);
-    std::shared_ptr<TimerInfo> timer_info = std::make_shared<TimerInfo>();
+    uint32_t generation = ctx->getGeneration();
+    sylar::IOManager* ioManager = sylar::IOManager::GetThis();
+    bool use_uring = ioManager && use_uring_here(ioManager);
 
 retry:
-    ssize_t rt = fun(fd, std::forward<Args>(args)...);
-    while (rt == -1 && errno == EINTR) {    // system interrupt, try again
+    ssize_t rt = -1;
+    io_uring_sqe sqe;
+    bool submit = use_uring && uring_op(sqe);
+    // a read usually finds no data yet and the ring tries it inline anyway,
+    // writes usually succeed at once and skip the ring
+    if (!submit || event != sylar::IOManager::READ) {
         rt = fun(fd, std::forward<Args>(args)...);
+        while (rt == -1 && get_errno() == EINTR) {    // system interrupt, try again
+            rt = fun(fd, std::forward<Args>(args)...);
+        }
+        if (ioManager) {
+            ioManager->addSyscallCount();
+        }
+        submit = submit && rt == -1 && get_errno() == EAGAIN;
     }
-    if (rt == -1 && errno == EAGAIN) {  //
-        sylar::IOManager* ioManager = sylar::IOManager::GetThis();
-        sylar::Timer::ptr timer;
-        std::weak_ptr<TimerInfo> weak_info(timer_info);
-        if (timeout != ~0ull) {
-            timer = ioManager->addConditionTimer(timeout, [weak_info, fd, ioManager, event]{
-                std::shared_ptr<TimerInfo> tf = weak_info.lock();
-                if (!tf || tf->cancelled) {
-                    return;
-                }
-                tf->cancelled = ETIMEDOUT;
-                ioManager->cancelEvent(fd, (sylar::IOManager::Event)event);
-            }, weak_info);
+    if (submit) {
+        // the ring does the retry, no readiness round trip through epoll_ctl
+        int res = ioManager->submitIO(fd, (sylar::IOManager::Event)event, sqe, timeout);
+        if (res >= 0) {
+            return res;
+        }
+        if (res == -EAGAIN) {
+            // the kernel would not wait on this fd for us, use readiness events
+            use_uring = false;
+            goto retry;
         }
-        int err = ioManager->addEvent(fd, (sylar::IOManager::Event)event);
-        if (err == -1) {
+        if (res == -ECANCELED) {
+            if (ctx->getGeneration() == generation) {
+                goto retry;
+            }
+            // cancelled by the hooked close
+            res = -EBADF;
+        }
+        set_errno(-res);
+        return -1;
+    }
+    if (rt == -1 && get_errno() == EAGAIN) {  //
+        // the wait state lives in the IOManager's fd context, nothing to allocate here
+        int res = ioManager->waitEvent(fd, (sylar::IOManager::Event)event, timeout);
+        if (res == -1) {
             SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
                 << fd << ", " << event << ")";
-            if(timer) {
-                ioManager->cancel(timer);
-            }
             return -1;
-        } else {
-            sylar::Fiber::YeildToHold();
-            if (timer) {
-                ioManager->cancel(timer);
-            }
-            if (timer_info->cancelled) {
-                errno = timer_info->cancelled;
-                return -1;
-            }
-            goto retry;
         }
+        if (res == -ETIMEDOUT) {
+            set_errno(ETIMEDOUT);
+            return -1;
+        }
+        if (ctx->getGeneration() != generation) {
+            // closed while we waited, the number may already belong to a new fd
+            set_errno(EBADF);
+            return -1;
+        }
+        goto retry;
     }
     return rt;
 }
@@ -133,53 +179,65 @@ int connect_with_timeout(int fd, const struct sockaddr *addr,
     if (!ctx->isSocket() || ctx->getUserNonblock()) {
         return connect_f(fd, addr, addrlen);
     }
+    sylar::IOManager* ioManager = sylar::IOManager::GetThis();
+    if (use_uring_here(ioManager)) {
+        // one submission instead of connect, epoll_ctl, epoll_wait and getsockopt
+        io_uring_sqe sqe;
+        prep_sqe(sqe, IORING_OP_CONNECT, fd, addr, 0, addrlen);
+        int res = ioManager->submitIO(fd, sylar::IOManager::WRITE, sqe, timeout_ms);
+        if (res == 0) {
+            return 0;
+        }
+        if (res != -EAGAIN) {
+            set_errno(-res);
+            return -1;
+        }
+        // the ring refused it, connect the readiness way
+    }
     int rt = connect_f(fd, addr, addrlen);
+    ioManager->addSyscallCount();
     if (rt == 0) {
         return 0;
     } else if (errno != EINPROGRESS) {
         return rt;
     }
-    sylar::IOManager* ioManager = sylar::IOManager::GetThis();
-    sylar::Timer::ptr timer;
-    std::shared_ptr<TimerInfo> timer_info = std::make_shared<TimerInfo>();
-    std::weak_ptr<TimerInfo> weak_info(timer_info);
-    if (timeout_ms != ~0ull) {
-        timer = ioManager->addConditionTimer(timeout_ms, [weak_info, fd, ioManager]{
-            std::shared_ptr<TimerInfo> tf = weak_info.lock();
-            if (!tf || tf->cancelled) {
-                return;
-            }
-            tf->cancelled = ETIMEDOUT;
-            ioManager->cancelEvent(fd, sylar::IOManager::WRITE);
-        }, weak_info);
-    }
-    int err = ioManager->addEvent(fd, sylar::IOManager::WRITE);
-    if (err == -1) {
+    int res = ioManager->waitEvent(fd, sylar::IOManager::WRITE, timeout_ms);
+    if (res == -1) {
         SYLAR_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
-        if(timer) {
-            ioManager->cancel(timer);
-        }
-    } else {
-        sylar::Fiber::YeildToHold();
-        if (timer) {
-            ioManager->cancel(timer);
-        }
-        if (timer_info->cancelled) {
-            errno = timer_info->cancelled;
-            return -1;
-        }
+    } else if (res == -ETIMEDOUT) {
+        set_errno(ETIMEDOUT);
+        return -1;
     }
     int error = 0;
     socklen_t len = sizeof(error);
+    ioManager->addSyscallCount();
     if(-1 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len)) {
         return -1;
     }
     if(!error) {
         return 0;
     } else {
-        errno = error;
+        set_errno(error);
+        return -1;
+    }
+}
+
+int accept4_nowait(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    sylar::FdCtx::ptr ctx = sylar::FdManager::GetInstance()->get(sockfd);
+    if (!sylar::is_hook_enable() || !ctx || !ctx->getSysNonblock()) {
+        // a blocking listener could park the thread
+        errno = EAGAIN;
         return -1;
     }
+    int fd = accept4_f(sockfd, addr, addrlen, flags | SOCK_NONBLOCK);
+    sylar::IOManager* ioManager = sylar::IOManager::GetThis();
+    if (ioManager) {
+        ioManager->addSyscallCount();
+    }
+    if (fd >= 0) {
+        sylar::FdManager::GetInstance()->createSocket(fd, flags & SOCK_NONBLOCK);
+    }
+    return fd;
 }
 
 extern "C" {
@@ -236,14 +294,32 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
     return connect_with_timeout(sockfd, addr, addrlen, s_connect_timeout);
 }
 
-int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(sockfd, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
-    if (fd >= 0 && sylar::is_hook_enable()) {
-        sylar::FdManager::GetInstance()->get(fd, true);
+// the kernel makes the new fd nonblocking, no fstat or fcntl to register it
+static int do_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    if (!sylar::is_hook_enable()) {
+        return accept4_f(sockfd, addr, addrlen, flags);
+    }
+    int sys_flags = flags | SOCK_NONBLOCK;
+    int fd = do_io(sockfd, accept4_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO,
+            [=](io_uring_sqe& sqe){
+                prep_sqe(sqe, IORING_OP_ACCEPT, sockfd, addr, 0, (uint64_t)addrlen);
+                sqe.accept_flags = sys_flags;
+                return true;
+            }, addr, addrlen, sys_flags);
+    if (fd >= 0) {
+        sylar::FdManager::GetInstance()->createSocket(fd, flags & SOCK_NONBLOCK);
     }
     return fd;
 }
 
+int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
+    return do_accept(sockfd, addr, addrlen, 0);
+}
+
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    return do_accept(sockfd, addr, addrlen, flags);
+}
+
 int close(int fd) {
     if (!sylar::is_hook_enable()) {
         return close_f(fd);
@@ -260,43 +336,108 @@ int close(int fd) {
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
-    return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
+    return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO,
+            [=](io_uring_sqe& sqe){
+                prep_sqe(sqe, IORING_OP_READ, fd, buf, count, -1);
+                return true;
+            }, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+    return do_io(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO,
+            [=](io_uring_sqe& sqe){
+                prep_sqe(sqe, IORING_OP_READV, fd, iov, iovcnt, -1);
+                return true;
+            }, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-    return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO,
+            [=](io_uring_sqe& sqe){
+                prep_sqe(sqe, IORING_OP_RECV, sockfd, buf, len, 0);
+                sqe.msg_flags = flags;
+                return true;
+            }, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
-    return do_io(sockfd, recvfrom_f, "recvfrom", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    return do_io(sockfd, recvfrom_f, "recvfrom", sylar::IOManager::READ, SO_RCVTIMEO, NoUringOp(), buf, len, flags, src_addr, addrlen);
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-    return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg, flags);
+    return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO,
+            [=](io_uring_sqe& sqe){
+                prep_sqe(sqe, IORING_OP_RECVMSG, sockfd, msg, 1, 0);
+                sqe.msg_flags = flags;
+                return true;
+            }, msg, flags);
+}
+
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
+    return do_io(sockfd, recvmmsg_f, "recvmmsg", sylar::IOManager::READ, SO_RCVTIMEO, NoUringOp(), msgvec, vlen, flags, timeout);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
-    return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+    return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO,
+            [=](io_uring_sqe& sqe){
+                prep_sqe(sqe, IORING_OP_WRITE, fd, buf, count, -1);
+                return true;
+            }, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO,
+            [=](io_uring_sqe& sqe){
+                prep_sqe(sqe, IORING_OP_WRITEV, fd, iov, iovcnt, -1);
+                return true;
+            }, iov, iovcnt);
 }
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags) {
-    return do_io(sockfd, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);
+    return do_io(sockfd, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO,
+            [=](io_uring_sqe& sqe){
+                prep_sqe(sqe, IORING_OP_SEND, sockfd, buf, len, 0);
+                sqe.msg_flags = flags;
+                return true;
+            }, buf, len, flags);
 }
 
 ssize_t sendto(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen) {
-    return do_io(sockfd, sendto_f, "sendto", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags, dest_addr, addrlen);
+    return do_io(sockfd, sendto_f, "sendto", sylar::IOManager::WRITE, SO_SNDTIMEO, NoUringOp(), buf, len, flags, dest_addr, addrlen);
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
-    return do_io(sockfd, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+    return do_io(sockfd, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO,
+            [=](io_uring_sqe& sqe){
+                prep_sqe(sqe, IORING_OP_SENDMSG, sockfd, msg, 1, 0);
+                sqe.msg_flags = flags;
+                return true;
+            }, msg, flags);
+}
+
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    return do_io(sockfd, sendmmsg_f, "sendmmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, NoUringOp(), msgvec, vlen, flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, "sendfile", sylar::IOManager::WRITE, SO_SNDTIMEO,
+            NoUringOp(), in_fd, offset, count);
+}
+
+// one end is a pipe, the fiber waits on the socket end
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    if (!sylar::is_hook_enable()) {
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }
+    sylar::FdCtx::ptr ctx = sylar::FdManager::GetInstance()->get(fd_out);
+    if (ctx && ctx->isSocket()) {
+        return do_io(fd_out, [=](int fd){
+                    return splice_f(fd_in, off_in, fd, off_out, len, flags);
+                }, "splice", sylar::IOManager::WRITE, SO_SNDTIMEO, NoUringOp());
+    }
+    return do_io(fd_in, [=](int fd){
+                return splice_f(fd, off_in, fd_out, off_out, len, flags);
+            }, "splice", sylar::IOManager::READ, SO_RCVTIMEO, NoUringOp());
 }
 
 int fcntl(int fd, int cmd, ... /* arg */ ) {
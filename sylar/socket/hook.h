@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -24,6 +25,7 @@ typedef int (*nanosleep_fun)(const struct timespec *req, struct timespec *rem);
 typedef int (*socket_fun)(int domain, int type, int protocol);
 typedef int (*connect_fun)(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
 typedef int (*accept_fun)(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+typedef int (*accept4_fun)(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
 typedef int (*close_fun)(int fd);
 
 // read
@@ -32,6 +34,7 @@ typedef ssize_t (*readv_fun)(int fd, const struct iovec *iov, int iovcnt);
 typedef ssize_t (*recv_fun)(int sockfd, void *buf, size_t len, int flags);
 typedef ssize_t (*recvfrom_fun)(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen);
 typedef ssize_t (*recvmsg_fun)(int sockfd, struct msghdr *msg, int flags);
+typedef int (*recvmmsg_fun)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
 
 // write
 typedef ssize_t (*write_fun)(int fd, const void *buf, size_t count);
@@ -39,6 +42,11 @@ typedef ssize_t (*writev_fun)(int fd, const struct iovec *iov, int iovcnt);
 typedef ssize_t (*send_fun)(int sockfd, const void *buf, size_t len, int flags);
 typedef ssize_t (*sendto_fun)(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen);
 typedef ssize_t (*sendmsg_fun)(int sockfd, const struct msghdr *msg, int flags);
+typedef int (*sendmmsg_fun)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
+// zero copy
+typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t *offset, size_t count);
+typedef ssize_t (*splice_fun)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
 
 // control
 typedef int (*fcntl_fun)(int fd, int cmd, ... /* arg */ );
@@ -54,17 +62,22 @@ typedef int (*setsockopt_fun)(int sockfd, int level, int optname, const void *op
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
     XX(close) \
     XX(read) \
     XX(readv) \
     XX(recv) \
     XX(recvfrom) \
     XX(recvmsg) \
+    XX(recvmmsg) \
     XX(write) \
     XX(writev) \
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendmmsg) \
+    XX(sendfile) \
+    XX(splice) \
     XX(fcntl) \
     XX(ioctl) \
     XX(getsockopt) \
@@ -75,3 +88,5 @@ typedef int (*setsockopt_fun)(int sockfd, int level, int optname, const void *op
 #undef XX
 
 extern int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms);
+// accept4 that never waits, -1 with EAGAIN when no connection is queued
+extern int accept4_nowait(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
@@ -1,3 +1,4 @@
+#include "config.h"
 #include "fd_manager.h"
 #include "fsUtil.h"
 #include "hook.h"
@@ -5,10 +6,19 @@
 #include "log.h"
 #include "socket.h"
 
+#include <algorithm>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
 
 namespace sylar {
 static Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+static ConfigVar<uint64_t>::ptr g_socket_zerocopy_threshold =
+    Config::Lookup("socket.zerocopy_threshold", (uint64_t)0,
+    "tcp sends of at least this many bytes use MSG_ZEROCOPY, 0 for never");
+static ConfigVar<uint32_t>::ptr g_socket_zerocopy_window =
+    Config::Lookup("socket.zerocopy_window", (uint32_t)32,
+    "MSG_ZEROCOPY sends in flight per socket before a send waits for completions");
 
 Socket::ptr Socket::CreateTCP(Address::ptr address) {
     Socket::ptr sock = std::make_shared<Socket>(address->getFamily(), TCP, 0);
@@ -58,7 +68,9 @@ Socket::ptr Socket::CreateUnixUDPSocket() {
 
 Socket::Socket(int family, int type, int protocol)
     : m_socket(-1), m_family(family), m_type(type)
-    , m_protocol(protocol), m_isConnected(false) {}
+    , m_protocol(protocol), m_isConnected(false)
+    , m_zeroCopyThreshold(g_socket_zerocopy_threshold->getValue())
+    , m_zeroCopyWindow(g_socket_zerocopy_window->getValue()) {}
 
 Socket::~Socket() {
     close();
@@ -112,10 +124,7 @@ bool Socket::setOption(int level, int option, const void* value, socklen_t len)
     return true;
 }
 
-Address::ptr Socket::getRemoteAddress() {
-    if (m_remoteAddress) {
-        return m_remoteAddress;
-    }
+Address::ptr Socket::newAddress() const {
     Address::ptr result;
     switch (m_family) {
         case AF_INET:
@@ -130,6 +139,14 @@ Address::ptr Socket::getRemoteAddress() {
         default:
             result.reset(new UnknownAddress(m_family));
     }
+    return result;
+}
+
+Address::ptr Socket::getRemoteAddress() {
+    if (m_remoteAddress) {
+        return m_remoteAddress;
+    }
+    Address::ptr result = newAddress();
     socklen_t addrlen = result->getAddrLen();
     if (getpeername(m_socket, result->getAddr(), &addrlen)) {
         return std::make_shared<UnknownAddress>(m_family);
@@ -146,20 +163,7 @@ Address::ptr Socket::getLocalAddress() {
     if (m_localAddress) {
         return m_localAddress;
     }
-    Address::ptr result;
-    switch (m_family) {
-        case AF_INET:
-            result.reset(new IPv4Address());
-            break;
-        case AF_INET6:
-            result.reset(new IPv6Address());
-            break;
-        case AF_UNIX:
-            result.reset(new UnixAddress());
-            break;
-        default:
-            result.reset(new UnknownAddress(m_family));
-    }
+    Address::ptr result = newAddress();
     socklen_t addrlen = result->getAddrLen();
     if (getsockname(m_socket, result->getAddr(), &addrlen)) {
         return std::make_shared<UnknownAddress>(m_family);
@@ -202,19 +206,48 @@ int Socket::getError() {
 }
 
 Socket::ptr Socket::accept() {
+    return accept(true);
+}
+
+Socket::ptr Socket::tryAccept() {
+    return accept(false);
+}
+
+Socket::ptr Socket::accept(bool wait) {
     Socket::ptr sock = std::make_shared<Socket>(m_family, m_type, m_protocol);
-    int new_sock = ::accept(m_socket, nullptr, nullptr);
+    // the peer address comes with the accept, no getpeername later
+    Address::ptr remote = newAddress();
+    socklen_t addrlen = remote->getAddrLen();
+    int new_sock = wait ? ::accept4(m_socket, remote->getAddr(), &addrlen, SOCK_CLOEXEC)
+        : accept4_nowait(m_socket, remote->getAddr(), &addrlen, SOCK_CLOEXEC);
     if (new_sock == -1) {
-        SYLAR_LOG_ERROR(g_logger) << "accept(" << m_socket << ") errno="
-            << errno << " errstr=" << strerror(errno);
+        if (wait) {
+            SYLAR_LOG_ERROR(g_logger) << "accept(" << m_socket << ") errno="
+                << errno << " errstr=" << strerror(errno);
+        }
         return nullptr;
     }
+    if (m_family == AF_UNIX) {
+        std::dynamic_pointer_cast<UnixAddress>(remote)->setAddrLen(addrlen);
+    }
+    sock->m_remoteAddress = remote;
     if (sock->init(new_sock)) {
         return sock;
     }
     return nullptr;
 }
 
+bool Socket::enableReusePort() {
+    if (!isValid()) {
+        newSock();
+        if (!isValid()) {
+            return false;
+        }
+    }
+    int val = 1;
+    return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 bool Socket::bind(const Address::ptr address) {
     if (!isValid()) {
         newSock();
@@ -302,6 +335,15 @@ bool Socket::listen(int backlog) {
 }
 
 bool Socket::close() {
+    closePipe();
+    if (!m_zeroCopyOwners.empty()) {
+        // the kernel still reads the buffers, give it the send timeout to finish
+        if (!m_zeroCopyWaiting && isValid() && is_hook_enable() && IOManager::GetThis()) {
+            waitZeroCopy(0);
+        }
+        m_zeroCopyOwners.clear();
+        m_zeroCopyDone = m_zeroCopySeq;
+    }
     if (!m_isConnected && m_socket == -1) {
         return true;
     }
@@ -390,6 +432,184 @@ int Socket::recvFrom(iovec* buffers, size_t length, const Address::ptr from, int
     return -1;
 }
 
+int Socket::recvBatch(mmsghdr* msgs, unsigned int count, int flags) {
+    if (isConnected()) {
+        // wait for the first datagram only, then take what is queued
+        return ::recvmmsg(m_socket, msgs, count, flags | MSG_WAITFORONE, nullptr);
+    }
+    return -1;
+}
+
+int Socket::sendBatch(mmsghdr* msgs, unsigned int count, int flags) {
+    if (isConnected()) {
+        return ::sendmmsg(m_socket, msgs, count, flags);
+    }
+    return -1;
+}
+
+int Socket::sendFile(int fd, off_t offset, size_t length) {
+    if (isConnected()) {
+        return ::sendfile(m_socket, fd, &offset, length);
+    }
+    return -1;
+}
+
+int Socket::spliceFrom(Socket& src, size_t length) {
+    if (!isConnected() || !src.isConnected()) {
+        return -1;
+    }
+    if (m_splicePipe[0] == -1 && pipe2(m_splicePipe, O_NONBLOCK | O_CLOEXEC)) {
+        SYLAR_LOG_ERROR(g_logger) << "pipe2 errno=" << errno << " errstr=" << strerror(errno);
+        m_splicePipe[0] = m_splicePipe[1] = -1;
+        return -1;
+    }
+    if (m_splicePending) {
+        // what an earlier call read from src goes out first
+        return flushPipe();
+    }
+    // the hooks wait on the socket end, the pipe end never blocks
+    int in = ::splice(src.m_socket, nullptr, m_splicePipe[1], nullptr, length,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (in <= 0) {
+        return in;
+    }
+    m_splicePending = in;
+    return flushPipe();
+}
+
+int Socket::flushPipe() {
+    int sent = 0;
+    while (m_splicePending > 0) {
+        int out = ::splice(m_splicePipe[0], nullptr, m_socket, nullptr, m_splicePending,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (out <= 0) {
+            // the rest stays in the pipe for the next call
+            return sent ? sent : -1;
+        }
+        m_splicePending -= out;
+        sent += out;
+    }
+    return sent;
+}
+
+bool Socket::useZeroCopy(size_t length) {
+    if(!m_zeroCopyThreshold || length < m_zeroCopyThreshold || m_type != SOCK_STREAM
+            || m_family == AF_UNIX || !is_hook_enable() || !IOManager::GetThis()) {
+        return false;
+    }
+    if(!m_zeroCopyOn) {
+        int val = 1;
+        if(!setOption(SOL_SOCKET, SO_ZEROCOPY, val)) {
+            // kernel before 4.14
+            m_zeroCopyThreshold = 0;
+            return false;
+        }
+        m_zeroCopyOn = true;
+    }
+    return true;
+}
+
+int Socket::sendZeroCopy(const void* buffer, size_t length, std::shared_ptr<void> owner, int flags) {
+    if(!isConnected()) {
+        return -1;
+    }
+    if(!useZeroCopy(length)) {
+        reapZeroCopy();
+        return ::send(m_socket, buffer, length, flags);
+    }
+    // completions are reaped here, a full window waits for the oldest
+    if(!waitZeroCopy(m_zeroCopyWindow ? m_zeroCopyWindow - 1 : 0)) {
+        return -1;
+    }
+    iovec iov{(void*)buffer, length};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    int rt = ::sendmsg(m_socket, &msg, flags | MSG_ZEROCOPY);
+    if(rt < 0) {
+        return rt;
+    }
+    // each successful call gets the next id, even a partial one
+    ++m_zeroCopySeq;
+    m_zeroCopyOwners.push_back(ZeroCopySend{std::move(owner), false});
+    return rt;
+}
+
+void Socket::reapZeroCopy() {
+    while(!m_zeroCopyOwners.empty()) {
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        // not the hooked recvmsg, that would wait for data
+        if(recvmsg_f(m_socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            return;
+        }
+        for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            sock_extended_err* err = (sock_extended_err*)CMSG_DATA(cm);
+            if(err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // the range [ee_info, ee_data] of ids is complete
+            int64_t first = std::max((int32_t)(err->ee_info - m_zeroCopyDone), 0);
+            int64_t last = std::min((int64_t)(int32_t)(err->ee_data - m_zeroCopyDone),
+                                    (int64_t)m_zeroCopyOwners.size() - 1);
+            for(int64_t i = first; i <= last; ++i) {
+                m_zeroCopyOwners[i].done = true;
+            }
+            if(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // the kernel copied anyway, e.g. loopback, pinning only costs here
+                m_zeroCopyThreshold = 0;
+            }
+        }
+        // owners go in send order
+        while(!m_zeroCopyOwners.empty() && m_zeroCopyOwners.front().done) {
+            m_zeroCopyOwners.pop_front();
+            ++m_zeroCopyDone;
+        }
+    }
+}
+
+bool Socket::waitZeroCopy(size_t inflight) {
+    reapZeroCopy();
+    IOManager* iom = IOManager::GetThis();
+    uint64_t timeout = getSendTimeout();
+    while(m_zeroCopyOwners.size() > inflight) {
+        m_zeroCopyWaiting = true;
+        int res = iom->waitEvent(m_socket, IOManager::ERROR, timeout);
+        m_zeroCopyWaiting = false;
+        // a close wakes us up
+        if(!isValid()) {
+            errno = EBADF;
+            return false;
+        }
+        if(res == -ETIMEDOUT) {
+            errno = ETIMEDOUT;
+            return false;
+        }
+        if(res == -1) {
+            return false;
+        }
+        reapZeroCopy();
+    }
+    return true;
+}
+
+void Socket::closePipe() {
+    m_splicePending = 0;
+    if (m_splicePipe[0] != -1) {
+        ::close(m_splicePipe[0]);
+        ::close(m_splicePipe[1]);
+        m_splicePipe[0] = m_splicePipe[1] = -1;
+    }
+}
+
 std::ostream& Socket::dump(std::ostream& os) const {
     os << "[Socket sock=" << m_socket
        << " is_connected=" << m_isConnected
@@ -435,8 +655,7 @@ bool Socket::init(int sock) {
     if(ctx && ctx->isSocket() && !ctx->isClose()) {
         m_socket = sock;
         m_isConnected = true;
-        initSocket();
-        getLocalAddress();
+        // TCP_NODELAY is inherited from the listener, the local address is read on demand
         getRemoteAddress();
         return true;
     }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
 #include <iostream>
 #include <memory>
 // #include <openssl/err.h>
@@ -54,6 +55,8 @@ public:
     bool isConnected() const { return m_isConnected; }
     int getSocket() const { return m_socket; }
     bool isValid() const;
+    // creates the socket if needed, call before bind to share the port with other sockets
+    bool enableReusePort();
     bool cancelRead();
     bool cancelWrite();
     bool cancelAccept();
@@ -72,6 +75,8 @@ public:
     }
 
     virtual Socket::ptr accept();
+    // nullptr with errno EAGAIN when no connection is queued, never waits
+    Socket::ptr tryAccept();
     virtual bool bind(const Address::ptr address);
     virtual bool connect(const Address::ptr address, uint64_t timeout_ms = -1);
     virtual bool reconnect(uint64_t timeout_ms = -1);
@@ -85,12 +90,63 @@ public:
     virtual int recv(iovec* buffers, size_t length, int flags = 0);
     virtual int recvFrom(void* buffer, size_t length, const Address::ptr from, int flags = 0);
     virtual int recvFrom(iovec* buffers, size_t length, const Address::ptr from, int flags = 0);
+    // several datagrams per syscall, returns how many like recvmmsg and sendmmsg
+    virtual int recvBatch(mmsghdr* msgs, unsigned int count, int flags = 0);
+    virtual int sendBatch(mmsghdr* msgs, unsigned int count, int flags = 0);
+    // one sendfile from fd at offset, may send less than length
+    virtual int sendFile(int fd, off_t offset, size_t length);
+    /**
+     * Reads once from src into a pipe and writes all of it to this socket
+     * without a copy through user space. At most one pipe buffer (64KiB by
+     * default) per call, 0 when src is at eof. Returns the bytes written to
+     * this socket. Bytes read from src that could not be written, e.g. on a
+     * send timeout, stay in the pipe and the next call writes them before it
+     * reads more, so a caller may retry. close() drops them.
+     */
+    virtual int spliceFrom(Socket& src, size_t length);
+    // bytes read from src by spliceFrom and not written yet
+    size_t getSplicePending() const { return m_splicePending; }
+    /**
+     * Sends with MSG_ZEROCOPY and returns once the data is queued, may send
+     * less than length. The kernel reads the buffer until the peer acked it,
+     * so the socket holds owner until then and the buffer must not change
+     * while it lives, a custom deleter works as a release callback.
+     * Completions are reaped by later sends and close(). A send waits only
+     * while the window of sends in flight is full, close() waits for all of
+     * them. Below the threshold it is a plain send and owner is not kept.
+     */
+    int sendZeroCopy(const void* buffer, size_t length, std::shared_ptr<void> owner, int flags = 0);
+    // sendZeroCopy of at least v bytes uses MSG_ZEROCOPY, 0 turns it off, defaults to socket.zerocopy_threshold
+    void setZeroCopyThreshold(uint64_t v) { m_zeroCopyThreshold = v; }
+    uint64_t getZeroCopyThreshold() const { return m_zeroCopyThreshold; }
+    // MSG_ZEROCOPY sends in flight before a send waits, defaults to socket.zerocopy_window
+    void setZeroCopyWindow(uint32_t v) { m_zeroCopyWindow = v; }
+    uint32_t getZeroCopyWindow() const { return m_zeroCopyWindow; }
+    // sends that went through MSG_ZEROCOPY
+    uint32_t getZeroCopySends() const { return m_zeroCopySeq; }
+    // MSG_ZEROCOPY sends whose owner is still held
+    size_t getZeroCopyInFlight() const { return m_zeroCopyOwners.size(); }
     virtual std::ostream& dump(std::ostream& os) const;
     virtual std::string toString() const;
 
 protected:
+    struct ZeroCopySend {
+        std::shared_ptr<void> owner;
+        bool done;                      // completed behind an older send
+    };
+
     void initSocket();
     void newSock();
+    void closePipe();
+    // writes the bytes left in the splice pipe, -1 if none went out
+    int flushPipe();
+    bool useZeroCopy(size_t length);
+    // drains the error queue and drops the owners of the completed sends
+    void reapZeroCopy();
+    // waits until at most inflight sends are pending, false on timeout or close
+    bool waitZeroCopy(size_t inflight);
+    Address::ptr newAddress() const;
+    Socket::ptr accept(bool wait);
 
     virtual bool init(int sock);
 
@@ -102,6 +158,16 @@ protected:
     bool m_isConnected;
     Address::ptr m_localAddress;
     Address::ptr m_remoteAddress;
+    int m_splicePipe[2] = {-1, -1};
+    size_t m_splicePending = 0;         // bytes in the splice pipe
+    uint64_t m_zeroCopyThreshold;
+    bool m_zeroCopyOn = false;          // SO_ZEROCOPY is set
+    uint32_t m_zeroCopyWindow;
+    uint32_t m_zeroCopySeq = 0;         // id of the next zerocopy send
+    uint32_t m_zeroCopyDone = 0;        // id of the oldest send in flight
+    bool m_zeroCopyWaiting = false;     // a fiber waits for completions
+    // sends in flight by id from m_zeroCopyDone on
+    std::deque<ZeroCopySend> m_zeroCopyOwners;
 };
 
 // class SSLSocket : public Socket {
@@ -85,6 +85,55 @@ int SocketStream::write(ByteArray::ptr ba, size_t length) {
     return rt;
 }
 
+int64_t SocketStream::sendFile(int fd, off_t offset, size_t length) {
+    if (!isConnected()) {
+        return -1;
+    }
+    size_t left = length;
+    while (left > 0) {
+        int rt = m_socket->sendFile(fd, offset, left);
+        if (rt <= 0) {
+            return rt;
+        }
+        offset += rt;
+        left -= rt;
+    }
+    return length;
+}
+
+int64_t SocketStream::sendZeroCopy(const void* buffer, size_t length, std::shared_ptr<void> owner) {
+    if (!isConnected()) {
+        return -1;
+    }
+    size_t left = length;
+    while (left > 0) {
+        int rt = m_socket->sendZeroCopy((const char*)buffer + length - left, left, owner);
+        if (rt <= 0) {
+            return rt;
+        }
+        left -= rt;
+    }
+    return length;
+}
+
+int64_t SocketStream::spliceFrom(SocketStream& src, size_t length) {
+    if (!isConnected() || !src.isConnected()) {
+        return -1;
+    }
+    size_t left = length;
+    while (left > 0) {
+        int rt = m_socket->spliceFrom(*src.getSocket(), left);
+        if (rt < 0) {
+            return rt;
+        }
+        if (rt == 0) {
+            break;
+        }
+        left -= rt;
+    }
+    return length - left;
+}
+
 void SocketStream::close() {
     if(m_socket) {
         m_socket->close();
@@ -22,6 +22,12 @@ public:
     virtual int write(const void* buffer, size_t length) override;
     virtual int write(ByteArray::ptr ba, size_t length) override;
     virtual void close() override;
+    // sends length bytes of fd from offset, the file offset does not move
+    int64_t sendFile(int fd, off_t offset, size_t length);
+    // sends all of buffer with Socket::sendZeroCopy, owner is held until the kernel is done with it
+    int64_t sendZeroCopy(const void* buffer, size_t length, std::shared_ptr<void> owner);
+    // moves length bytes from src or until it reaches eof, returns bytes moved
+    int64_t spliceFrom(SocketStream& src, size_t length);
 
 protected:
     Socket::ptr m_socket;
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <stddef.h>
+#include <utility>
+
+#include "noncopyable.h"
+
+namespace sylar {
+/**
+ * Lock free multi-producer single-consumer queue. Producers link nodes onto an
+ * atomic head with one CAS, the consumer takes the whole list with one exchange
+ * and reverses it back to FIFO order, so there is no ABA problem. The consumer
+ * hands drained nodes back to the queue's free list, a producer that runs out
+ * takes the whole list into its per-thread cache with one exchange. So nodes
+ * flow back to the threads that push and a steady flow does not allocate.
+ */
+template<typename T>
+class MpscQueue : Noncopyable {
+public:
+    struct Node {
+        T value;
+        Node* next;
+
+        Node(T&& v) : value(std::move(v)), next(nullptr) {}
+    };
+
+    /**
+     * Nodes linked by one producer and spliced into the queue at once.
+     */
+    class Batch : Noncopyable {
+    public:
+        friend class MpscQueue;
+
+        ~Batch() {
+            while (m_head) {
+                Node* next = m_head->next;
+                FreeNode(m_head);
+                m_head = next;
+            }
+        }
+
+        void push(T&& v) {
+            Node* node = NewNode(std::move(v));
+            node->next = m_head;
+            m_head = node;
+            if (!m_tail) {
+                m_tail = node;
+            }
+            ++m_size;
+        }
+
+        bool empty() const { return m_head == nullptr; }
+        size_t size() const { return m_size; }
+
+    private:
+        Node* m_head = nullptr;     // newest
+        Node* m_tail = nullptr;     // oldest
+        size_t m_size = 0;
+    };
+
+    MpscQueue() : m_head(nullptr), m_free(nullptr) {}
+
+    ~MpscQueue() {
+        drain([](T&&){});
+        void* mem = m_free.exchange(nullptr, std::memory_order_acquire);
+        while (mem) {
+            void* next = *(void**)mem;
+            ::operator delete(mem);
+            mem = next;
+        }
+    }
+
+    // return true if the queue was empty
+    bool push(T&& v) {
+        if (!GetNodeCache().head) {
+            adopt();
+        }
+        Node* node = NewNode(std::move(v));
+        return link(node, node);
+    }
+
+    bool push(Batch& batch) {
+        if (batch.empty()) {
+            return false;
+        }
+        bool was_empty = link(batch.m_head, batch.m_tail);
+        batch.m_head = batch.m_tail = nullptr;
+        batch.m_size = 0;
+        // the next batch of this thread reuses what the consumer gave back
+        if (!GetNodeCache().head) {
+            adopt();
+        }
+        return was_empty;
+    }
+
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) == nullptr;
+    }
+
+    // consumer only, call f with every value in push order
+    template<typename Func>
+    size_t drain(Func f) {
+        Node* node = m_head.exchange(nullptr, std::memory_order_acquire);
+        Node* fifo = nullptr;
+        while (node) {
+            Node* next = node->next;
+            node->next = fifo;
+            fifo = node;
+            node = next;
+        }
+        size_t count = 0;
+        void* free_head = nullptr;
+        void* free_tail = nullptr;
+        while (fifo) {
+            Node* next = fifo->next;
+            f(std::move(fifo->value));
+            fifo->~Node();
+            *(void**)fifo = free_head;
+            free_head = fifo;
+            if (!free_tail) {
+                free_tail = fifo;
+            }
+            fifo = next;
+            ++count;
+        }
+        recycle(free_head, free_tail, count);
+        return count;
+    }
+
+private:
+    struct NodeCache {
+        enum {
+            MAX_SIZE = 1024,
+        };
+
+        ~NodeCache() {
+            while (head) {
+                void* next = *(void**)head;
+                ::operator delete(head);
+                head = next;
+            }
+            destroyed = true;
+        }
+
+        void* head = nullptr;
+        size_t size = 0;
+        bool destroyed = false;
+    };
+
+    static NodeCache& GetNodeCache() {
+        static thread_local NodeCache s_cache;
+        return s_cache;
+    }
+
+    static Node* NewNode(T&& v) {
+        NodeCache& cache = GetNodeCache();
+        void* mem = cache.head;
+        if (mem) {
+            cache.head = *(void**)mem;
+            --cache.size;
+        } else {
+            mem = ::operator new(sizeof(Node));
+        }
+        return new (mem) Node(std::move(v));
+    }
+
+    static void FreeNode(Node* node) {
+        node->~Node();
+        NodeCache& cache = GetNodeCache();
+        // other thread_local destructors may still free nodes at thread exit
+        if (cache.destroyed || cache.size >= NodeCache::MAX_SIZE) {
+            ::operator delete(node);
+            return;
+        }
+        *(void**)node = cache.head;
+        cache.head = node;
+        ++cache.size;
+    }
+
+    // consumer only, give drained nodes back for the producers
+    void recycle(void* head, void* tail, size_t count) {
+        if (!head) {
+            return;
+        }
+        if (m_freeSize.load(std::memory_order_relaxed) >= NodeCache::MAX_SIZE) {
+            while (head) {
+                void* next = *(void**)head;
+                ::operator delete(head);
+                head = next;
+            }
+            return;
+        }
+        m_freeSize.fetch_add(count, std::memory_order_relaxed);
+        void* old_head = m_free.load(std::memory_order_relaxed);
+        do {
+            *(void**)tail = old_head;
+        } while (!m_free.compare_exchange_weak(old_head, head,
+                    std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // producer, move the whole free list into this thread's cache
+    void adopt() {
+        NodeCache& cache = GetNodeCache();
+        if (cache.destroyed || !m_free.load(std::memory_order_relaxed)) {
+            return;
+        }
+        void* mem = m_free.exchange(nullptr, std::memory_order_acquire);
+        size_t count = 0;
+        while (mem) {
+            void* next = *(void**)mem;
+            *(void**)mem = cache.head;
+            cache.head = mem;
+            ++cache.size;
+            ++count;
+            mem = next;
+        }
+        m_freeSize.fetch_sub(count, std::memory_order_relaxed);
+    }
+
+    bool link(Node* head, Node* tail) {
+        Node* old_head = m_head.load(std::memory_order_relaxed);
+        do {
+            tail->next = old_head;
+        } while (!m_head.compare_exchange_weak(old_head, head,
+                    std::memory_order_release, std::memory_order_relaxed));
+        return old_head == nullptr;
+    }
+
+private:
+    std::atomic<Node*> m_head;
+    std::atomic<void*> m_free;              // drained nodes, pushed by the consumer
+    std::atomic<size_t> m_freeSize {0};
+};
+}
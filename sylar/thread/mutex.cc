@@ -73,6 +73,10 @@ void Spinlock::lock() {
     pthread_spin_lock(&m_lock);
 }
 
+bool Spinlock::tryLock() {
+    return pthread_spin_trylock(&m_lock) == 0;
+}
+
 void Spinlock::unlock() {
     pthread_spin_unlock(&m_lock);
 }
@@ -147,6 +147,7 @@ public:
     Spinlock();
     ~Spinlock();
     void lock();
+    bool tryLock();
     void unlock();
 
 private:
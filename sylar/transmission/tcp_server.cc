@@ -2,18 +2,32 @@
 #include "config.h"
 #include "log.h"
 #include "tcp_server.h"
+#include "util.h"
+
+#include <unistd.h>
 
 namespace sylar {
 static sylar::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
     sylar::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
     "tcp server read timeout");
+static sylar::ConfigVar<bool>::ptr g_tcp_server_reuse_port =
+    sylar::Config::Lookup("tcp_server.reuse_port", false,
+    "one SO_REUSEPORT listener per io worker thread");
+static sylar::ConfigVar<uint32_t>::ptr g_tcp_server_max_connections =
+    sylar::Config::Lookup("tcp_server.max_connections", (uint32_t)0,
+    "connections served at once before accepting pauses, 0 for no limit");
+static sylar::ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch =
+    sylar::Config::Lookup("tcp_server.accept_batch", (uint32_t)64,
+    "connections taken from the backlog per wakeup");
 
 static Logger::ptr g_logger = SYLAR_LOG_NAME("root");
 
 TcpServer::TcpServer(sylar::IOManager* worker, sylar::IOManager* io_worker,
     sylar::IOManager* accept_worker) : m_worker(worker), m_IOworker(io_worker),
     m_acceptWorker(accept_worker), m_recvTimeout(g_tcp_server_read_timeout->getValue()),
-    m_name("sylar/1.0.0"), m_isStop(true) {}
+    m_name("sylar/1.0.0"), m_isStop(true), m_reusePort(g_tcp_server_reuse_port->getValue()),
+    m_maxConnections(g_tcp_server_max_connections->getValue()),
+    m_acceptBatch(g_tcp_server_accept_batch->getValue()) {}
 
 TcpServer::~TcpServer() {
     for(auto& i : m_sockets) {
@@ -38,6 +52,12 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs
                         ,bool ssl) {
     m_ssl = ssl;
     for(auto& addr : addrs) {
+        if(m_reusePort) {
+            if(!bindReusePort(addr)) {
+                fails.push_back(addr);
+            }
+            continue;
+        }
         // Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
         Socket::ptr sock = Socket::CreateTCP(addr);
         if(!sock->bind(addr)) {
@@ -55,10 +75,12 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs
             continue;
         }
         m_sockets.push_back(sock);
+        m_acceptThreads.push_back(-1);
     }
 
     if(!fails.empty()) {
         m_sockets.clear();
+        m_acceptThreads.clear();
         return false;
     }
 
@@ -71,17 +93,121 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs
     return true;
 }
 
+bool TcpServer::bindReusePort(Address::ptr addr) {
+    Address::ptr bound = addr;
+    for(pid_t thread : m_IOworker->getWorkerThreads()) {
+        Socket::ptr sock = Socket::CreateTCP(bound);
+        if(!sock->enableReusePort() || !sock->bind(bound) || !sock->listen()) {
+            SYLAR_LOG_ERROR(g_logger) << "reuse port listen fail errno="
+                << errno << " errstr=" << strerror(errno)
+                << " addr=[" << bound->toString() << "]";
+            return false;
+        }
+        // port 0 picks a port for the first listener, the others share it
+        bound = sock->getLocalAddress();
+        m_sockets.push_back(sock);
+        m_acceptThreads.push_back(thread);
+    }
+    return true;
+}
+
 void TcpServer::startAccept(Socket::ptr sock) {
     while(!m_isStop) {
+        if(!admit()) {
+            break;
+        }
         Socket::ptr client = sock->accept();
-        if(client) {
-            client->setRecvTimeout(m_recvTimeout);
-            m_IOworker->schedule(std::bind(&TcpServer::handleClient,
-                        shared_from_this(), client));
-        } else {
-            SYLAR_LOG_ERROR(g_logger) << "accept errno=" << errno
-                << " errstr=" << strerror(errno);
+        if(!client) {
+            onAcceptError();
+            release();
+            continue;
+        }
+        dispatch(client);
+        // drain the backlog before waiting on the listener again
+        for(uint32_t i = 1; i < m_acceptBatch && !m_isStop; ++i) {
+            if(!reserve()) {
+                break;
+            }
+            client = sock->tryAccept();
+            if(!client) {
+                if(errno != EAGAIN) {
+                    onAcceptError();
+                }
+                release();
+                break;
+            }
+            dispatch(client);
+        }
+    }
+}
+
+bool TcpServer::reserve() {
+    // the accept loops of reuse port mode race for the last slot
+    uint32_t count = m_connections;
+    do {
+        if(m_maxConnections && count >= m_maxConnections) {
+            return false;
+        }
+    } while(!m_connections.compare_exchange_weak(count, count + 1));
+    return true;
+}
+
+void TcpServer::release() {
+    // wake the accept loops when this frees the slot they wait for
+    if(m_connections-- >= m_maxConnections && m_maxConnections) {
+        FiberMutex::Lock lock(m_admitMutex);
+        m_admitCond.notifyAll();
+    }
+}
+
+bool TcpServer::admit() {
+    if(m_isStop) {
+        return false;
+    }
+    if(reserve()) {
+        return true;
+    }
+    FiberMutex::Lock lock(m_admitMutex);
+    while(!m_isStop) {
+        if(reserve()) {
+            return true;
         }
+        m_admitCond.wait(lock);
+    }
+    return false;
+}
+
+void TcpServer::dispatch(Socket::ptr client) {
+    ++m_acceptCount;
+    client->setRecvTimeout(m_recvTimeout);
+    pid_t thread = -1;
+    if(m_reusePort) {
+        // this thread owns the listener, serve the connection here too
+        thread = GetThreadID();
+    } else {
+        // with sharded reactors the connection lives on one thread
+        thread = m_IOworker->pinFd(client->getSocket());
+    }
+    m_IOworker->schedule(std::bind(&TcpServer::serveClient,
+                shared_from_this(), client), thread);
+}
+
+void TcpServer::serveClient(Socket::ptr client) {
+    handleClient(client);
+    release();
+}
+
+void TcpServer::onAcceptError() {
+    if(m_isStop) {
+        return;
+    }
+    int error = errno;
+    ++m_rejectCount;
+    SYLAR_LOG_ERROR(g_logger) << "accept errno=" << error
+        << " errstr=" << strerror(error);
+    if(error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+        // the listener stays readable, back off instead of spinning
+        usleep(10 * 1000);
     }
 }
 
@@ -90,9 +216,14 @@ bool TcpServer::start() {
         return true;
     }
     m_isStop = false;
-    for(auto& sock : m_sockets) {
-        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
-                    shared_from_this(), sock));
+    for(size_t i = 0; i < m_sockets.size(); ++i) {
+        if(m_acceptThreads[i] != -1) {
+            m_IOworker->schedule(std::bind(&TcpServer::startAccept,
+                        shared_from_this(), m_sockets[i]), m_acceptThreads[i]);
+        } else {
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
+                        shared_from_this(), m_sockets[i]));
+        }
     }
     return true;
 }
@@ -101,11 +232,17 @@ void TcpServer::stop() {
     m_isStop = true;
     auto self = shared_from_this();
     m_acceptWorker->schedule([this, self]() {
+        {
+            // accept loops waiting for a free slot look at m_isStop again
+            FiberMutex::Lock lock(m_admitMutex);
+            m_admitCond.notifyAll();
+        }
         for(auto& sock : m_sockets) {
             sock->cancelAll();
             sock->close();
         }
         m_sockets.clear();
+        m_acceptThreads.clear();
     });
 }
 
@@ -131,7 +268,12 @@ std::string TcpServer::toString(const std::string& prefix) {
        << " name=" << m_name << " ssl=" << m_ssl
        << " worker=" << (m_worker ? m_worker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
-       << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
+       << " recv_timeout=" << m_recvTimeout
+       << " reuse_port=" << m_reusePort
+       << " max_connections=" << m_maxConnections
+       << " connections=" << m_connections
+       << " accepted=" << m_acceptCount
+       << " rejected=" << m_rejectCount << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
     for(auto& i : m_sockets) {
         ss << pfx << pfx << *i << std::endl;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "config_cast.h"
+#include "fiber_sync.h"
 #include "iomanager.h"
 #include "noncopyable.h"
 #include "socket.h"
@@ -87,6 +88,24 @@ public:
     uint64_t getRecvTimeout() const { return m_recvTimeout;}
     std::string getName() const { return m_name;}
     void setRecvTimeout(uint64_t v) { m_recvTimeout = v;}
+    /**
+     * Every io worker thread gets its own SO_REUSEPORT listener and serves
+     * the connections it accepts, the kernel spreads them over the threads.
+     * Call before bind.
+     */
+    void setReusePort(bool v) { m_reusePort = v;}
+    bool isReusePort() const { return m_reusePort;}
+    /**
+     * At most v connections in handleClient at once, 0 for no limit. At the
+     * limit accepting pauses and new connections wait in the listen backlog.
+     */
+    void setMaxConnections(uint32_t v) { m_maxConnections = v;}
+    uint32_t getMaxConnections() const { return m_maxConnections;}
+    uint32_t getConnectionCount() const { return m_connections;}
+    // connections accepted since construction, sample it for the accept rate
+    uint64_t getAcceptCount() const { return m_acceptCount;}
+    // accepts that failed, e.g. EMFILE, the peer is left to the kernel
+    uint64_t getRejectCount() const { return m_rejectCount;}
     virtual void setName(const std::string& v) { m_name = v;}
     bool isStop() const { return m_isStop;}
     TcpServerConf::ptr getConf() const { return m_conf;}
@@ -98,9 +117,21 @@ public:
 protected:
     virtual void handleClient(Socket::ptr client);
     virtual void startAccept(Socket::ptr sock);
+    bool bindReusePort(Address::ptr addr);
+    // take a connection slot, false if the limit is reached
+    bool reserve();
+    // give a slot back and wake the accept loops waiting for one
+    void release();
+    // reserve, waiting for a free slot. false if the server stopped meanwhile
+    bool admit();
+    // serve client on the slot reserved for it
+    void dispatch(Socket::ptr client);
+    void serveClient(Socket::ptr client);
+    void onAcceptError();
 
 protected:
     std::vector<Socket::ptr> m_sockets;
+    std::vector<pid_t> m_acceptThreads;     // io worker thread of each socket, -1 unless reuse port
     IOManager* m_worker;
     IOManager* m_IOworker;
     IOManager* m_acceptWorker;
@@ -109,6 +140,14 @@ protected:
     std::string m_type = "tcp";
     bool m_isStop;
     bool m_ssl = false;
+    bool m_reusePort;
+    uint32_t m_maxConnections;
+    uint32_t m_acceptBatch;
+    std::atomic<uint32_t> m_connections {0};
+    std::atomic<uint64_t> m_acceptCount {0};
+    std::atomic<uint64_t> m_rejectCount {0};
+    FiberMutex m_admitMutex;
+    FiberCondVar m_admitCond;
     TcpServerConf::ptr m_conf;
 };
 }
\ No newline at end of file
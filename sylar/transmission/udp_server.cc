@@ -0,0 +1,350 @@
+#include "config.h"
+#include "log.h"
+#include "udp_server.h"
+
+#include <netinet/udp.h>
+#include <string.h>
+
+namespace sylar {
+static sylar::ConfigVar<uint32_t>::ptr g_udp_server_batch =
+    sylar::Config::Lookup("udp_server.batch", (uint32_t)32,
+    "datagrams per recvmmsg and sendmmsg");
+static sylar::ConfigVar<uint32_t>::ptr g_udp_server_buffer_size =
+    sylar::Config::Lookup("udp_server.buffer_size", (uint32_t)2048,
+    "bytes per pooled datagram buffer, gro raises it to 64KiB");
+static sylar::ConfigVar<bool>::ptr g_udp_server_gso =
+    sylar::Config::Lookup("udp_server.gso", false,
+    "send equal sized replies to one peer as one UDP_SEGMENT message");
+static sylar::ConfigVar<bool>::ptr g_udp_server_gro =
+    sylar::Config::Lookup("udp_server.gro", false,
+    "let the kernel merge received datagrams of one sender, UDP_GRO");
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+// limits of one UDP_SEGMENT message
+static const size_t s_gso_max_segments = 64;
+static const size_t s_gso_max_bytes = 65000;
+static const size_t s_control_size = CMSG_SPACE(sizeof(int));
+
+DatagramPool::DatagramPool(size_t buffer_size, size_t max_cached)
+    : m_bufferSize(buffer_size), m_maxCached(max_cached) {}
+
+DatagramPool::~DatagramPool() {
+    for(auto& i : m_free) {
+        delete i;
+    }
+}
+
+Datagram::ptr DatagramPool::get() {
+    Datagram* dgram = nullptr;
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(!m_free.empty()) {
+            dgram = m_free.back();
+            m_free.pop_back();
+        }
+    }
+    if(!dgram) {
+        dgram = new Datagram(m_bufferSize);
+    }
+    // the deleter keeps the pool alive while datagrams are out
+    DatagramPool::ptr self = shared_from_this();
+    return Datagram::ptr(dgram, [self](Datagram* d){
+        self->put(d);
+    });
+}
+
+void DatagramPool::put(Datagram* dgram) {
+    dgram->length = 0;
+    dgram->segment = 0;
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(m_free.size() < m_maxCached) {
+            m_free.push_back(dgram);
+            return;
+        }
+    }
+    delete dgram;
+}
+
+UdpServer::UdpServer(sylar::IOManager* worker, sylar::IOManager* io_worker)
+    : m_worker(worker), m_IOworker(io_worker), m_name("sylar/1.0.0"), m_isStop(true),
+    m_batch(std::max(g_udp_server_batch->getValue(), (uint32_t)1)),
+    m_gso(g_udp_server_gso->getValue()), m_gro(g_udp_server_gro->getValue()) {
+    size_t buffer_size = g_udp_server_buffer_size->getValue();
+    if(m_gro) {
+        buffer_size = 65535;
+    }
+    m_pool.reset(new DatagramPool(buffer_size, m_batch * 16));
+}
+
+UdpServer::~UdpServer() {
+    for(auto& i : m_listeners) {
+        i->sock->close();
+    }
+    m_listeners.clear();
+}
+
+bool UdpServer::bind(Address::ptr addr) {
+    std::vector<Address::ptr> addrs;
+    std::vector<Address::ptr> fails;
+    addrs.push_back(addr);
+    return bind(addrs, fails);
+}
+
+bool UdpServer::bind(const std::vector<Address::ptr>& addrs
+                        ,std::vector<Address::ptr>& fails) {
+    for(auto& addr : addrs) {
+        Socket::ptr sock = Socket::CreateUDP(addr);
+        if(!sock->bind(addr)) {
+            SYLAR_LOG_ERROR(g_logger) << "bind fail errno="
+                << errno << " errstr=" << strerror(errno)
+                << " addr=[" << addr->toString() << "]";
+            fails.push_back(addr);
+            continue;
+        }
+        int zero = 0;
+        if(m_gso && !sock->setOption(SOL_UDP, UDP_SEGMENT, zero)) {
+            SYLAR_LOG_WARN(g_logger) << "udp gso unsupported, replies go one by one";
+            m_gso = false;
+        }
+        int one = 1;
+        if(m_gro && !sock->setOption(SOL_UDP, UDP_GRO, one)) {
+            SYLAR_LOG_WARN(g_logger) << "udp gro unsupported";
+            m_gro = false;
+        }
+        Listener::ptr listener(new Listener);
+        listener->sock = sock;
+        listener->thread = m_IOworker->pinFd(sock->getSocket());
+        m_listeners.push_back(listener);
+    }
+
+    if(!fails.empty()) {
+        m_listeners.clear();
+        return false;
+    }
+
+    for(auto& i : m_listeners) {
+        SYLAR_LOG_INFO(g_logger) << "type=udp name=" << m_name
+            << " server bind success: " << *i->sock;
+    }
+    return true;
+}
+
+bool UdpServer::start() {
+    if(!m_isStop) {
+        return true;
+    }
+    m_isStop = false;
+    for(size_t i = 0; i < m_listeners.size(); ++i) {
+        m_IOworker->schedule(std::bind(&UdpServer::startRecv,
+                    shared_from_this(), m_listeners[i], i), m_listeners[i]->thread);
+    }
+    return true;
+}
+
+void UdpServer::stop() {
+    m_isStop = true;
+    auto self = shared_from_this();
+    m_IOworker->schedule([this, self]() {
+        for(auto& i : m_listeners) {
+            i->sock->cancelAll();
+            i->sock->close();
+        }
+    });
+}
+
+void UdpServer::startRecv(Listener::ptr listener, size_t index) {
+    std::vector<Datagram::ptr> dgrams(m_batch);
+    std::vector<mmsghdr> msgs(m_batch);
+    std::vector<iovec> iovs(m_batch);
+    std::vector<char> controls(m_gro ? m_batch * s_control_size : 0);
+    while(!m_isStop) {
+        for(size_t i = 0; i < m_batch; ++i) {
+            // slots handed to a handler last round get a fresh buffer
+            if(!dgrams[i]) {
+                dgrams[i] = m_pool->get();
+            }
+            Datagram& dgram = *dgrams[i];
+            iovs[i].iov_base = dgram.data;
+            iovs[i].iov_len = dgram.capacity;
+            msghdr& hdr = msgs[i].msg_hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_name = &dgram.peer;
+            hdr.msg_namelen = sizeof(dgram.peer);
+            hdr.msg_iov = &iovs[i];
+            hdr.msg_iovlen = 1;
+            if(m_gro) {
+                hdr.msg_control = &controls[i * s_control_size];
+                hdr.msg_controllen = s_control_size;
+            }
+        }
+        int rt = listener->sock->recvBatch(&msgs[0], m_batch);
+        ++m_recvCalls;
+        if(rt <= 0) {
+            if(m_isStop || !listener->sock->isValid()) {
+                break;
+            }
+            SYLAR_LOG_ERROR(g_logger) << "recvmmsg errno=" << errno
+                << " errstr=" << strerror(errno);
+            continue;
+        }
+        for(int i = 0; i < rt; ++i) {
+            msghdr& hdr = msgs[i].msg_hdr;
+            if(hdr.msg_flags & MSG_TRUNC) {
+                ++m_dropCount;
+                continue;
+            }
+            Datagram::ptr dgram = std::move(dgrams[i]);
+            dgram->length = msgs[i].msg_len;
+            dgram->peerLen = hdr.msg_namelen;
+            dgram->listener = index;
+            for(cmsghdr* cm = CMSG_FIRSTHDR(&hdr); cm; cm = CMSG_NXTHDR(&hdr, cm)) {
+                if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                    dgram->segment = *(int*)CMSG_DATA(cm);
+                }
+            }
+            ++m_recvCount;
+            m_worker->schedule(std::bind(&UdpServer::handleDatagram,
+                        shared_from_this(), dgram));
+        }
+    }
+}
+
+bool UdpServer::reply(const Datagram& dgram, const void* data, size_t length) {
+    if(length > m_pool->getBufferSize() || dgram.listener >= m_listeners.size()) {
+        return false;
+    }
+    Datagram::ptr rsp = m_pool->get();
+    memcpy(rsp->data, data, length);
+    rsp->length = length;
+    memcpy(&rsp->peer, &dgram.peer, dgram.peerLen);
+    rsp->peerLen = dgram.peerLen;
+    Listener::ptr listener = m_listeners[dgram.listener];
+    {
+        Spinlock::Lock lock(listener->mutex);
+        listener->replies.push_back(std::move(rsp));
+        if(listener->flushing) {
+            return true;
+        }
+        listener->flushing = true;
+    }
+    // replies queued until the flush runs share its sendmmsg calls
+    m_IOworker->schedule(std::bind(&UdpServer::flush,
+                shared_from_this(), listener), listener->thread);
+    return true;
+}
+
+void UdpServer::flush(Listener::ptr listener) {
+    std::vector<Datagram::ptr> replies;
+    while(true) {
+        {
+            Spinlock::Lock lock(listener->mutex);
+            if(listener->replies.empty()) {
+                listener->flushing = false;
+                return;
+            }
+            replies.swap(listener->replies);
+        }
+        sendReplies(*listener, replies);
+        replies.clear();
+    }
+}
+
+void UdpServer::sendReplies(Listener& listener, std::vector<Datagram::ptr>& replies) {
+    std::vector<mmsghdr> msgs;
+    std::vector<iovec> iovs(replies.size());
+    std::vector<size_t> counts;
+    std::vector<char> controls(m_gso ? replies.size() * s_control_size : 0);
+    msgs.reserve(replies.size());
+    for(size_t i = 0; i < replies.size();) {
+        Datagram& first = *replies[i];
+        size_t j = i + 1;
+        size_t total = first.length;
+        if(m_gso && first.length) {
+            // the kernel cuts the message into first.length sized datagrams,
+            // only the last may be shorter
+            while(j < replies.size() && j - i < s_gso_max_segments
+                    && replies[j - 1]->length == first.length
+                    && replies[j]->length && replies[j]->length <= first.length
+                    && total + replies[j]->length <= s_gso_max_bytes
+                    && replies[j]->peerLen == first.peerLen
+                    && !memcmp(&replies[j]->peer, &first.peer, first.peerLen)) {
+                total += replies[j]->length;
+                ++j;
+            }
+        }
+        for(size_t k = i; k < j; ++k) {
+            iovs[k].iov_base = replies[k]->data;
+            iovs[k].iov_len = replies[k]->length;
+        }
+        mmsghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_hdr.msg_name = &first.peer;
+        msg.msg_hdr.msg_namelen = first.peerLen;
+        msg.msg_hdr.msg_iov = &iovs[i];
+        msg.msg_hdr.msg_iovlen = j - i;
+        if(j - i > 1) {
+            msg.msg_hdr.msg_control = &controls[msgs.size() * s_control_size];
+            msg.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            cmsghdr* cm = CMSG_FIRSTHDR(&msg.msg_hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *(uint16_t*)CMSG_DATA(cm) = first.length;
+        }
+        msgs.push_back(msg);
+        counts.push_back(j - i);
+        i = j;
+    }
+
+    for(size_t off = 0; off < msgs.size();) {
+        int rt = listener.sock->sendBatch(&msgs[off],
+                    std::min<size_t>(m_batch, msgs.size() - off));
+        ++m_sendCalls;
+        if(rt <= 0) {
+            // a datagram nobody can take is lost like any other, skip it
+            SYLAR_LOG_DEBUG(g_logger) << "sendmmsg errno=" << errno
+                << " errstr=" << strerror(errno);
+            m_dropCount += counts[off];
+            ++off;
+            continue;
+        }
+        for(int i = 0; i < rt; ++i) {
+            m_sendCount += counts[off + i];
+        }
+        off += rt;
+    }
+}
+
+void UdpServer::handleDatagram(Datagram::ptr dgram) {
+    SYLAR_LOG_INFO(g_logger) << "handleDatagram: length=" << dgram->length
+        << " from=" << *dgram->getPeer();
+}
+
+std::vector<Socket::ptr> UdpServer::getSocks() const {
+    std::vector<Socket::ptr> socks;
+    for(auto& i : m_listeners) {
+        socks.push_back(i->sock);
+    }
+    return socks;
+}
+
+std::string UdpServer::toString(const std::string& prefix) {
+    std::stringstream ss;
+    ss << prefix << "[type=udp name=" << m_name
+       << " worker=" << (m_worker ? m_worker->getName() : "")
+       << " io_worker=" << (m_IOworker ? m_IOworker->getName() : "")
+       << " batch=" << m_batch
+       << " gso=" << m_gso
+       << " gro=" << m_gro
+       << " received=" << m_recvCount
+       << " sent=" << m_sendCount
+       << " dropped=" << m_dropCount << "]" << std::endl;
+    std::string pfx = prefix.empty() ? "    " : prefix;
+    for(auto& i : m_listeners) {
+        ss << pfx << pfx << *i->sock << std::endl;
+    }
+    return ss.str();
+}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "iomanager.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "socket.h"
+
+#include <atomic>
+#include <vector>
+
+namespace sylar {
+/**
+ * A datagram in a pooled buffer, the buffer goes back to the pool with the
+ * last reference. With GRO the kernel may merge datagrams of one sender,
+ * then segment is their size and data holds them back to back, the last
+ * one may be shorter. segment is 0 for a single datagram.
+ */
+struct Datagram : Noncopyable {
+    typedef std::shared_ptr<Datagram> ptr;
+    Datagram(size_t size) : data(new char[size]), capacity(size) {}
+    ~Datagram() { delete[] data; }
+    Address::ptr getPeer() const { return Address::Create((const sockaddr*)&peer, peerLen); }
+
+    char* data;
+    size_t capacity;
+    size_t length = 0;
+    size_t segment = 0;
+    sockaddr_storage peer;              // sender of a request, receiver of a reply
+    socklen_t peerLen = 0;
+    size_t listener = 0;                // index of the socket it came in on
+};
+
+class DatagramPool : public std::enable_shared_from_this<DatagramPool>, Noncopyable {
+public:
+    typedef std::shared_ptr<DatagramPool> ptr;
+    DatagramPool(size_t buffer_size, size_t max_cached);
+    ~DatagramPool();
+    Datagram::ptr get();
+    size_t getBufferSize() const { return m_bufferSize;}
+
+private:
+    void put(Datagram* dgram);
+
+private:
+    size_t m_bufferSize;
+    size_t m_maxCached;
+    Spinlock m_mutex;
+    std::vector<Datagram*> m_free;
+};
+
+/**
+ * Reads datagrams in batches with recvmmsg and runs handleDatagram for each
+ * on the worker. Replies are queued per socket and go out in batches with
+ * sendmmsg, with UDP GSO consecutive equal sized replies to one peer share
+ * a message.
+ */
+class UdpServer : public std::enable_shared_from_this<UdpServer>, Noncopyable {
+public:
+    typedef std::shared_ptr<UdpServer> ptr;
+    UdpServer(sylar::IOManager* worker = sylar::IOManager::GetThis()
+              ,sylar::IOManager* io_worker = sylar::IOManager::GetThis());
+    virtual ~UdpServer();
+    virtual bool bind(Address::ptr addr);
+    virtual bool bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails);
+    virtual bool start();
+    virtual void stop();
+    // queues a reply to the sender of dgram, false if it does not fit a buffer
+    bool reply(const Datagram& dgram, const void* data, size_t length);
+    bool isStop() const { return m_isStop;}
+    uint32_t getBatch() const { return m_batch;}
+    bool isGso() const { return m_gso;}
+    bool isGro() const { return m_gro;}
+    uint64_t getRecvCount() const { return m_recvCount;}
+    uint64_t getSendCount() const { return m_sendCount;}
+    // datagrams truncated on receive or replies the kernel refused
+    uint64_t getDropCount() const { return m_dropCount;}
+    // recvmmsg and sendmmsg calls, compare with the datagram counts for the batching
+    uint64_t getRecvCalls() const { return m_recvCalls;}
+    uint64_t getSendCalls() const { return m_sendCalls;}
+    std::string getName() const { return m_name;}
+    virtual void setName(const std::string& v) { m_name = v;}
+    virtual std::string toString(const std::string& prefix = "");
+    std::vector<Socket::ptr> getSocks() const;
+
+protected:
+    struct Listener {
+        typedef std::shared_ptr<Listener> ptr;
+        Socket::ptr sock;
+        pid_t thread = -1;              // reactor owning the socket, -1 unless sharded
+        Spinlock mutex;
+        std::vector<Datagram::ptr> replies;
+        bool flushing = false;
+    };
+
+    virtual void handleDatagram(Datagram::ptr dgram);
+    virtual void startRecv(Listener::ptr listener, size_t index);
+    void flush(Listener::ptr listener);
+    void sendReplies(Listener& listener, std::vector<Datagram::ptr>& replies);
+
+protected:
+    std::vector<Listener::ptr> m_listeners;
+    IOManager* m_worker;
+    IOManager* m_IOworker;
+    DatagramPool::ptr m_pool;
+    std::string m_name;
+    bool m_isStop;
+    uint32_t m_batch;
+    bool m_gso;
+    bool m_gro;
+    std::atomic<uint64_t> m_recvCount {0};
+    std::atomic<uint64_t> m_sendCount {0};
+    std::atomic<uint64_t> m_dropCount {0};
+    std::atomic<uint64_t> m_recvCalls {0};
+    std::atomic<uint64_t> m_sendCalls {0};
+};
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <new>
+#include <stddef.h>
+
+namespace sylar {
+/**
+ * Allocator for node based containers such as std::set. Freed single
+ * objects go to a small per-thread free list and are handed out again, so
+ * a container that keeps inserting and erasing does not call malloc.
+ */
+template<typename T>
+class CachedAllocator {
+public:
+    typedef T value_type;
+
+    CachedAllocator() {}
+    template<typename U>
+    CachedAllocator(const CachedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n != 1) {
+            return (T*)::operator new(n * sizeof(T));
+        }
+        FreeList& list = GetFreeList();
+        if (list.head) {
+            void* mem = list.head;
+            list.head = *(void**)mem;
+            --list.size;
+            return (T*)mem;
+        }
+        return (T*)::operator new(sizeof(T) < sizeof(void*) ? sizeof(void*) : sizeof(T));
+    }
+
+    void deallocate(T* p, size_t n) {
+        FreeList& list = GetFreeList();
+        // other thread_local destructors may still free objects at thread exit
+        if (n != 1 || list.destroyed || list.size >= FreeList::MAX_SIZE) {
+            ::operator delete(p);
+            return;
+        }
+        *(void**)p = list.head;
+        list.head = p;
+        ++list.size;
+    }
+
+    template<typename U>
+    bool operator==(const CachedAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const CachedAllocator<U>&) const { return false; }
+
+private:
+    struct FreeList {
+        enum {
+            MAX_SIZE = 1024,
+        };
+
+        ~FreeList() {
+            while (head) {
+                void* next = *(void**)head;
+                ::operator delete(head);
+                head = next;
+            }
+            destroyed = true;
+        }
+
+        void* head = nullptr;
+        size_t size = 0;
+        bool destroyed = false;
+    };
+
+    static FreeList& GetFreeList() {
+        static thread_local FreeList s_list;
+        return s_list;
+    }
+};
+}
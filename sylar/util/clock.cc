@@ -0,0 +1,103 @@
+#include "clock.h"
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define SYLAR_HAVE_TSC 1
+#endif
+
+namespace sylar {
+static thread_local uint64_t t_loopMS = 0;
+
+static uint64_t ReadNS(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec * 1000 * 1000 * 1000ul + ts.tv_nsec;
+}
+
+uint64_t GetMonotonicMS() {
+    return ReadNS(CLOCK_MONOTONIC) / (1000 * 1000);
+}
+
+uint64_t GetMonotonicUS() {
+    return ReadNS(CLOCK_MONOTONIC) / 1000;
+}
+
+uint64_t GetMonotonicNS() {
+    return ReadNS(CLOCK_MONOTONIC);
+}
+
+uint64_t GetCoarseMonotonicMS() {
+    return ReadNS(CLOCK_MONOTONIC_COARSE) / (1000 * 1000);
+}
+
+uint64_t GetLoopMS() {
+    return t_loopMS ? t_loopMS : GetMonotonicMS();
+}
+
+uint64_t UpdateLoopMS() {
+    t_loopMS = GetMonotonicMS();
+    return t_loopMS;
+}
+
+void ClearLoopMS() {
+    t_loopMS = 0;
+}
+
+namespace {
+struct TscCalibration {
+    bool usable = false;
+    uint64_t baseTsc = 0;
+    uint64_t baseNS = 0;
+    uint64_t mult = 0;          // ns per tick << 32
+
+    TscCalibration() {
+#ifdef SYLAR_HAVE_TSC
+        unsigned int eax, ebx, ecx, edx;
+        // CPUID.80000007H:EDX[8], the TSC ticks at a constant rate in every P and C state
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8))) {
+            return;
+        }
+        uint64_t start_ns = GetMonotonicNS();
+        uint64_t start_tsc = __rdtsc();
+        uint64_t end_ns = start_ns;
+        while (end_ns - start_ns < 10 * 1000 * 1000) {
+            end_ns = GetMonotonicNS();
+        }
+        uint64_t end_tsc = __rdtsc();
+        if (end_tsc <= start_tsc) {
+            return;
+        }
+        mult = (uint64_t)(((unsigned __int128)(end_ns - start_ns) << 32) / (end_tsc - start_tsc));
+        baseTsc = start_tsc;
+        baseNS = start_ns;
+        usable = mult > 0;
+#endif
+    }
+};
+
+TscCalibration& GetTscCalibration() {
+    static TscCalibration s_calibration;
+    return s_calibration;
+}
+}
+
+bool HasTscClock() {
+    return GetTscCalibration().usable;
+}
+
+uint64_t GetTscNS() {
+    TscCalibration& calibration = GetTscCalibration();
+    if (!calibration.usable) {
+        return GetMonotonicNS();
+    }
+#ifdef SYLAR_HAVE_TSC
+    uint64_t ticks = __rdtsc() - calibration.baseTsc;
+    return calibration.baseNS + (uint64_t)(((unsigned __int128)ticks * calibration.mult) >> 32);
+#else
+    return GetMonotonicNS();
+#endif
+}
+}
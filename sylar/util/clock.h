@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace sylar {
+/**
+ * Clocks for timers and timeouts. They count from an arbitrary point and
+ * never jump with settimeofday or NTP, so they only make sense as
+ * differences. Use GetCurrentMS for wall clock time.
+ */
+
+// CLOCK_MONOTONIC
+uint64_t GetMonotonicMS();
+uint64_t GetMonotonicUS();
+uint64_t GetMonotonicNS();
+
+// CLOCK_MONOTONIC_COARSE, cheaper but only as precise as the scheduler tick
+uint64_t GetCoarseMonotonicMS();
+
+/**
+ * Monotonic ms cached by the current thread. A reactor refreshes it once
+ * per loop with UpdateLoopMS(), so it may lag by however long the fibers
+ * of this loop have run. Threads that never update it get a fresh reading.
+ */
+uint64_t GetLoopMS();
+uint64_t UpdateLoopMS();
+// the thread stops running a loop, later reads are fresh again
+void ClearLoopMS();
+
+/**
+ * Nanoseconds from the invariant TSC, calibrated against CLOCK_MONOTONIC on
+ * first use. For profiling only, falls back to GetMonotonicNS without a
+ * usable TSC.
+ */
+bool HasTscClock();
+uint64_t GetTscNS();
+}
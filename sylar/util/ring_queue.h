@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+namespace sylar {
+/**
+ * FIFO on a power of two ring buffer. Unlike std::deque it keeps its capacity,
+ * so a queue in steady state never allocates. Not thread safe.
+ */
+template<typename T>
+class RingQueue {
+public:
+    RingQueue() : m_buffer(16) {}
+
+    void push(T&& v) {
+        if (m_size == m_buffer.size()) {
+            grow();
+        }
+        m_buffer[(m_head + m_size) & (m_buffer.size() - 1)] = std::move(v);
+        ++m_size;
+    }
+
+    // oldest element
+    bool pop(T& v) {
+        if (m_size == 0) {
+            return false;
+        }
+        v = std::move(m_buffer[m_head]);
+        m_head = (m_head + 1) & (m_buffer.size() - 1);
+        --m_size;
+        return true;
+    }
+
+    // newest element
+    bool popBack(T& v) {
+        if (m_size == 0) {
+            return false;
+        }
+        --m_size;
+        v = std::move(m_buffer[(m_head + m_size) & (m_buffer.size() - 1)]);
+        return true;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+private:
+    void grow() {
+        std::vector<T> buffer(m_buffer.size() * 2);
+        for (size_t i = 0; i < m_size; ++i) {
+            buffer[i] = std::move(m_buffer[(m_head + i) & (m_buffer.size() - 1)]);
+        }
+        m_buffer.swap(buffer);
+        m_head = 0;
+    }
+
+private:
+    std::vector<T> m_buffer;
+    size_t m_head = 0;
+    size_t m_size = 0;
+};
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+#include "noncopyable.h"
+
+namespace sylar {
+/**
+ * Array indexed by small integers such as fds, split into fixed size
+ * segments that are allocated on first use and never move or shrink.
+ * get() is a wait free pointer chase, a new segment is published with a
+ * single compare and swap. Elements are default constructed and live
+ * until the array is destroyed.
+ */
+template<typename T, size_t SEGMENT_BITS = 10, size_t MAX_SEGMENTS = 4096>
+class SegmentedArray : Noncopyable {
+public:
+    static const size_t SEGMENT_SIZE = (size_t)1 << SEGMENT_BITS;
+    static const size_t CAPACITY = SEGMENT_SIZE * MAX_SEGMENTS;
+
+    SegmentedArray() {
+        for (auto& i : m_segments) {
+            i.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~SegmentedArray() {
+        for (auto& i : m_segments) {
+            delete i.load(std::memory_order_relaxed);
+        }
+    }
+
+    // nullptr if index is out of range or its segment was never created
+    T* get(size_t index) const {
+        if (index >= CAPACITY) {
+            return nullptr;
+        }
+        Segment* segment = m_segments[index >> SEGMENT_BITS].load(std::memory_order_acquire);
+        return segment ? &segment->items[index & (SEGMENT_SIZE - 1)] : nullptr;
+    }
+
+    /**
+     * Creates the segment holding index if needed, init(T&, index) runs once
+     * for each element of a new segment before it is published. nullptr if
+     * index is out of range.
+     */
+    template<typename F>
+    T* getOrCreate(size_t index, F init) {
+        T* item = get(index);
+        if (item || index >= CAPACITY) {
+            return item;
+        }
+        std::atomic<Segment*>& slot = m_segments[index >> SEGMENT_BITS];
+        Segment* segment = new Segment;
+        size_t base = index & ~(SEGMENT_SIZE - 1);
+        for (size_t i = 0; i < SEGMENT_SIZE; ++i) {
+            init(segment->items[i], base + i);
+        }
+        Segment* expected = nullptr;
+        if (!slot.compare_exchange_strong(expected, segment, std::memory_order_acq_rel)) {
+            // another thread won the race, use its segment
+            delete segment;
+            segment = expected;
+        }
+        return &segment->items[index & (SEGMENT_SIZE - 1)];
+    }
+
+    T* getOrCreate(size_t index) {
+        return getOrCreate(index, [](T&, size_t){});
+    }
+
+private:
+    struct Segment {
+        T items[SEGMENT_SIZE];
+    };
+
+    std::atomic<Segment*> m_segments[MAX_SEGMENTS];
+};
+}
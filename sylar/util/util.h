@@ -31,6 +31,7 @@ std::string TypetoName() {
     return name;
 }
 
+// wall clock, see clock.h for timeouts
 uint64_t GetCurrentMS();
 uint64_t GetCurrentUS();
 
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Replaces the global operator new so a test can count heap allocations in
+ * s_allocs. Include it from the one source file of a test executable only.
+ */
+static std::atomic<uint64_t> s_allocs {0};
+
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
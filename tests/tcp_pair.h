@@ -0,0 +1,19 @@
+#pragma once
+
+#include "address.h"
+#include "socket.h"
+#include "util.h"
+
+#include <utility>
+
+// a connected loopback pair, first is the accepted end
+inline std::pair<sylar::Socket::ptr, sylar::Socket::ptr> tcp_pair() {
+    sylar::Socket::ptr server = sylar::Socket::CreateTCPSocket();
+    SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+    SYLAR_ASSERT(server->listen());
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+    SYLAR_ASSERT(sock->connect(server->getLocalAddress()));
+    sylar::Socket::ptr accepted = server->accept();
+    SYLAR_ASSERT(accepted);
+    return std::make_pair(accepted, sock);
+}
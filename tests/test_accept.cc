@@ -0,0 +1,198 @@
+#include "address.h"
+#include "config.h"
+#include "hook.h"
+#include "iomanager.h"
+#include "log.h"
+#include "socket.h"
+#include "tcp_server.h"
+#include "util.h"
+
+#include <atomic>
+#include <netinet/tcp.h>
+#include <vector>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+class SlowEcho : public sylar::TcpServer {
+public:
+    SlowEcho(sylar::IOManager* iom, uint64_t hold_ms)
+        : sylar::TcpServer(iom, iom, iom), m_holdMs(hold_ms) {}
+
+    int getMaxActive() const { return m_maxActive; }
+
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        // reserved slots, the hard limit holds for every accept loop together
+        SYLAR_ASSERT(!getMaxConnections() || getConnectionCount() <= getMaxConnections());
+        int active = ++m_active;
+        int max = m_maxActive;
+        while (active > max && !m_maxActive.compare_exchange_weak(max, active)) {
+        }
+        int nodelay = 0;
+        SYLAR_ASSERT(client->getOption(IPPROTO_TCP, TCP_NODELAY, nodelay) && nodelay);
+        SYLAR_ASSERT(client->getRemoteAddress()->toString().find("127.0.0.1") == 0);
+        char c;
+        if (client->recv(&c, 1) == 1) {
+            if (m_holdMs) {
+                usleep(m_holdMs * 1000);
+            }
+            client->send(&c, 1);
+        }
+        client->close();
+        --m_active;
+    }
+
+private:
+    uint64_t m_holdMs;
+    std::atomic<int> m_active {0};
+    std::atomic<int> m_maxActive {0};
+};
+
+// runs cb in a fiber of iom once the server listens on a loopback port
+static void with_server(std::shared_ptr<SlowEcho> server, sylar::IOManager& iom,
+        std::function<void(sylar::Address::ptr)> cb) {
+    iom.schedule([server, cb](){
+        SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+        SYLAR_ASSERT(server->start());
+        cb(server->getSocks()[0]->getLocalAddress());
+    });
+}
+
+void test_try_accept() {
+    sylar::IOManager iom(1, false, "try");
+    iom.schedule([](){
+        sylar::Socket::ptr server = sylar::Socket::CreateTCPSocket();
+        SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+        SYLAR_ASSERT(server->listen());
+        errno = 0;
+        SYLAR_ASSERT(!server->tryAccept() && errno == EAGAIN);
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+        SYLAR_ASSERT(sock->connect(server->getLocalAddress()));
+        sylar::Socket::ptr client = server->tryAccept();
+        SYLAR_ASSERT(client && client->isConnected());
+        SYLAR_ASSERT(client->getRemoteAddress()->toString() == sock->getLocalAddress()->toString());
+        // the hooks still see a blocking socket
+        SYLAR_ASSERT(!(fcntl(client->getSocket(), F_GETFL) & O_NONBLOCK));
+        SYLAR_ASSERT(!server->tryAccept() && errno == EAGAIN);
+    });
+}
+
+// the accept loops never run more than max handlers, the rest wait in the backlog.
+// with reuse port every io thread runs its own accept loop
+void test_max_connections(bool reuse_port) {
+    static const int s_conns = 32;
+    static const uint32_t s_max = 4;
+    std::shared_ptr<SlowEcho> server;
+    sylar::Config::Lookup<uint32_t>("tcp_server.max_connections")->setValue(s_max);
+    sylar::Config::Lookup<bool>("tcp_server.reuse_port")->setValue(reuse_port);
+    {
+        sylar::IOManager iom(4, false, "limit");
+        server.reset(new SlowEcho(&iom, 20));
+        sylar::Config::Lookup<uint32_t>("tcp_server.max_connections")->setValue(0);
+        sylar::Config::Lookup<bool>("tcp_server.reuse_port")->setValue(false);
+        SYLAR_ASSERT(server->getMaxConnections() == s_max);
+        with_server(server, iom, [server](sylar::Address::ptr addr){
+            std::shared_ptr<std::atomic<int>> left = std::make_shared<std::atomic<int>>(s_conns);
+            for (int i = 0; i < s_conns; ++i) {
+                sylar::IOManager::GetThis()->schedule([addr, left, server, i](){
+                    sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+                    SYLAR_ASSERT(sock->connect(addr));
+                    char c = i;
+                    SYLAR_ASSERT(sock->send(&c, 1) == 1);
+                    SYLAR_ASSERT(sock->recv(&c, 1) == 1 && c == (char)i);
+                    sock->close();
+                    if (--*left == 0) {
+                        server->stop();
+                    }
+                });
+            }
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << "reuse_port=" << reuse_port << " max_connections=" << s_max
+        << " max active=" << server->getMaxActive()
+        << " accepted=" << server->getAcceptCount() << " rejected=" << server->getRejectCount();
+    SYLAR_ASSERT(server->getMaxActive() <= (int)s_max);
+    SYLAR_ASSERT(server->getAcceptCount() == s_conns);
+    SYLAR_ASSERT(server->getRejectCount() == 0);
+    SYLAR_ASSERT(server->getConnectionCount() == 0);
+}
+
+// stop() wakes an accept loop that waits for a free slot
+void test_stop_when_full() {
+    static uint64_t used = 0;
+    sylar::Config::Lookup<uint32_t>("tcp_server.max_connections")->setValue(1);
+    {
+        sylar::IOManager iom(1, false, "full");
+        std::shared_ptr<SlowEcho> server(new SlowEcho(&iom, 0));
+        sylar::Config::Lookup<uint32_t>("tcp_server.max_connections")->setValue(0);
+        with_server(server, iom, [server](sylar::Address::ptr addr){
+            // the handler holds the only slot until sock sends
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+            SYLAR_ASSERT(sock->connect(addr));
+            while (server->getConnectionCount() < 1) {
+                usleep(1000);
+            }
+            usleep(10 * 1000);
+            // the accept loop lets go of the server when it returns
+            long refs = server.use_count();
+            uint64_t start = sylar::GetCurrentMS();
+            server->stop();
+            while (server.use_count() >= refs && sylar::GetCurrentMS() - start < 1000) {
+                usleep(1000);
+            }
+            used = sylar::GetCurrentMS() - start;
+            char c = 1;
+            SYLAR_ASSERT(sock->send(&c, 1) == 1);
+            SYLAR_ASSERT(sock->recv(&c, 1) == 1);
+            sock->close();
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << "stop with a full server used=" << used << "ms";
+    SYLAR_ASSERT(used < 50);
+}
+
+// a burst of handshakes queued in the backlog, returns connections accepted per second
+uint64_t bench_burst(uint32_t batch) {
+    static const int s_conns = 2000;
+    uint64_t used = 0;
+    sylar::Config::Lookup<uint32_t>("tcp_server.accept_batch")->setValue(batch);
+    {
+        sylar::IOManager iom(1, false, "burst");
+        std::shared_ptr<SlowEcho> server(new SlowEcho(&iom, 0));
+        sylar::Config::Lookup<uint32_t>("tcp_server.accept_batch")->setValue(64);
+        with_server(server, iom, [server, &used](sylar::Address::ptr addr){
+            // blocking connects finish the handshakes before the accept loop runs
+            sylar::set_hook_enable(false);
+            std::vector<sylar::Socket::ptr> socks;
+            for (int i = 0; i < s_conns; ++i) {
+                sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+                SYLAR_ASSERT(sock->connect(addr));
+                socks.push_back(sock);
+            }
+            sylar::set_hook_enable(true);
+            uint64_t start = sylar::GetCurrentUS();
+            while (server->getAcceptCount() < s_conns) {
+                sylar::Fiber::YeildToReady();
+            }
+            used = sylar::GetCurrentUS() - start;
+            for (auto& i : socks) {
+                i->close();
+            }
+            server->stop();
+        });
+    }
+    uint64_t rate = s_conns * 1000000ull / (used ? used : 1);
+    SYLAR_LOG_INFO(g_logger) << "accept_batch=" << batch << " conns=" << s_conns
+        << " used=" << used / 1000 << "ms conns/s=" << rate;
+    return rate;
+}
+
+int main() {
+    test_try_accept();
+    test_max_connections(false);
+    test_max_connections(true);
+    test_stop_when_full();
+    bench_burst(1);
+    bench_burst(64);
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "channel.h"
+#include "iomanager.h"
+#include "log.h"
+#include "util.h"
+
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+void test_channel() {
+    static sylar::Channel<std::unique_ptr<int>> ch(2);
+    static int sum = 0;
+    sylar::IOManager iom(2, false, "channel");
+    iom.schedule([](){
+        for (int i = 1; i <= 1000; ++i) {
+            SYLAR_ASSERT(ch.send(std::unique_ptr<int>(new int(i))));
+        }
+        ch.close();
+        SYLAR_ASSERT(!ch.send(std::unique_ptr<int>(new int(0))));
+    });
+    iom.schedule([](){
+        std::unique_ptr<int> v;
+        while (ch.recv(v)) {
+            sum += *v;
+        }
+        SYLAR_ASSERT(ch.isClosed() && ch.size() == 0);
+    });
+    iom.stop();
+    SYLAR_ASSERT(sum == 500500);
+
+    sylar::Channel<int> bounded(1);
+    int v = 0;
+    SYLAR_ASSERT(!bounded.tryRecv(v));
+    SYLAR_ASSERT(bounded.trySend(1));
+    SYLAR_ASSERT(!bounded.trySend(2));
+    SYLAR_ASSERT(bounded.tryRecv(v) && v == 1);
+    SYLAR_LOG_INFO(g_logger) << "channel sum=" << sum;
+}
+
+void test_select() {
+    static sylar::Channel<int> ints(4);
+    static sylar::Channel<std::string> strs;
+    static sylar::Channel<int> done(1);
+    static int int_count = 0;
+    static int str_count = 0;
+    sylar::IOManager iom(2, false, "select");
+    iom.schedule([](){
+        for (int i = 0; i < 500; ++i) {
+            ints.send(i);
+        }
+        ints.close();
+    });
+    iom.schedule([](){
+        for (int i = 0; i < 500; ++i) {
+            strs.send(std::to_string(i));
+        }
+        strs.close();
+    });
+    iom.schedule([](){
+        int i = -1;
+        std::string s;
+        bool ints_ok = true;
+        bool strs_ok = true;
+        while (ints_ok || strs_ok) {
+            sylar::Select sel;
+            if (ints_ok) {
+                sel.recv(ints, i, &ints_ok);
+            }
+            if (strs_ok) {
+                sel.recv(strs, s, &strs_ok);
+            }
+            sel.wait();
+            // the indices shift once a channel is dropped, so count by ok flags
+            if (ints_ok && i >= 0) {
+                ++int_count;
+                i = -1;
+            }
+            if (strs_ok && !s.empty()) {
+                ++str_count;
+                s.clear();
+            }
+        }
+        sylar::Select timeout;
+        sylar::Channel<int> never;
+        uint64_t start = sylar::GetCurrentMS();
+        SYLAR_ASSERT(timeout.recv(never, i).waitFor(30) == -1);
+        SYLAR_ASSERT(sylar::GetCurrentMS() - start >= 25);
+
+        sylar::Select sender;
+        SYLAR_ASSERT(sender.send(done, 1).tryWait() == 0);
+    });
+    iom.stop();
+    SYLAR_ASSERT(int_count == 500 && str_count == 500);
+    SYLAR_ASSERT(done.size() == 1);
+    SYLAR_LOG_INFO(g_logger) << "select ints=" << int_count << " strs=" << str_count;
+}
+
+void bench_ping_pong(size_t threads) {
+    static const int s_rounds = 100000;
+    static sylar::Channel<int>* ping = nullptr;
+    static sylar::Channel<int>* pong = nullptr;
+    sylar::Channel<int> ping_ch(1);
+    sylar::Channel<int> pong_ch(1);
+    ping = &ping_ch;
+    pong = &pong_ch;
+    uint64_t start = 0;
+    uint64_t used = 0;
+    // scheduler tickle/idle logs would dominate the run
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    {
+        sylar::IOManager iom(threads, false, "ping_pong");
+        iom.schedule([](){
+            int v = 0;
+            while (ping->recv(v)) {
+                pong->send(std::move(v));
+            }
+        });
+        iom.schedule([&start, &used](){
+            start = sylar::GetCurrentUS();
+            int v = 0;
+            for (int i = 0; i < s_rounds; ++i) {
+                ping->send(std::move(i));
+                pong->recv(v);
+                SYLAR_ASSERT(v == i);
+            }
+            used = sylar::GetCurrentUS() - start;
+            ping->close();
+        });
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_INFO(g_logger) << "ping pong threads=" << threads << " rounds=" << s_rounds
+        << " used=" << used / 1000 << "ms latency=" << used * 1000 / s_rounds << "ns/round trip";
+}
+
+int main() {
+    test_channel();
+    test_select();
+    bench_ping_pong(1);
+    bench_ping_pong(2);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include "clock.h"
+#include "log.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+void test_clock() {
+    uint64_t last = sylar::GetMonotonicNS();
+    for (int i = 0; i < 100000; ++i) {
+        uint64_t now = sylar::GetMonotonicNS();
+        SYLAR_ASSERT(now >= last);
+        last = now;
+    }
+    // the coarse clock trails by at most a few scheduler ticks
+    uint64_t coarse = sylar::GetCoarseMonotonicMS();
+    uint64_t fine = sylar::GetMonotonicMS();
+    SYLAR_ASSERT(coarse <= fine && fine - coarse < 20);
+
+    // fresh until a loop updates it, then cached until the next update
+    SYLAR_ASSERT(sylar::GetLoopMS() >= fine);
+    uint64_t loop = sylar::UpdateLoopMS();
+    usleep(20 * 1000);
+    SYLAR_ASSERT(sylar::GetLoopMS() == loop);
+    SYLAR_ASSERT(sylar::UpdateLoopMS() >= loop + 20);
+    sylar::ClearLoopMS();
+    SYLAR_ASSERT(sylar::GetLoopMS() >= loop + 20);
+
+    uint64_t tsc = sylar::GetTscNS();
+    uint64_t mono = sylar::GetMonotonicNS();
+    usleep(100 * 1000);
+    int64_t tsc_used = sylar::GetTscNS() - tsc;
+    int64_t mono_used = sylar::GetMonotonicNS() - mono;
+    // calibrated within 1%
+    SYLAR_ASSERT(std::abs(tsc_used - mono_used) < mono_used / 100);
+    SYLAR_LOG_INFO(g_logger) << "tsc=" << sylar::HasTscClock() << " 100ms sleep tsc="
+        << tsc_used << "ns monotonic=" << mono_used << "ns";
+}
+
+template<typename F>
+uint64_t cost(F f) {
+    static const int s_calls = 1000000;
+    uint64_t sum = 0;
+    uint64_t start = sylar::GetMonotonicNS();
+    for (int i = 0; i < s_calls; ++i) {
+        sum += f();
+    }
+    SYLAR_ASSERT(sum > 0);
+    return (sylar::GetMonotonicNS() - start) / s_calls;
+}
+
+void bench() {
+    uint64_t wall = cost([](){ return sylar::GetCurrentMS(); });
+    uint64_t mono = cost([](){ return sylar::GetMonotonicMS(); });
+    uint64_t coarse = cost([](){ return sylar::GetCoarseMonotonicMS(); });
+    sylar::UpdateLoopMS();
+    uint64_t loop = cost([](){ return sylar::GetLoopMS(); });
+    sylar::ClearLoopMS();
+    uint64_t tsc = cost([](){ return sylar::GetTscNS(); });
+    SYLAR_LOG_INFO(g_logger) << "per call gettimeofday=" << wall << "ns monotonic=" << mono
+        << "ns coarse=" << coarse << "ns loop=" << loop << "ns tsc=" << tsc << "ns";
+}
+
+int main() {
+    test_clock();
+    bench();
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "fiber_local.h"
+#include "iomanager.h"
+#include "log.h"
+#include "mutex.h"
+#include "util.h"
+
+#include <atomic>
+#include <map>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static std::atomic<int> s_live{0};
+
+struct Tracked {
+    Tracked() { ++s_live; }
+    ~Tracked() { --s_live; }
+    uint64_t id = 0;
+};
+
+static sylar::FiberLocal<Tracked> s_tracked;
+static sylar::FiberLocal<uint64_t> s_traceId;
+
+void test_follow_fiber() {
+    static const int s_fibers = 200;
+    static std::atomic<int> ok{0};
+    {
+        sylar::IOManager iom(3, false, "local");
+        for (int i = 0; i < s_fibers; ++i) {
+            iom.schedule([](){
+                uint64_t id = sylar::Fiber::GetFiberID();
+                s_traceId.set(id);
+                s_tracked.get().id = id;
+                for (int j = 0; j < 20; ++j) {
+                    // may resume on another worker thread
+                    sylar::Fiber::YeildToReady();
+                    SYLAR_ASSERT(*s_traceId == id && s_tracked->id == id);
+                }
+                ++ok;
+            });
+        }
+    }
+    SYLAR_ASSERT(ok == s_fibers);
+    SYLAR_ASSERT(s_live == 0);
+    SYLAR_LOG_INFO(g_logger) << "follow fiber ok=" << ok;
+}
+
+void test_reset_on_reuse() {
+    static int fresh = 0;
+    {
+        // one thread, so scheduled callbacks reuse the same fiber
+        sylar::IOManager iom(1, false, "reuse");
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule([](){
+                if (!s_traceId.has()) {
+                    ++fresh;
+                }
+                s_traceId.set(1);
+                s_tracked.get();
+            });
+        }
+    }
+    SYLAR_ASSERT(fresh == 100);
+    SYLAR_ASSERT(s_live == 0);
+
+    s_tracked.get();
+    SYLAR_ASSERT(s_live == 1);
+    s_tracked.reset();
+    SYLAR_ASSERT(s_live == 0 && !s_tracked.tryGet());
+    SYLAR_LOG_INFO(g_logger) << "reset on reuse ok";
+}
+
+void bench_access() {
+    static const int s_loops = 1000000;
+    sylar::Mutex mutex;
+    std::map<uint64_t, uint64_t> by_fiber;
+    by_fiber[sylar::Fiber::GetFiberID()] = 1;
+    s_traceId.set(1);
+    uint64_t sum = 0;
+    uint64_t start = sylar::GetCurrentUS();
+    for (int i = 0; i < s_loops; ++i) {
+        sylar::Mutex::Lock lock(mutex);
+        sum += by_fiber[sylar::Fiber::GetFiberID()];
+    }
+    uint64_t map_used = sylar::GetCurrentUS() - start;
+    start = sylar::GetCurrentUS();
+    for (int i = 0; i < s_loops; ++i) {
+        sum += *s_traceId.tryGet();
+    }
+    uint64_t local_used = sylar::GetCurrentUS() - start;
+    SYLAR_ASSERT(sum == 2 * s_loops);
+    SYLAR_LOG_INFO(g_logger) << "locked map " << map_used * 1000 / s_loops << "ns/get, FiberLocal "
+        << local_used * 1000 / s_loops << "ns/get";
+}
+
+int main() {
+    test_follow_fiber();
+    test_reset_on_reuse();
+    bench_access();
+    return 0;
+}
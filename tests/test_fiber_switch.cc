@@ -0,0 +1,66 @@
+#include "fiber.h"
+#include "log.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <ucontext.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static const uint64_t s_count = 10 * 1000 * 1000;
+
+static ucontext_t s_main_ctx;
+static ucontext_t s_fiber_ctx;
+
+static void ucontext_loop() {
+    while (true) {
+        swapcontext(&s_fiber_ctx, &s_main_ctx);
+    }
+}
+
+// baseline: raw glibc swapcontext, one rt_sigprocmask per switch
+void bench_ucontext() {
+    size_t stack_size = 128 * 1024;
+    void* stack = malloc(stack_size);
+    getcontext(&s_fiber_ctx);
+    s_fiber_ctx.uc_link = nullptr;
+    s_fiber_ctx.uc_stack.ss_sp = stack;
+    s_fiber_ctx.uc_stack.ss_size = stack_size;
+    makecontext(&s_fiber_ctx, &ucontext_loop, 0);
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < s_count; ++i) {
+        swapcontext(&s_main_ctx, &s_fiber_ctx);
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "ucontext switches=" << s_count * 2 << " used=" << used
+        << "us switches/s=" << (uint64_t)(s_count * 2 * 1000000.0 / used);
+    free(stack);
+}
+
+void bench_fiber() {
+    sylar::Fiber::GetThis();
+    bool stop = false;
+    sylar::Fiber::ptr fiber = std::make_shared<sylar::Fiber>([&stop](){
+        while (!stop) {
+            sylar::Fiber::YeildToHold();
+        }
+    });
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < s_count; ++i) {
+        fiber->swapIn();
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    stop = true;
+    fiber->swapIn();
+    SYLAR_LOG_INFO(g_logger) << "fiber(" << sylar::FiberContext::Backend() << ") switches="
+        << s_count * 2 << " used=" << used << "us switches/s="
+        << (uint64_t)(s_count * 2 * 1000000.0 / used);
+}
+
+int main() {
+    bench_ucontext();
+    bench_fiber();
+    return 0;
+}
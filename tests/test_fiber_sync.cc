@@ -0,0 +1,145 @@
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "log.h"
+#include "util.h"
+
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+void test_mutex() {
+    static sylar::FiberMutex mutex;
+    static int inside = 0;
+    static int count = 0;
+    static std::atomic<int> done {0};
+    sylar::IOManager iom(2, false, "mutex");
+    for (int i = 0; i < 50; ++i) {
+        iom.schedule([](){
+            for (int n = 0; n < 100; ++n) {
+                sylar::FiberMutex::Lock lock(mutex);
+                SYLAR_ASSERT(++inside == 1);
+                // yielding while holding the lock must not let anyone else in
+                sylar::Fiber::YeildToReady();
+                ++count;
+                --inside;
+            }
+            ++done;
+        });
+    }
+    iom.stop();
+    SYLAR_ASSERT(done == 50);
+    SYLAR_ASSERT(count == 5000);
+    SYLAR_LOG_INFO(g_logger) << "mutex count=" << count;
+}
+
+void test_rwmutex() {
+    static sylar::FiberRWMutex mutex;
+    static std::atomic<int> readers {0};
+    static std::atomic<int> max_readers {0};
+    static std::atomic<int> writers {0};
+    sylar::IOManager iom(2, false, "rwmutex");
+    for (int i = 0; i < 20; ++i) {
+        iom.schedule([i](){
+            for (int n = 0; n < 50; ++n) {
+                if (i % 5 == 0) {
+                    sylar::FiberRWMutex::WriteLock lock(mutex);
+                    SYLAR_ASSERT(++writers == 1 && readers == 0);
+                    sylar::Fiber::YeildToReady();
+                    --writers;
+                } else {
+                    sylar::FiberRWMutex::ReadLock lock(mutex);
+                    SYLAR_ASSERT(writers == 0);
+                    int r = ++readers;
+                    int m = max_readers;
+                    while (r > m && !max_readers.compare_exchange_weak(m, r));
+                    sylar::Fiber::YeildToReady();
+                    --readers;
+                }
+            }
+        });
+    }
+    iom.stop();
+    SYLAR_ASSERT(readers == 0 && writers == 0);
+    SYLAR_LOG_INFO(g_logger) << "rwmutex max concurrent readers=" << max_readers;
+}
+
+void test_condvar() {
+    static sylar::FiberMutex mutex;
+    static sylar::FiberCondVar cond;
+    static int queue = 0;
+    static int consumed = 0;
+    sylar::IOManager iom(2, false, "condvar");
+    for (int i = 0; i < 4; ++i) {
+        iom.schedule([](){
+            for (int n = 0; n < 250; ++n) {
+                sylar::FiberMutex::Lock lock(mutex);
+                while (queue == 0) {
+                    cond.wait(lock);
+                }
+                --queue;
+                ++consumed;
+            }
+        });
+    }
+    iom.schedule([](){
+        for (int n = 0; n < 1000; ++n) {
+            {
+                sylar::FiberMutex::Lock lock(mutex);
+                ++queue;
+            }
+            cond.notify();
+            if (n % 10 == 0) {
+                sylar::Fiber::YeildToReady();
+            }
+        }
+    });
+    iom.schedule([](){
+        sylar::FiberMutex mutex;
+        sylar::FiberCondVar cond;
+        sylar::FiberMutex::Lock lock(mutex);
+        uint64_t start = sylar::GetCurrentMS();
+        SYLAR_ASSERT(!cond.waitFor(lock, 50));
+        SYLAR_LOG_INFO(g_logger) << "condvar waitFor timeout used=" << sylar::GetCurrentMS() - start << "ms";
+    });
+    iom.stop();
+    SYLAR_ASSERT(consumed == 1000 && queue == 0);
+    SYLAR_LOG_INFO(g_logger) << "condvar consumed=" << consumed;
+}
+
+void test_semaphore() {
+    static sylar::FiberSemaphore sem(2);
+    static std::atomic<int> inside {0};
+    static std::atomic<int> timeouts {0};
+    // one thread: blocked fibers must not stall the others on it
+    sylar::IOManager iom(1, false, "semaphore");
+    for (int i = 0; i < 10; ++i) {
+        iom.schedule([](){
+            sem.wait();
+            SYLAR_ASSERT(++inside <= 2);
+            sylar::Fiber::YeildToReady();
+            --inside;
+            sem.notify();
+        });
+    }
+    iom.schedule([](){
+        sylar::FiberSemaphore empty;
+        uint64_t start = sylar::GetCurrentMS();
+        if (!empty.waitFor(30)) {
+            ++timeouts;
+        }
+        SYLAR_ASSERT(sylar::GetCurrentMS() - start >= 25);
+        empty.notify();
+        SYLAR_ASSERT(empty.waitFor(30));
+    });
+    iom.stop();
+    SYLAR_ASSERT(sem.getCount() == 2 && timeouts == 1);
+    SYLAR_LOG_INFO(g_logger) << "semaphore count=" << sem.getCount();
+}
+
+int main() {
+    test_mutex();
+    test_rwmutex();
+    test_condvar();
+    test_semaphore();
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "future.h"
+#include "iomanager.h"
+#include "log.h"
+#include "util.h"
+
+#include <stdexcept>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+void test_async() {
+    static bool ok = false;
+    sylar::IOManager iom(2, false, "async");
+    iom.schedule([](){
+        sylar::IOManager* iom = sylar::IOManager::GetThis();
+        std::vector<sylar::Future<int>> futures;
+        for (int i = 0; i < 10; ++i) {
+            futures.push_back(sylar::Async(iom, [i](){
+                usleep((10 - i) * 1000);
+                return i * i;
+            }));
+        }
+        sylar::WhenAll(futures).wait();
+        int sum = 0;
+        for (auto& f : futures) {
+            SYLAR_ASSERT(f.isReady());
+            sum += f.get();
+        }
+        SYLAR_ASSERT(sum == 285);
+
+        sylar::Future<void> failed = sylar::Async(iom, [](){
+            throw std::runtime_error("backend down");
+        });
+        try {
+            failed.get();
+            SYLAR_ASSERT(false);
+        } catch (const std::runtime_error& e) {
+            SYLAR_ASSERT(std::string(e.what()) == "backend down");
+        }
+
+        sylar::Future<std::string> name = sylar::Async(iom, [](){ return std::string("sylar"); });
+        sylar::Future<int> answer = sylar::Async(iom, [](){ return 42; });
+        sylar::WhenAll(name, answer).wait();
+        SYLAR_ASSERT(name.get() == "sylar" && answer.get() == 42);
+        ok = true;
+    });
+    iom.stop();
+    SYLAR_ASSERT(ok);
+    SYLAR_LOG_INFO(g_logger) << "async ok";
+}
+
+void test_when_any() {
+    static bool ok = false;
+    sylar::IOManager iom(2, false, "when_any");
+    iom.schedule([](){
+        sylar::IOManager* iom = sylar::IOManager::GetThis();
+        sylar::Future<int> slow = sylar::Async(iom, [](){ usleep(200 * 1000); return 1; });
+        sylar::Future<int> fast = sylar::Async(iom, [](){ usleep(10 * 1000); return 2; });
+        uint64_t start = sylar::GetCurrentMS();
+        SYLAR_ASSERT(sylar::WhenAny(slow, fast).get() == 1);
+        SYLAR_ASSERT(sylar::GetCurrentMS() - start < 150);
+        SYLAR_ASSERT(!slow.isReady());
+        SYLAR_ASSERT(!slow.waitFor(20));
+        SYLAR_ASSERT(slow.get() == 1);
+
+        sylar::Future<int> broken;
+        {
+            sylar::Promise<int> promise;
+            broken = promise.getFuture();
+        }
+        try {
+            broken.get();
+            SYLAR_ASSERT(false);
+        } catch (const std::future_error& e) {
+            SYLAR_ASSERT(e.code() == std::future_errc::broken_promise);
+        }
+        ok = true;
+    });
+    iom.stop();
+    SYLAR_ASSERT(ok);
+    SYLAR_LOG_INFO(g_logger) << "when any ok";
+}
+
+void test_wait_group() {
+    static const int s_workers = 100;
+    static std::atomic<int> count{0};
+    static bool ok = false;
+    sylar::IOManager iom(3, false, "wait_group");
+    iom.schedule([](){
+        sylar::WaitGroup wg;
+        for (int i = 0; i < s_workers; ++i) {
+            wg.add();
+            sylar::IOManager::GetThis()->schedule([&wg](){
+                sylar::Fiber::YeildToReady();
+                ++count;
+                wg.done();
+            });
+        }
+        wg.wait();
+        SYLAR_ASSERT(count == s_workers && wg.getCount() == 0);
+
+        sylar::WaitGroup never(1);
+        SYLAR_ASSERT(!never.waitFor(20));
+        ok = true;
+    });
+    iom.stop();
+    SYLAR_ASSERT(ok);
+    SYLAR_LOG_INFO(g_logger) << "wait group ok";
+}
+
+void test_wait_group_timeout() {
+    static uint64_t used = 0;
+    // one thread: the waiter can't run between done() and add()
+    sylar::IOManager iom(1, false, "wait_group_timeout");
+    iom.schedule([](){
+        // woken every 10ms with work left, still times out after 50ms
+        std::shared_ptr<sylar::WaitGroup> busy = std::make_shared<sylar::WaitGroup>(1);
+        sylar::Timer::ptr timer = sylar::IOManager::GetThis()->addTimer(10, [busy](){
+            busy->done();
+            busy->add();
+        }, true);
+        uint64_t start = sylar::GetCurrentMS();
+        SYLAR_ASSERT(!busy->waitFor(50));
+        used = sylar::GetCurrentMS() - start;
+        sylar::IOManager::GetThis()->cancel(timer);
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "wait group timeout used=" << used << "ms";
+    SYLAR_ASSERT(used >= 45 && used < 200);
+}
+
+void bench_fan_out() {
+    static const int s_rounds = 10000;
+    static const int s_width = 8;
+    static uint64_t used = 0;
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    {
+        sylar::IOManager iom(2, false, "fan_out");
+        iom.schedule([](){
+            sylar::IOManager* iom = sylar::IOManager::GetThis();
+            uint64_t start = sylar::GetCurrentUS();
+            for (int r = 0; r < s_rounds; ++r) {
+                std::vector<sylar::Future<int>> futures;
+                for (int i = 0; i < s_width; ++i) {
+                    futures.push_back(sylar::Async(iom, [i](){ return i; }));
+                }
+                sylar::WhenAll(futures).wait();
+            }
+            used = sylar::GetCurrentUS() - start;
+        });
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_INFO(g_logger) << "fan out width=" << s_width << " rounds=" << s_rounds
+        << " used=" << used / 1000 << "ms join=" << used * 1000 / s_rounds << "ns/round";
+}
+
+int main() {
+    test_async();
+    test_when_any();
+    test_wait_group();
+    test_wait_group_timeout();
+    bench_fan_out();
+    return 0;
+}
@@ -1,10 +1,19 @@
 #include<arpa/inet.h>
+#include <atomic>
 #include <cstring>
+#include <memory>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
 
+#include "fd_manager.h"
 #include "hook.h"
 #include "iomanager.h"
 #include "log.h"
+#include "mutex.h"
+#include "thread.h"
+#include "util.h"
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
 
@@ -57,7 +66,73 @@ void test_sock() {
     SYLAR_LOG_INFO(g_logger) << buff;
 }
 
+// ns per lookup with every thread hitting the same fd
+template<typename Lookup>
+uint64_t bench_lookup(Lookup lookup) {
+    static const int s_threads = 4;
+    static const int s_lookups = 2000000;
+    std::vector<sylar::Thread::ptr> thrs;
+    uint64_t start = sylar::GetCurrentUS();
+    for (int i = 0; i < s_threads; ++i) {
+        thrs.push_back(std::make_shared<sylar::Thread>([&lookup](){
+            size_t sum = 0;
+            for (int n = 0; n < s_lookups; ++n) {
+                sum += lookup();
+            }
+            SYLAR_ASSERT(sum > 0);
+        }, "lookup_" + std::to_string(i)));
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+    return (sylar::GetCurrentUS() - start) * 1000 / (s_threads * (uint64_t)s_lookups);
+}
+
+struct OldFdCtx {
+    bool isSocket = true;
+};
+
+void bench_fd_manager() {
+    int fds[2];
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    int fd = fds[0];
+    sylar::FdManager* mgr = sylar::FdManager::GetInstance();
+    sylar::FdCtx::ptr ctx = mgr->get(fd, true);
+    SYLAR_ASSERT(ctx && ctx->isSocket() && mgr->get(fd) == ctx);
+
+    // what the hooks did before: a read lock and a shared_ptr copy per call
+    sylar::RWMutex mutex;
+    std::vector<std::shared_ptr<OldFdCtx>> datas(fd + 1);
+    datas[fd] = std::make_shared<OldFdCtx>();
+    uint64_t locked = bench_lookup([&mutex, &datas, fd](){
+        sylar::RWMutex::ReadLock lock(mutex);
+        std::shared_ptr<OldFdCtx> ctx = datas[fd];
+        return ctx->isSocket;
+    });
+    // atomic shared_ptr loads, libstdc++ guards them with a pool of mutexes
+    uint64_t atomic_ptr = bench_lookup([&datas, fd](){
+        std::shared_ptr<OldFdCtx> ctx = std::atomic_load(&datas[fd]);
+        return ctx->isSocket;
+    });
+    uint64_t flat = bench_lookup([mgr, fd](){
+        sylar::FdCtx::ptr ctx = mgr->get(fd);
+        return ctx->isSocket() && !ctx->getUserNonblock();
+    });
+
+    // a closed fd is gone, its number comes back with a new generation
+    uint32_t generation = ctx->getGeneration();
+    mgr->del(fd);
+    SYLAR_ASSERT(!mgr->get(fd) && ctx->isClose());
+    SYLAR_ASSERT(mgr->get(fd, true) == ctx && ctx->getGeneration() == generation + 1);
+    mgr->del(fd);
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "fd lookup rwmutex+shared_ptr=" << locked
+        << "ns atomic shared_ptr=" << atomic_ptr << "ns flat=" << flat << "ns";
+}
+
 int main() {
+    bench_fd_manager();
     sylar::set_hook_enable(true);
     // test_sleep();
     sylar::IOManager iom;
@@ -0,0 +1,96 @@
+#include "config.h"
+#include "fd_manager.h"
+#include "hook.h"
+#include "iomanager.h"
+#include "log.h"
+#include "socket.h"
+#include "util.h"
+#include "tests/alloc_count.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+// two fibers ping pong one byte, every recv blocks once. returns mallocs per blocking recv
+double ping_pong(bool timeout, bool wheel) {
+    static const int s_rounds = 20000;
+    static const int s_warmup = 1000;
+    static double per_recv = 0;
+    sylar::Config::Lookup<bool>("timer.wheel")->setValue(wheel);
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    {
+        sylar::IOManager iom(1, false, "hook_alloc");
+        iom.schedule([timeout](){
+            int fds[2];
+            SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+            // socketpair is not hooked, register the fds like socket() does
+            for (int fd : fds) {
+                SYLAR_ASSERT(sylar::FdManager::GetInstance()->get(fd, true));
+            }
+            if (timeout) {
+                struct timeval tv = {10, 0};
+                for (int fd : fds) {
+                    SYLAR_ASSERT(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+                }
+            }
+            sylar::IOManager::GetThis()->schedule([fds](){
+                char c = 0;
+                for (int i = 0; i < s_warmup + s_rounds; ++i) {
+                    SYLAR_ASSERT(recv(fds[1], &c, 1, 0) == 1);
+                    SYLAR_ASSERT(send(fds[1], &c, 1, 0) == 1);
+                }
+                close(fds[1]);
+            });
+            char c = 0;
+            uint64_t start = 0;
+            for (int i = 0; i < s_warmup + s_rounds; ++i) {
+                if (i == s_warmup) {
+                    start = s_allocs;
+                }
+                SYLAR_ASSERT(send(fds[0], &c, 1, 0) == 1);
+                SYLAR_ASSERT(recv(fds[0], &c, 1, 0) == 1);
+            }
+            per_recv = (double)(s_allocs - start) / (2 * s_rounds);
+            close(fds[0]);
+        });
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_INFO(g_logger) << "timeout=" << timeout << " wheel=" << wheel
+        << " mallocs/blocking recv=" << per_recv;
+    sylar::Config::Lookup<bool>("timer.wheel")->setValue(false);
+    return per_recv;
+}
+
+// a timed out wait reports ETIMEDOUT, the next wait on the fd reuses its timer
+void test_timeout() {
+    sylar::IOManager iom(1, false, "hook_timeout");
+    iom.schedule([](){
+        int fds[2];
+        SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        for (int fd : fds) {
+            SYLAR_ASSERT(sylar::FdManager::GetInstance()->get(fd, true));
+        }
+        struct timeval tv = {0, 50 * 1000};
+        SYLAR_ASSERT(setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+        char c = 0;
+        for (int i = 0; i < 3; ++i) {
+            uint64_t start = sylar::GetCurrentMS();
+            SYLAR_ASSERT(recv(fds[0], &c, 1, 0) == -1 && errno == ETIMEDOUT);
+            SYLAR_ASSERT(sylar::GetCurrentMS() - start >= 49);
+        }
+        SYLAR_ASSERT(send(fds[1], &c, 1, 0) == 1);
+        SYLAR_ASSERT(recv(fds[0], &c, 1, 0) == 1);
+        close(fds[0]);
+        close(fds[1]);
+    });
+}
+
+int main() {
+    test_timeout();
+    // a stray allocation from warming up a cache is fine, one per wait is not
+    SYLAR_ASSERT(ping_pong(false, false) < 0.01);
+    SYLAR_ASSERT(ping_pong(true, false) < 0.01);
+    SYLAR_ASSERT(ping_pong(true, true) < 0.01);
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include "address.h"
+#include "config.h"
+#include "io_uring.h"
+#include "iomanager.h"
+#include "log.h"
+#include "socket.h"
+#include "util.h"
+#include "tests/tcp_pair.h"
+
+#include <atomic>
+#include <errno.h>
+#include <string.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+// the fiber may have moved to another thread since errno was last read
+static __attribute__((noinline)) int last_errno() {
+    return errno;
+}
+
+static void set_backend(const std::string& backend) {
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue(backend);
+}
+
+// request/response over loopback, returns syscalls per round trip
+double bench_echo(const std::string& backend) {
+    static const int s_rounds = 20000;
+    static const size_t s_size = 64;
+    static sylar::Address::ptr addr;
+    static uint64_t syscalls = 0;
+    static uint64_t used = 0;
+    static bool uring = false;
+    set_backend(backend);
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    {
+        sylar::IOManager iom(1, false, backend);
+        uring = iom.hasUring();
+        iom.schedule([](){
+            sylar::IOManager* iom = sylar::IOManager::GetThis();
+            // sockets must be created in a fiber to be hooked
+            sylar::Socket::ptr server = sylar::Socket::CreateTCPSocket();
+            SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+            SYLAR_ASSERT(server->listen());
+            addr = server->getLocalAddress();
+            iom->schedule([server](){
+                sylar::Socket::ptr client = server->accept();
+                SYLAR_ASSERT(client);
+                char buf[s_size];
+                while (true) {
+                    int rt = client->recv(buf, s_size);
+                    if (rt <= 0) {
+                        break;
+                    }
+                    SYLAR_ASSERT(client->send(buf, rt) == rt);
+                }
+            });
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+            SYLAR_ASSERT(sock->connect(addr));
+            char buf[s_size] = {0};
+            uint64_t start_calls = iom->getSyscallCount();
+            uint64_t start = sylar::GetCurrentUS();
+            for (int i = 0; i < s_rounds; ++i) {
+                buf[0] = i;
+                SYLAR_ASSERT(sock->send(buf, s_size) == (int)s_size);
+                size_t got = 0;
+                while (got < s_size) {
+                    int rt = sock->recv(buf + got, s_size - got);
+                    SYLAR_ASSERT(rt > 0);
+                    got += rt;
+                }
+                SYLAR_ASSERT(buf[0] == (char)i);
+            }
+            used = sylar::GetCurrentUS() - start;
+            syscalls = iom->getSyscallCount() - start_calls;
+            sock->close();
+        });
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    double per_round = (double)syscalls / s_rounds;
+    SYLAR_LOG_INFO(g_logger) << "backend=" << backend << " uring=" << uring << " rounds=" << s_rounds
+        << " used=" << used / 1000 << "ms latency=" << used * 1000 / s_rounds << "ns"
+        << " syscalls/round trip=" << per_round;
+    return per_round;
+}
+
+void test_timeout_and_cancel(const std::string& backend) {
+    static bool ok = false;
+    set_backend(backend);
+    sylar::IOManager iom(2, false, backend);
+    iom.schedule([](){
+        sylar::IOManager* iom = sylar::IOManager::GetThis();
+        sylar::Socket::ptr server = sylar::Socket::CreateTCPSocket();
+        SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+        SYLAR_ASSERT(server->listen());
+        sylar::Address::ptr addr = server->getLocalAddress();
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+        SYLAR_ASSERT(sock->connect(addr));
+        sylar::Socket::ptr peer = server->accept();
+        SYLAR_ASSERT(peer);
+
+        char buf[16];
+        sock->setRecvTimeout(50);
+        uint64_t start = sylar::GetCurrentMS();
+        SYLAR_ASSERT(sock->recv(buf, sizeof(buf)) == -1 && last_errno() == ETIMEDOUT);
+        uint64_t waited = sylar::GetCurrentMS() - start;
+        SYLAR_ASSERT(waited >= 40 && waited < 1000);
+
+        // closing a socket wakes the fiber blocked on it
+        iom->schedule([peer](){
+            usleep(20 * 1000);
+            peer->close();
+        });
+        char c;
+        SYLAR_ASSERT(peer->recv(&c, 1) == -1);
+        SYLAR_LOG_INFO(g_logger) << "recv after close errno=" << last_errno();
+
+        sylar::Socket::ptr refused = sylar::Socket::CreateTCPSocket();
+        server->close();
+        SYLAR_ASSERT(!refused->connect(addr));
+        ok = true;
+    });
+    iom.stop();
+    SYLAR_ASSERT(ok);
+    SYLAR_LOG_INFO(g_logger) << "backend=" << backend << " timeout and cancel ok";
+}
+
+// callbacks on shared stacks park in recv with their buffers on the stack,
+// the next fiber reuses that stack while the first one waits
+void test_shared_stack() {
+    static const int s_pairs = 8;
+    static const int s_rounds = 200;
+    static std::atomic<int> done {0};
+    set_backend("io_uring");
+    sylar::Config::Lookup<bool>("fiber.shared_stack")->setValue(true);
+    {
+        sylar::IOManager iom(1, false, "shared_uring");
+        for (int p = 0; p < s_pairs; ++p) {
+            iom.schedule([p](){
+                auto pair = tcp_pair();
+                sylar::Socket::ptr peer = pair.first;
+                sylar::IOManager::GetThis()->schedule([peer](){
+                    char buf[64];
+                    int rt;
+                    while ((rt = peer->recv(buf, sizeof(buf))) > 0) {
+                        SYLAR_ASSERT(peer->send(buf, rt) == rt);
+                    }
+                });
+                for (int r = 0; r < s_rounds; ++r) {
+                    char out[64];
+                    char in[64];
+                    memset(out, 'a' + (p + r) % 26, sizeof(out));
+                    SYLAR_ASSERT(pair.second->send(out, sizeof(out)) == sizeof(out));
+                    size_t got = 0;
+                    while (got < sizeof(in)) {
+                        int rt = pair.second->recv(in + got, sizeof(in) - got);
+                        SYLAR_ASSERT(rt > 0);
+                        got += rt;
+                    }
+                    SYLAR_ASSERT(memcmp(in, out, sizeof(in)) == 0);
+                }
+                pair.second->close();
+                ++done;
+            });
+        }
+    }
+    sylar::Config::Lookup<bool>("fiber.shared_stack")->setValue(false);
+    set_backend("epoll");
+    SYLAR_ASSERT(done == s_pairs);
+    SYLAR_LOG_INFO(g_logger) << "io_uring with shared stacks pairs=" << s_pairs << " ok";
+}
+
+// submits without reaping until the completions overflow the cq, a refused
+// submission must leave nothing behind in the ring
+void test_full_ring() {
+    static const uint32_t s_submits = 256;
+    std::unique_ptr<sylar::IoUring> ring(sylar::IoUring::Create(4));
+    if (!ring) {
+        SYLAR_LOG_INFO(g_logger) << "no io_uring, skip full ring";
+        return;
+    }
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_NOP;
+    uint32_t accepted = 0;
+    uint32_t refused = 0;
+    for (uint32_t i = 0; i < s_submits; ++i) {
+        sqe.user_data = i;
+        if (ring->submit(&sqe, 1)) {
+            ++accepted;
+        } else {
+            SYLAR_ASSERT(last_errno() == EBUSY || last_errno() == EAGAIN);
+            ++refused;
+        }
+    }
+    size_t reaped = ring->reap([](uint64_t user_data, int32_t res){
+        SYLAR_ASSERT(res == 0 && user_data < s_submits);
+    });
+    SYLAR_LOG_INFO(g_logger) << "full ring accepted=" << accepted << " refused=" << refused
+        << " reaped=" << reaped;
+    SYLAR_ASSERT(reaped == accepted);
+    // room again once the cq is reaped
+    SYLAR_ASSERT(ring->submit(&sqe, 1) == 1);
+    SYLAR_ASSERT(ring->reap([](uint64_t, int32_t){}) == 1);
+}
+
+int main() {
+    test_full_ring();
+    test_shared_stack();
+    test_timeout_and_cancel("epoll");
+    test_timeout_and_cancel("io_uring");
+    double epoll_calls = bench_echo("epoll");
+    double uring_calls = bench_echo("io_uring");
+    SYLAR_LOG_INFO(g_logger) << "io_uring/epoll syscalls=" << uring_calls / epoll_calls;
+    // equal when the kernel lacks io_uring and the backend fell back to epoll
+    SYLAR_ASSERT(uring_calls <= epoll_calls);
+    set_backend("epoll");
+    return 0;
+}
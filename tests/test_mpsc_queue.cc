@@ -0,0 +1,148 @@
+#include "log.h"
+#include "mpsc_queue.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "util.h"
+#include "tests/alloc_count.h"
+
+#include <algorithm>
+#include <sched.h>
+#include <unistd.h>
+#include <vector>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static const int s_producers = 4;
+static const int s_per_producer = 100000;
+static const int s_wakeups = 10000;
+
+void test_queue() {
+    sylar::MpscQueue<uint64_t> queue;
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int i = 0; i < s_producers; ++i) {
+        thrs.push_back(std::make_shared<sylar::Thread>([&queue, i](){
+            sylar::MpscQueue<uint64_t>::Batch batch;
+            for (uint64_t n = 0; n < s_per_producer; ++n) {
+                uint64_t v = ((uint64_t)i << 32) | n;
+                if (n % 2) {
+                    queue.push(std::move(v));
+                } else {
+                    // batches and single pushes interleave but keep per-producer order
+                    batch.push(std::move(v));
+                    if (batch.size() == 16) {
+                        queue.push(batch);
+                    }
+                }
+            }
+            queue.push(batch);
+        }, "producer_" + std::to_string(i)));
+    }
+    std::vector<uint64_t> next(s_producers, 0);
+    std::vector<std::vector<uint64_t>> seen(s_producers);
+    size_t total = 0;
+    while (total < (size_t)s_producers * s_per_producer) {
+        total += queue.drain([&seen](uint64_t&& v){
+            seen[v >> 32].push_back(v & 0xffffffff);
+        });
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+    SYLAR_ASSERT(queue.empty());
+    for (int i = 0; i < s_producers; ++i) {
+        SYLAR_ASSERT(seen[i].size() == (size_t)s_per_producer);
+        // single pushes (odd) and batched values (even) each keep their push order
+        int64_t last[2] = {-1, -1};
+        for (auto& n : seen[i]) {
+            SYLAR_ASSERT((int64_t)n > last[n % 2]);
+            last[n % 2] = n;
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "mpsc queue total=" << total;
+}
+
+// one value in flight from another thread at a time, the wakeup pattern of an inbox
+void test_recycle() {
+    static const int s_rounds = 20000;
+    static const int s_warmup = 1000;
+    sylar::MpscQueue<uint64_t> queue;
+    std::atomic<int> drained {0};
+    std::atomic<uint64_t> start {0};
+    sylar::Thread::ptr thr = std::make_shared<sylar::Thread>([&queue, &drained, &start](){
+        for (int i = 0; i < s_rounds; ++i) {
+            if (i == s_warmup) {
+                start = s_allocs.load();
+            }
+            queue.push(i);
+            while (drained <= i) {
+                sched_yield();
+            }
+        }
+    }, "producer");
+    int total = 0;
+    while (total < s_rounds) {
+        int count = queue.drain([](uint64_t&&){});
+        if (!count) {
+            sched_yield();
+        }
+        total += count;
+        drained = total;
+    }
+    uint64_t allocs = s_allocs - start;
+    thr->join();
+    SYLAR_LOG_INFO(g_logger) << "mpsc recycle pushes=" << s_rounds - s_warmup << " allocs=" << allocs;
+    SYLAR_ASSERT(allocs < 16);
+}
+
+static std::vector<uint64_t> s_latency;
+
+void wakeup(uint64_t start) {
+    s_latency.push_back(sylar::GetCurrentUS() - start);
+}
+
+void test_fan_in() {
+    s_latency.clear();
+    s_latency.reserve(s_producers * s_wakeups);
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    pid_t worker = -1;
+    {
+        sylar::Scheduler sc(2, false, "fan_in");
+        sc.start();
+        sylar::Semaphore sem;
+        sc.schedule([&worker, &sem](){
+            worker = sylar::GetThreadID();
+            sem.notify();
+        });
+        sem.wait();
+        std::vector<sylar::Thread::ptr> thrs;
+        for (int i = 0; i < s_producers; ++i) {
+            thrs.push_back(std::make_shared<sylar::Thread>([&sc, worker](){
+                for (int n = 0; n < s_wakeups; ++n) {
+                    // all wakeups pinned to one worker go through its inbox
+                    sc.schedule(std::bind(&wakeup, sylar::GetCurrentUS()), worker);
+                    if (n % 8 == 0) {
+                        usleep(50);
+                    }
+                }
+            }, "waker_" + std::to_string(i)));
+        }
+        for (auto& i : thrs) {
+            i->join();
+        }
+        sc.stop();
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_ASSERT(s_latency.size() == (size_t)s_producers * s_wakeups);
+    std::sort(s_latency.begin(), s_latency.end());
+    SYLAR_LOG_INFO(g_logger) << "fan in wakeups=" << s_latency.size()
+        << " p50=" << s_latency[s_latency.size() / 2] << "us"
+        << " p99=" << s_latency[s_latency.size() * 99 / 100] << "us"
+        << " max=" << s_latency.back() << "us";
+}
+
+int main() {
+    test_queue();
+    test_recycle();
+    test_fan_in();
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "config.h"
+#include "http_connection.h"
+#include "http_server.h"
+#include "iomanager.h"
+#include "log.h"
+#include "util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+// keep-alive HTTP requests over loopback, returns syscalls per request
+double bench_http(bool persistent) {
+    static const int s_requests = 10000;
+    static uint64_t syscalls = 0;
+    static uint64_t used = 0;
+    sylar::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(persistent);
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    {
+        sylar::IOManager iom(1, false, "persistent");
+        SYLAR_ASSERT(iom.isPersistent() == persistent);
+        iom.schedule([](){
+            sylar::IOManager* iom = sylar::IOManager::GetThis();
+            sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(true));
+            server->getServletDispatch()->addServlet("/bench", [](sylar::http::HttpRequest::ptr req
+                        ,sylar::http::HttpResponse::ptr rsp
+                        ,sylar::http::HttpSession::ptr session) {
+                rsp->setBody("ok");
+                return 0;
+            });
+            SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+            SYLAR_ASSERT(server->start());
+            sylar::Address::ptr addr = server->getSocks()[0]->getLocalAddress();
+
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+            SYLAR_ASSERT(sock->connect(addr));
+            sylar::http::HttpConnection::ptr conn(new sylar::http::HttpConnection(sock));
+            sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest(0x11, false));
+            req->setPath("/bench");
+            req->setHeader("Host", "127.0.0.1");
+            uint64_t start_calls = iom->getSyscallCount();
+            uint64_t start = sylar::GetCurrentUS();
+            for (int i = 0; i < s_requests; ++i) {
+                SYLAR_ASSERT(conn->sendRequest(req) > 0);
+                sylar::http::HttpResponse::ptr rsp = conn->recvResponse();
+                SYLAR_ASSERT(rsp && rsp->getBody() == "ok");
+            }
+            used = sylar::GetCurrentUS() - start;
+            syscalls = iom->getSyscallCount() - start_calls;
+            conn->close();
+            server->stop();
+        });
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    double per_request = (double)syscalls / s_requests;
+    SYLAR_LOG_INFO(g_logger) << "persistent=" << persistent << " requests=" << s_requests
+        << " used=" << used / 1000 << "ms latency=" << used * 1000 / s_requests << "ns"
+        << " syscalls/request=" << per_request;
+    return per_request;
+}
+
+int main() {
+    double oneshot = bench_http(false);
+    double persistent = bench_http(true);
+    SYLAR_LOG_INFO(g_logger) << "persistent/oneshot syscalls=" << persistent / oneshot;
+    SYLAR_ASSERT(persistent < oneshot);
+    sylar::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(false);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "address.h"
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "socket.h"
+#include "util.h"
+
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static const int s_clients = 16;
+static const int s_rounds = 2000;
+static const size_t s_size = 64;
+static std::atomic<int> s_moved {0};
+
+void serve(sylar::Socket::ptr client, pid_t owner) {
+    char buf[s_size];
+    while (true) {
+        int rt = client->recv(buf, s_size);
+        if (owner != -1 && sylar::GetThreadID() != owner) {
+            ++s_moved;
+        }
+        if (rt <= 0) {
+            break;
+        }
+        SYLAR_ASSERT(client->send(buf, rt) == rt);
+    }
+    client->close();
+}
+
+// echo clients against an accept loop, returns syscalls per round trip
+double bench_echo(bool sharded) {
+    static sylar::Address::ptr addr;
+    static uint64_t syscalls = 0;
+    static uint64_t used = 0;
+    s_moved = 0;
+    sylar::Config::Lookup<bool>("iomanager.sharded")->setValue(sharded);
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    {
+        sylar::IOManager iom(4, false, "reactor");
+        SYLAR_ASSERT(iom.isSharded() == sharded);
+        iom.schedule([](){
+            sylar::IOManager* iom = sylar::IOManager::GetThis();
+            sylar::Socket::ptr server = sylar::Socket::CreateTCPSocket();
+            SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+            SYLAR_ASSERT(server->listen());
+            addr = server->getLocalAddress();
+            iom->schedule([server, iom](){
+                for (int i = 0; i < s_clients; ++i) {
+                    sylar::Socket::ptr client = server->accept();
+                    SYLAR_ASSERT(client);
+                    pid_t owner = iom->pinFd(client->getSocket());
+                    iom->schedule(std::bind(serve, client, owner), owner);
+                }
+                server->close();
+            });
+
+            std::shared_ptr<std::atomic<int>> left = std::make_shared<std::atomic<int>>(s_clients);
+            uint64_t start_calls = iom->getSyscallCount();
+            uint64_t start = sylar::GetCurrentUS();
+            for (int i = 0; i < s_clients; ++i) {
+                iom->schedule([left, start, start_calls](){
+                    sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+                    SYLAR_ASSERT(sock->connect(addr));
+                    char buf[s_size] = {0};
+                    for (int r = 0; r < s_rounds; ++r) {
+                        buf[0] = r;
+                        SYLAR_ASSERT(sock->send(buf, s_size) == (int)s_size);
+                        size_t got = 0;
+                        while (got < s_size) {
+                            int rt = sock->recv(buf + got, s_size - got);
+                            SYLAR_ASSERT(rt > 0);
+                            got += rt;
+                        }
+                        SYLAR_ASSERT(buf[0] == (char)r);
+                    }
+                    sock->close();
+                    if (--*left == 0) {
+                        sylar::IOManager* iom = sylar::IOManager::GetThis();
+                        used = sylar::GetCurrentUS() - start;
+                        syscalls = iom->getSyscallCount() - start_calls;
+                    }
+                });
+            }
+        });
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    double per_round = (double)syscalls / (s_clients * s_rounds);
+    SYLAR_LOG_INFO(g_logger) << "sharded=" << sharded << " clients=" << s_clients
+        << " rounds=" << s_rounds << " used=" << used / 1000 << "ms"
+        << " syscalls/round trip=" << per_round << " moved=" << s_moved;
+    return per_round;
+}
+
+int main() {
+    bench_echo(false);
+    bench_echo(true);
+    // a pinned connection never runs on another thread
+    SYLAR_ASSERT(s_moved == 0);
+    sylar::Config::Lookup<bool>("iomanager.sharded")->setValue(false);
+    return 0;
+}
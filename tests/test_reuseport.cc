@@ -0,0 +1,108 @@
+#include "address.h"
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "mutex.h"
+#include "socket.h"
+#include "tcp_server.h"
+#include "util.h"
+
+#include <atomic>
+#include <set>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static const int s_clients = 8;
+static const int s_conns = 250;
+
+class EchoOnce : public sylar::TcpServer {
+public:
+    EchoOnce(sylar::IOManager* iom) : sylar::TcpServer(iom, iom, iom) {}
+
+    std::set<pid_t> getThreads() {
+        sylar::Mutex::Lock lock(m_mutex);
+        return m_threads;
+    }
+
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        {
+            sylar::Mutex::Lock lock(m_mutex);
+            m_threads.insert(sylar::GetThreadID());
+        }
+        char c;
+        if (client->recv(&c, 1) == 1) {
+            client->send(&c, 1);
+        }
+        client->close();
+    }
+
+private:
+    sylar::Mutex m_mutex;
+    std::set<pid_t> m_threads;
+};
+
+// short lived connections, one byte each way, returns connections per second
+uint64_t bench_accept(int threads, bool reuse_port) {
+    static uint64_t used = 0;
+    static size_t served_on = 0;
+    sylar::Config::Lookup<bool>("tcp_server.reuse_port")->setValue(reuse_port);
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    {
+        sylar::IOManager server_iom(threads, false, "server");
+        sylar::IOManager client_iom(1, false, "client");
+        std::shared_ptr<EchoOnce> server(new EchoOnce(&server_iom));
+        SYLAR_ASSERT(server->isReusePort() == reuse_port);
+        // sockets must be created in a hooked thread to be nonblocking
+        sylar::Address::ptr addr;
+        sylar::Semaphore bound;
+        server_iom.schedule([server, threads, reuse_port, &addr, &bound](){
+            SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+            SYLAR_ASSERT(server->getSocks().size() == (reuse_port ? (size_t)threads : 1));
+            SYLAR_ASSERT(server->start());
+            addr = server->getSocks()[0]->getLocalAddress();
+            bound.notify();
+        });
+        bound.wait();
+
+        std::shared_ptr<std::atomic<int>> left = std::make_shared<std::atomic<int>>(s_clients);
+        uint64_t start = sylar::GetCurrentUS();
+        for (int i = 0; i < s_clients; ++i) {
+            client_iom.schedule([addr, left, start, server, reuse_port](){
+                for (int n = 0; n < s_conns; ++n) {
+                    sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+                    SYLAR_ASSERT(sock->connect(addr));
+                    char c = n;
+                    SYLAR_ASSERT(sock->send(&c, 1) == 1);
+                    SYLAR_ASSERT(sock->recv(&c, 1) == 1 && c == (char)n);
+                    sock->close();
+                }
+                if (--*left == 0) {
+                    used = sylar::GetCurrentUS() - start;
+                    served_on = server->getThreads().size();
+                    server->stop();
+                }
+            });
+        }
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    uint64_t rate = (uint64_t)s_clients * s_conns * 1000000 / (used ? used : 1);
+    SYLAR_LOG_INFO(g_logger) << "reuse_port=" << reuse_port << " threads=" << threads
+        << " conns=" << s_clients * s_conns << " used=" << used / 1000 << "ms"
+        << " conns/s=" << rate << " served on threads=" << served_on;
+    if (reuse_port) {
+        // every listener has its own thread, the kernel hashes connections over them
+        SYLAR_ASSERT(served_on <= (size_t)threads);
+        SYLAR_ASSERT(threads == 1 || served_on > 1);
+    }
+    return rate;
+}
+
+int main() {
+    for (int threads : {1, 2, 4}) {
+        bench_accept(threads, false);
+        bench_accept(threads, true);
+    }
+    sylar::Config::Lookup<bool>("tcp_server.reuse_port")->setValue(false);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include "fd_manager.h"
+#include "log.h"
+#include "mutex.h"
+#include "segmented_array.h"
+#include "thread.h"
+#include "util.h"
+
+#include <atomic>
+#include <vector>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static const int s_threads = 4;
+static const size_t s_fds = 64 * 1024;
+static const int s_lookups = 2000000;
+
+struct Item {
+    size_t index = ~(size_t)0;
+    std::atomic<int> hits {0};
+};
+
+// threads race to create the same segments, every index must end up with one item
+void test_grow() {
+    sylar::SegmentedArray<Item> array;
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int i = 0; i < s_threads; ++i) {
+        thrs.push_back(std::make_shared<sylar::Thread>([&array](){
+            for (size_t n = 0; n < s_fds; ++n) {
+                Item* item = array.getOrCreate(n, [](Item& item, size_t index){
+                    item.index = index;
+                });
+                SYLAR_ASSERT(item && item->index == n);
+                ++item->hits;
+            }
+        }, "grow_" + std::to_string(i)));
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+    for (size_t n = 0; n < s_fds; ++n) {
+        SYLAR_ASSERT(array.get(n)->hits == s_threads);
+    }
+    SYLAR_ASSERT(!array.get(s_fds + sylar::SegmentedArray<Item>::SEGMENT_SIZE));
+    SYLAR_ASSERT(!array.get(sylar::SegmentedArray<Item>::CAPACITY));
+    SYLAR_LOG_INFO(g_logger) << "segmented array grow ok fds=" << s_fds;
+}
+
+// lookups while one thread keeps growing the table
+template<typename Lookup, typename Grow>
+uint64_t bench(Lookup lookup, Grow grow) {
+    std::atomic<bool> done {false};
+    sylar::Thread::ptr grower = std::make_shared<sylar::Thread>([&done, &grow](){
+        for (size_t n = 1024; !done; n += 1024) {
+            grow(n % s_fds);
+        }
+    }, "grower");
+    std::vector<sylar::Thread::ptr> thrs;
+    uint64_t start = sylar::GetCurrentUS();
+    for (int i = 0; i < s_threads - 1; ++i) {
+        thrs.push_back(std::make_shared<sylar::Thread>([&lookup](){
+            size_t sum = 0;
+            for (int n = 0; n < s_lookups; ++n) {
+                sum += lookup(n % 1024);
+            }
+            SYLAR_ASSERT(sum > 0);
+        }, "lookup_" + std::to_string(i)));
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+    done = true;
+    grower->join();
+    return used * 1000 / ((s_threads - 1) * (uint64_t)s_lookups);
+}
+
+void bench_lookup() {
+    sylar::RWMutex mutex;
+    std::vector<size_t*> vec;
+    auto vec_grow = [&mutex, &vec](size_t fd){
+        sylar::RWMutex::WriteLock lock(mutex);
+        if (fd >= vec.size()) {
+            // the old table layout, resized by 1.5 and filled under the write lock
+            size_t old = vec.size();
+            vec.resize(fd * 1.5 + 1);
+            for (size_t i = old; i < vec.size(); ++i) {
+                vec[i] = new size_t(i + 1);
+            }
+        }
+    };
+    vec_grow(1024);
+    uint64_t locked = bench([&mutex, &vec](size_t fd){
+        sylar::RWMutex::ReadLock lock(mutex);
+        return *vec[fd];
+    }, vec_grow);
+    for (auto i : vec) {
+        delete i;
+    }
+
+    sylar::SegmentedArray<size_t> array;
+    auto array_grow = [&array](size_t fd){
+        array.getOrCreate(fd, [](size_t& v, size_t index){
+            v = index + 1;
+        });
+    };
+    array_grow(0);
+    uint64_t segmented = bench([&array](size_t fd){
+        return *array.get(fd);
+    }, array_grow);
+    SYLAR_LOG_INFO(g_logger) << "lookup rwmutex vector=" << locked << "ns segmented=" << segmented << "ns";
+}
+
+void test_fd_manager() {
+    sylar::FdManager* mgr = sylar::FdManager::GetInstance();
+    SYLAR_ASSERT(!mgr->get(-1, true));
+    SYLAR_ASSERT(!mgr->get(100000));
+    sylar::FdCtx::ptr ctx = mgr->get(100000, true);
+    SYLAR_ASSERT(ctx && mgr->get(100000) == ctx && mgr->get(100000, true) == ctx);
+    mgr->del(100000);
+    SYLAR_ASSERT(!mgr->get(100000));
+    mgr->del(1 << 30);
+    SYLAR_LOG_INFO(g_logger) << "fd manager ok";
+}
+
+int main() {
+    test_grow();
+    test_fd_manager();
+    bench_lookup();
+    return 0;
+}
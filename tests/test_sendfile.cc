@@ -0,0 +1,224 @@
+#include "address.h"
+#include "http_connection.h"
+#include "http_server.h"
+#include "iomanager.h"
+#include "log.h"
+#include "socket.h"
+#include "socket_stream.h"
+#include "util.h"
+#include "tests/tcp_pair.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static const std::string s_path = "/tmp/sylar_test_sendfile";
+static const size_t s_size = 32 * 1024 * 1024;
+static std::string s_data;
+
+static void make_file() {
+    s_data.resize(s_size);
+    for (size_t i = 0; i < s_size; ++i) {
+        s_data[i] = 'a' + (i * 7 + i / 4096) % 26;
+    }
+    int fd = open(s_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    SYLAR_ASSERT(fd != -1);
+    SYLAR_ASSERT(write(fd, s_data.c_str(), s_size) == (ssize_t)s_size);
+    close(fd);
+}
+
+static std::string read_all(sylar::Socket::ptr sock, size_t size) {
+    std::string buf(size, 0);
+    sylar::SocketStream stream(sock, false);
+    SYLAR_ASSERT(stream.readFixSize(&buf[0], size) == (int)size);
+    return buf;
+}
+
+void test_http_file() {
+    sylar::IOManager iom(2, false, "http");
+    iom.schedule([](){
+        sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(true));
+        server->getServletDispatch()->addServlet("/file", [](sylar::http::HttpRequest::ptr req
+                    ,sylar::http::HttpResponse::ptr rsp
+                    ,sylar::http::HttpSession::ptr session) {
+            rsp->setFileBody(sylar::http::FileBody::Open(s_path));
+            return 0;
+        });
+        server->getServletDispatch()->addServlet("/range", [](sylar::http::HttpRequest::ptr req
+                    ,sylar::http::HttpResponse::ptr rsp
+                    ,sylar::http::HttpSession::ptr session) {
+            sylar::http::FileBody::ptr file = sylar::http::FileBody::Open(s_path);
+            file->offset = 1000;
+            file->length = 5000;
+            rsp->setFileBody(file);
+            return 0;
+        });
+        SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+        SYLAR_ASSERT(server->start());
+        SYLAR_ASSERT(!sylar::http::FileBody::Open("/tmp"));
+        sylar::Address::ptr addr = server->getSocks()[0]->getLocalAddress();
+
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+        SYLAR_ASSERT(sock->connect(addr));
+        sylar::http::HttpConnection::ptr conn(new sylar::http::HttpConnection(sock));
+        sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest(0x11, false));
+        req->setHeader("Host", "127.0.0.1");
+        req->setPath("/file");
+        SYLAR_ASSERT(conn->sendRequest(req) > 0);
+        sylar::http::HttpResponse::ptr rsp = conn->recvResponse();
+        SYLAR_ASSERT(rsp && rsp->getBody() == s_data);
+        // keep-alive, the next response starts right after the file
+        req->setPath("/range");
+        SYLAR_ASSERT(conn->sendRequest(req) > 0);
+        rsp = conn->recvResponse();
+        SYLAR_ASSERT(rsp && rsp->getBody() == s_data.substr(1000, 5000));
+        conn->close();
+        server->stop();
+        SYLAR_LOG_INFO(g_logger) << "http file body ok size=" << s_size;
+    });
+}
+
+void test_send_timeout() {
+    sylar::IOManager iom(1, false, "timeout");
+    iom.schedule([](){
+        auto pair = tcp_pair();
+        pair.first->setSendTimeout(100);
+        int fd = open(s_path.c_str(), O_RDONLY);
+        // nobody reads, the socket buffers fill up and the fiber waits
+        uint64_t start = sylar::GetCurrentMS();
+        int64_t sent = 0;
+        int rt = 0;
+        while ((rt = pair.first->sendFile(fd, sent, s_size - sent)) > 0) {
+            sent += rt;
+        }
+        SYLAR_ASSERT(rt == -1 && errno == ETIMEDOUT);
+        SYLAR_ASSERT(sylar::GetCurrentMS() - start >= 100);
+        SYLAR_ASSERT(sent > 0 && sent < (int64_t)s_size);
+        SYLAR_ASSERT(read_all(pair.second, sent) == s_data.substr(0, sent));
+        close(fd);
+        SYLAR_LOG_INFO(g_logger) << "sendFile timed out after " << sent << " bytes";
+    });
+}
+
+void test_splice() {
+    sylar::IOManager iom(2, false, "splice");
+    iom.schedule([](){
+        auto upstream = tcp_pair();
+        auto downstream = tcp_pair();
+        sylar::Socket::ptr writer = upstream.second;
+        sylar::IOManager::GetThis()->schedule([writer](){
+            sylar::SocketStream stream(writer, false);
+            SYLAR_ASSERT(stream.writeFixSize(s_data.c_str(), s_size) == (int)s_size);
+            writer->close();
+        });
+        sylar::Socket::ptr proxy_in = upstream.first;
+        sylar::Socket::ptr proxy_out = downstream.first;
+        sylar::IOManager::GetThis()->schedule([proxy_in, proxy_out](){
+            sylar::SocketStream in(proxy_in);
+            sylar::SocketStream out(proxy_out);
+            // stops at eof, not at the asked length
+            SYLAR_ASSERT(out.spliceFrom(in, s_size * 2) == (int64_t)s_size);
+        });
+        SYLAR_ASSERT(read_all(downstream.second, s_size) == s_data);
+        char c;
+        SYLAR_ASSERT(downstream.second->recv(&c, 1) == 0);
+        SYLAR_LOG_INFO(g_logger) << "splice proxy ok size=" << s_size;
+    });
+}
+
+// the proxy times out while nobody reads downstream, retrying loses nothing
+void test_splice_retry() {
+    static const size_t s_part = 16 * 1024 * 1024;
+    sylar::IOManager iom(2, false, "splice_retry");
+    iom.schedule([](){
+        auto upstream = tcp_pair();
+        auto downstream = tcp_pair();
+        sylar::Socket::ptr writer = upstream.second;
+        sylar::IOManager::GetThis()->schedule([writer](){
+            sylar::SocketStream stream(writer, false);
+            SYLAR_ASSERT(stream.writeFixSize(s_data.c_str(), s_part) == (int)s_part);
+            writer->close();
+        });
+        sylar::Socket::ptr proxy_out = downstream.first;
+        sylar::Socket::ptr reader = downstream.second;
+        proxy_out->setSendTimeout(100);
+        size_t moved = 0;
+        int timeouts = 0;
+        while (true) {
+            int rt = proxy_out->spliceFrom(*upstream.first, 64 * 1024);
+            if (rt == 0) {
+                break;
+            }
+            if (rt < 0) {
+                SYLAR_ASSERT(errno == ETIMEDOUT && proxy_out->getSplicePending() > 0);
+                if (timeouts++ == 0) {
+                    sylar::IOManager::GetThis()->schedule([reader](){
+                        SYLAR_ASSERT(read_all(reader, s_part) == s_data.substr(0, s_part));
+                        char c;
+                        SYLAR_ASSERT(reader->recv(&c, 1) == 0);
+                    });
+                }
+                continue;
+            }
+            moved += rt;
+        }
+        proxy_out->close();
+        SYLAR_ASSERT(moved == s_part && timeouts > 0);
+        SYLAR_LOG_INFO(g_logger) << "splice retried after " << timeouts << " timeouts";
+    });
+}
+
+// file to socket throughput, the reader drains and discards
+void bench_file(bool zero_copy) {
+    static const int s_rounds = 8;
+    static uint64_t used = 0;
+    {
+        sylar::IOManager iom(1, false, "bench");
+        iom.schedule([zero_copy](){
+            auto pair = tcp_pair();
+            sylar::Socket::ptr reader = pair.second;
+            sylar::IOManager::GetThis()->schedule([reader](){
+                std::string buf(256 * 1024, 0);
+                while (reader->recv(&buf[0], buf.size()) > 0) {
+                }
+            });
+            int fd = open(s_path.c_str(), O_RDONLY);
+            sylar::SocketStream stream(pair.first);
+            std::string buf(256 * 1024, 0);
+            uint64_t start = sylar::GetCurrentUS();
+            for (int r = 0; r < s_rounds; ++r) {
+                if (zero_copy) {
+                    SYLAR_ASSERT(stream.sendFile(fd, 0, s_size) == (int64_t)s_size);
+                    continue;
+                }
+                for (off_t off = 0; off < (off_t)s_size; off += buf.size()) {
+                    ssize_t n = pread(fd, &buf[0], buf.size(), off);
+                    SYLAR_ASSERT(n > 0);
+                    SYLAR_ASSERT(stream.writeFixSize(buf.c_str(), n) == n);
+                }
+            }
+            used = sylar::GetCurrentUS() - start;
+            close(fd);
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << (zero_copy ? "sendFile" : "pread+send") << " "
+        << s_rounds * s_size / 1024 / 1024 << "MiB used=" << used / 1000 << "ms "
+        << (uint64_t)s_rounds * s_size / (used ? used : 1) << "MB/s";
+}
+
+int main() {
+    make_file();
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    test_http_file();
+    test_send_timeout();
+    test_splice();
+    test_splice_retry();
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    bench_file(false);
+    bench_file(true);
+    unlink(s_path.c_str());
+    return 0;
+}
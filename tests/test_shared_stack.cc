@@ -0,0 +1,71 @@
+#include "config.h"
+#include "fiber.h"
+#include "log.h"
+#include "scheduler.h"
+#include "stack_allocator.h"
+
+#include <sstream>
+#include <vector>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static int s_done = 0;
+
+// keep locals alive across yields, they must survive the stack copies
+static int deep(int id, int depth) {
+    char buf[256];
+    memset(buf, id & 0xff, sizeof(buf));
+    int sum = 0;
+    if (depth > 0) {
+        sum = deep(id, depth - 1);
+    } else {
+        sylar::Fiber::YeildToHold();
+    }
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        SYLAR_ASSERT(buf[i] == (char)(id & 0xff));
+    }
+    return sum + depth;
+}
+
+void test_swap() {
+    sylar::Fiber::GetThis();
+    std::vector<sylar::Fiber::ptr> fibers;
+    for (int i = 0; i < 1000; ++i) {
+        fibers.push_back(std::make_shared<sylar::Fiber>([i](){
+            int sum = deep(i, i % 16);
+            SYLAR_ASSERT(sum == (i % 16) * (i % 16 + 1) / 2);
+            ++s_done;
+        }, 0, false, true));
+    }
+    for (auto& i : fibers) {
+        i->swapIn();
+    }
+    for (auto& i : fibers) {
+        i->swapIn();
+        SYLAR_ASSERT(i->getState() == sylar::Fiber::TERM);
+    }
+    SYLAR_LOG_INFO(g_logger) << "shared=" << fibers[0]->isSharedStack() << " done=" << s_done;
+}
+
+void test_scheduler() {
+    sylar::Config::Lookup<bool>("fiber.shared_stack", false)->setValue(true);
+    sylar::Scheduler sc(2, true, "shared");
+    sc.start();
+    for (int i = 0; i < 1000; ++i) {
+        sc.schedule([i](){
+            deep(i, 8);
+            sylar::Fiber::YeildToReady();
+            deep(i, 4);
+        });
+    }
+    sc.stop();
+}
+
+int main() {
+    test_swap();
+    test_scheduler();
+    std::stringstream ss;
+    sylar::StackAllocator::Dump(ss);
+    SYLAR_LOG_INFO(g_logger) << ss.str();
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "config.h"
+#include "fiber.h"
+#include "log.h"
+#include "stack_allocator.h"
+#include "thread.h"
+#include "util.h"
+
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <vector>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static std::string dump_stats() {
+    std::stringstream ss;
+    sylar::StackAllocator::Dump(ss);
+    return ss.str();
+}
+
+void test_reuse() {
+    sylar::Fiber::GetThis();
+    std::vector<sylar::Fiber::ptr> fibers;
+    for (int i = 0; i < 16; ++i) {
+        fibers.push_back(std::make_shared<sylar::Fiber>([](){}));
+    }
+    SYLAR_LOG_INFO(g_logger) << "after alloc " << dump_stats();
+    for (auto& i : fibers) {
+        i->swapIn();
+    }
+    fibers.clear();
+    SYLAR_LOG_INFO(g_logger) << "after free " << dump_stats();
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for (int i = 0; i < 100000; ++i) {
+        sylar::Fiber::ptr fiber = std::make_shared<sylar::Fiber>([](){});
+        fiber->swapIn();
+    }
+    SYLAR_LOG_INFO(g_logger) << "100000 fibers used=" << sylar::GetCurrentUS() - begin
+        << "us " << dump_stats();
+    sylar::StackAllocator::Stats stats = sylar::StackAllocator::GetStats();
+    SYLAR_ASSERT(stats.in_use == 0);
+    SYLAR_ASSERT(stats.high_water >= 16);
+}
+
+static uint64_t free_huge_pages() {
+    std::ifstream ifs("/proc/meminfo");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        uint64_t n = 0;
+        if (sscanf(line.c_str(), "HugePages_Free: %lu", &n) == 1) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+// more stacks than the huge page pool holds, the rest fall back to normal pages
+void test_hugetlb() {
+    static const int s_fibers = 100;
+    uint64_t free_pages = free_huge_pages();
+    uint64_t hugetlb = sylar::StackAllocator::GetStats().hugetlb;
+    sylar::Fiber::GetThis();
+    std::vector<sylar::Fiber::ptr> fibers;
+    for (int i = 0; i < s_fibers; ++i) {
+        fibers.push_back(std::make_shared<sylar::Fiber>([](){
+            // touch most of the 128KiB stack
+            char buf[96 * 1024];
+            memset(buf, 1, sizeof(buf));
+            SYLAR_ASSERT(buf[sizeof(buf) - 1] == 1);
+        }));
+    }
+    for (auto& i : fibers) {
+        i->swapIn();
+    }
+    // beyond the cache size the stacks are unmapped right away
+    fibers.clear();
+    uint64_t got = sylar::StackAllocator::GetStats().hugetlb - hugetlb;
+    SYLAR_LOG_INFO(g_logger) << "hugetlb free pages=" << free_pages << " stacks=" << got
+        << " " << dump_stats();
+    SYLAR_ASSERT(got <= free_pages);
+    if (free_pages) {
+        SYLAR_ASSERT(got > 0);
+    }
+}
+
+int main() {
+    sylar::Thread::ptr thr = std::make_shared<sylar::Thread>(&test_reuse, "stack");
+    thr->join();
+    SYLAR_LOG_INFO(g_logger) << "thread exit " << dump_stats();
+    sylar::Config::Lookup<int>("fiber.stack_hugepage")->setValue(sylar::StackAllocator::HUGETLB);
+    thr = std::make_shared<sylar::Thread>(&test_hugetlb, "hugetlb");
+    thr->join();
+    sylar::Config::Lookup<int>("fiber.stack_hugepage")->setValue(sylar::StackAllocator::NONE);
+    SYLAR_ASSERT(sylar::StackAllocator::GetStats().in_use == 0);
+    SYLAR_LOG_INFO(g_logger) << "thread exit " << dump_stats();
+    return 0;
+}
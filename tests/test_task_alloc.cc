@@ -0,0 +1,108 @@
+#include "iomanager.h"
+#include "log.h"
+#include "task.h"
+#include "tests/alloc_count.h"
+
+#include <memory>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+void test_task() {
+    int count = 0;
+    uint64_t before = s_allocs;
+    sylar::Task small([&count](){ ++count; });
+    sylar::Task moved(std::move(small));
+    SYLAR_ASSERT(!small && moved);
+    moved();
+    SYLAR_ASSERT(count == 1);
+    SYLAR_ASSERT(s_allocs == before);
+
+    // larger than the inline buffer, allocates once
+    char big[sylar::Task::INLINE_SIZE * 2] = {0};
+    sylar::Task large([big, &count](){ count += big[0] + 1; });
+    SYLAR_ASSERT(s_allocs == before + 1);
+    sylar::Task large_moved(std::move(large));
+    large_moved();
+    SYLAR_ASSERT(count == 2 && s_allocs == before + 1);
+
+    // move-only captures work, std::function could not hold this
+    std::unique_ptr<int> value(new int(40));
+    struct Add {
+        std::unique_ptr<int> v;
+        int* out;
+        void operator()() { *out += *v; }
+    };
+    sylar::Task owner(Add{std::move(value), &count});
+    owner();
+    SYLAR_ASSERT(count == 42);
+
+    std::function<void()> empty;
+    SYLAR_ASSERT(!sylar::Task(empty));
+    SYLAR_LOG_INFO(g_logger) << "task ok";
+}
+
+void test_schedule_alloc() {
+    static const int s_warmup = 1000;
+    static const int s_loops = 100000;
+    static uint64_t allocs = 0;
+    static int done = 0;
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    {
+        sylar::IOManager iom(1, false, "alloc");
+        iom.schedule([](){
+            uint64_t start = 0;
+            for (int i = 0; i < s_warmup + s_loops; ++i) {
+                if (i == s_warmup) {
+                    start = s_allocs;
+                }
+                sylar::IOManager::GetThis()->schedule([](){ ++done; });
+                sylar::Fiber::YeildToReady();
+            }
+            allocs = s_allocs - start;
+        });
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_INFO(g_logger) << "schedule+yield loops=" << s_loops << " allocs=" << allocs;
+    SYLAR_ASSERT(done == s_warmup + s_loops);
+    SYLAR_ASSERT(allocs == 0);
+}
+
+void test_event_alloc() {
+    static const int s_warmup = 100;
+    static const int s_loops = 10000;
+    static uint64_t allocs = 0;
+    static int fds[2];
+    SYLAR_ASSERT(pipe(fds) == 0);
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    {
+        sylar::IOManager iom(1, false, "event");
+        iom.schedule([](){
+            uint64_t start = 0;
+            char c = 0;
+            for (int i = 0; i < s_warmup + s_loops; ++i) {
+                if (i == s_warmup) {
+                    start = s_allocs;
+                }
+                // resumes this fiber once readable, as the read hook does
+                sylar::IOManager::GetThis()->addEvent(fds[0], sylar::IOManager::READ);
+                SYLAR_ASSERT(write(fds[1], &c, 1) == 1);
+                sylar::Fiber::YeildToHold();
+                SYLAR_ASSERT(read(fds[0], &c, 1) == 1);
+            }
+            allocs = s_allocs - start;
+        });
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "addEvent+trigger loops=" << s_loops << " allocs=" << allocs;
+    SYLAR_ASSERT(allocs == 0);
+}
+
+int main() {
+    test_task();
+    test_schedule_alloc();
+    test_event_alloc();
+    return 0;
+}
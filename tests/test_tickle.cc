@@ -0,0 +1,80 @@
+#include "iomanager.h"
+#include "log.h"
+#include "util.h"
+
+#include <atomic>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static const int s_bursts = 1000;
+static const int s_burst_size = 100;
+
+// bursts of tasks from outside the scheduler while its threads sleep
+void test_burst() {
+    std::atomic<int> done {0};
+    uint64_t requested = 0;
+    uint64_t sent = 0;
+    uint64_t syscalls = 0;
+    uint64_t start = 0;
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    {
+        sylar::IOManager iom(4, false, "tickle");
+        for (int i = 0; i < s_bursts; ++i) {
+            for (int n = 0; n < s_burst_size; ++n) {
+                iom.schedule([&done](){
+                    ++done;
+                });
+            }
+            // let the threads go back to sleep between bursts
+            if (i % 100 == 0) {
+                usleep(1000);
+            }
+        }
+        while (done != s_bursts * s_burst_size) {
+            usleep(1000);
+        }
+        requested = iom.getTickleRequested();
+        sent = iom.getTickleSent();
+        syscalls = iom.getSyscallCount();
+        start = sylar::GetCurrentMS();
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_INFO(g_logger) << "tasks=" << done << " tickles requested=" << requested
+        << " sent=" << sent << " syscalls=" << syscalls
+        << " stop=" << sylar::GetCurrentMS() - start << "ms";
+    SYLAR_ASSERT(sent <= requested);
+    SYLAR_ASSERT(sent < (uint64_t)s_bursts * s_burst_size / 10);
+}
+
+// a task pinned to a busy thread waits there, the idle threads stay asleep
+void test_pinned_wait() {
+    std::atomic<bool> ran {false};
+    uint64_t sent = 0;
+    {
+        sylar::IOManager iom(4, false, "pinned");
+        usleep(10 * 1000);
+        pid_t thread = iom.getWorkerThreads()[0];
+        uint64_t before = iom.getTickleSent();
+        iom.schedule([](){
+            uint64_t start = sylar::GetCurrentMS();
+            while (sylar::GetCurrentMS() - start < 200) {
+            }
+        }, thread);
+        iom.schedule([&ran](){
+            ran = true;
+        }, thread);
+        while (!ran) {
+            usleep(1000);
+        }
+        sent = iom.getTickleSent() - before;
+    }
+    SYLAR_LOG_INFO(g_logger) << "pinned wait tickles sent=" << sent;
+    SYLAR_ASSERT(sent < 10);
+}
+
+int main() {
+    test_burst();
+    test_pinned_wait();
+    return 0;
+}
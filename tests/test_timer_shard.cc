@@ -0,0 +1,112 @@
+#include "clock.h"
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "util.h"
+
+#include <atomic>
+#include <stdlib.h>
+#include <vector>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static const int s_threads = 4;
+
+static void set_per_thread(bool v) {
+    sylar::Config::Lookup<bool>("iomanager.sharded")->setValue(v);
+    sylar::Config::Lookup<bool>("timer.per_thread")->setValue(v);
+}
+
+// timers added and cancelled from worker threads and from outside the scheduler
+void test_fire(bool per_thread) {
+    static const int s_count = 500;
+    set_per_thread(per_thread);
+    std::vector<uint64_t> deadline(s_count * (s_threads + 1));
+    std::vector<int64_t> fired(deadline.size(), -1);
+    std::atomic<int> ticks {0};
+    {
+        sylar::IOManager iom(s_threads, false, "timer_shard");
+        SYLAR_ASSERT(iom.isPerThread() == per_thread);
+        auto add = [&deadline, &fired](sylar::IOManager* iom, int base){
+            for (int i = base; i < base + s_count; ++i) {
+                uint64_t ms = rand() % 300;
+                deadline[i] = sylar::GetMonotonicMS() + ms;
+                iom->addTimer(ms, [&fired, i](){
+                    SYLAR_ASSERT(fired[i] == -1);
+                    fired[i] = sylar::GetMonotonicMS();
+                });
+            }
+        };
+        std::vector<sylar::Timer::ptr> far;
+        for (int t = 0; t < s_threads; ++t) {
+            iom.schedule([&iom, &add, &far, t](){
+                add(&iom, t * s_count);
+            });
+        }
+        // posted to the inbox of a running thread
+        add(&iom, s_threads * s_count);
+        for (int i = 0; i < 100; ++i) {
+            far.push_back(iom.addTimer(20000 + i, [](){
+                SYLAR_ASSERT(false);
+            }));
+        }
+        sylar::Timer::ptr recurring = iom.addTimer(20, [&ticks](){
+            ++ticks;
+        }, true);
+        usleep(200 * 1000);
+        for (auto& i : far) {
+            SYLAR_ASSERT(iom.cancel(i));
+            SYLAR_ASSERT(!iom.cancel(i));
+        }
+        SYLAR_ASSERT(iom.cancel(recurring));
+    }
+    int64_t max_late = 0;
+    for (size_t i = 0; i < fired.size(); ++i) {
+        SYLAR_ASSERT(fired[i] >= (int64_t)deadline[i]);
+        max_late = std::max(max_late, fired[i] - (int64_t)deadline[i]);
+    }
+    SYLAR_ASSERT(max_late < 50);
+    SYLAR_ASSERT(ticks > 0);
+    SYLAR_LOG_INFO(g_logger) << "per_thread=" << per_thread << " timers=" << fired.size()
+        << " max late=" << max_late << "ms recurring ticks=" << ticks;
+}
+
+// what a hooked read with SO_RCVTIMEO does in every thread when data arrives in time
+uint64_t bench(bool per_thread) {
+    static const int s_pairs = 200000;
+    set_per_thread(per_thread);
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    uint64_t used = 0;
+    {
+        sylar::IOManager iom(s_threads, false, "timer_shard");
+        // let every thread reach its idle loop first
+        usleep(50 * 1000);
+        uint64_t start = sylar::GetCurrentUS();
+        std::atomic<int> left {s_threads};
+        for (int t = 0; t < s_threads; ++t) {
+            iom.schedule([&iom, &used, &left, start](){
+                for (int i = 0; i < s_pairs; ++i) {
+                    sylar::Timer::ptr timer = iom.addTimer(5000 + i % 1000, [](){});
+                    iom.cancel(timer);
+                }
+                if (--left == 0) {
+                    used = sylar::GetCurrentUS() - start;
+                }
+            });
+        }
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    uint64_t per_pair = used * 1000 / (s_threads * (uint64_t)s_pairs);
+    SYLAR_LOG_INFO(g_logger) << "per_thread=" << per_thread << " threads=" << s_threads
+        << " add+cancel=" << per_pair << "ns";
+    return per_pair;
+}
+
+int main() {
+    test_fire(false);
+    test_fire(true);
+    bench(false);
+    bench(true);
+    set_per_thread(false);
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include "clock.h"
+#include "config.h"
+#include "log.h"
+#include "timer.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+class Timers : public sylar::TimerManager {
+protected:
+    void onTimerInsertedAtFront() override {}
+};
+
+static void set_wheel(bool v) {
+    sylar::Config::Lookup<bool>("timer.wheel")->setValue(v);
+}
+
+// run the timers in this thread until none are left
+static void run(Timers& timers) {
+    while (timers.hasTimer()) {
+        uint64_t next = timers.getNextTimer();
+        if (next > 0) {
+            usleep(std::min<uint64_t>(next, 100) * 1000);
+        }
+        std::vector<sylar::Task> cbs;
+        timers.listExpiredCb(cbs);
+        for (auto& i : cbs) {
+            i();
+        }
+    }
+}
+
+void test_fire(bool wheel) {
+    static const int s_count = 2000;
+    set_wheel(wheel);
+    Timers timers;
+    std::vector<uint64_t> deadline(s_count);
+    std::vector<int64_t> fired(s_count, -1);
+    uint64_t start = sylar::GetMonotonicMS();
+    for (int i = 0; i < s_count; ++i) {
+        // crosses the 256ms root of the wheel several times
+        uint64_t ms = rand() % 700;
+        deadline[i] = start + ms;
+        timers.addTimer(ms, [&fired, i](){
+            SYLAR_ASSERT(fired[i] == -1);
+            fired[i] = sylar::GetMonotonicMS();
+        });
+    }
+    // cancelled before they fire, one level up in the wheel
+    std::vector<sylar::Timer::ptr> far;
+    for (int i = 0; i < 100; ++i) {
+        far.push_back(timers.addTimer(20000 + i, [](){
+            SYLAR_ASSERT(false);
+        }));
+    }
+    int ticks = 0;
+    sylar::Timer::ptr recurring = timers.addTimer(50, [&ticks, &recurring, &timers](){
+        if (++ticks == 5) {
+            timers.cancel(recurring);
+        }
+    }, true);
+    // reset moves a timer, refresh restarts it from now
+    bool moved = false;
+    sylar::Timer::ptr reset = timers.addTimer(10000, [&moved](){
+        moved = true;
+    });
+    SYLAR_ASSERT(timers.reset(reset, 300, true));
+    sylar::Timer::ptr refreshed = timers.addTimer(100, [](){});
+    SYLAR_ASSERT(timers.refresh(refreshed));
+    for (auto& i : far) {
+        SYLAR_ASSERT(timers.cancel(i));
+        SYLAR_ASSERT(!timers.cancel(i));
+    }
+    run(timers);
+    int64_t max_late = 0;
+    for (int i = 0; i < s_count; ++i) {
+        SYLAR_ASSERT(fired[i] >= (int64_t)deadline[i]);
+        max_late = std::max(max_late, fired[i] - (int64_t)deadline[i]);
+    }
+    // getNextTimer must not sleep past a due timer, run() caps sleeps at 100ms
+    SYLAR_ASSERT(max_late < 50);
+    SYLAR_ASSERT(ticks == 5 && moved);
+    SYLAR_ASSERT(!timers.cancel(reset));
+    SYLAR_LOG_INFO(g_logger) << "wheel=" << wheel << " timers=" << s_count << " max late=" << max_late << "ms";
+}
+
+void bench(bool wheel) {
+    static const int s_pending = 1000000;
+    static const int s_pairs = 1000000;
+    set_wheel(wheel);
+    Timers timers;
+    std::vector<sylar::Timer::ptr> pending;
+    pending.reserve(s_pending);
+    uint64_t start = sylar::GetCurrentUS();
+    for (int i = 0; i < s_pending; ++i) {
+        pending.push_back(timers.addTimer(1000 + rand() % 60000, [](){}));
+    }
+    uint64_t add_used = sylar::GetCurrentUS() - start;
+
+    // what a hooked read with SO_RCVTIMEO does when data arrives in time
+    start = sylar::GetCurrentUS();
+    for (int i = 0; i < s_pairs; ++i) {
+        sylar::Timer::ptr timer = timers.addTimer(5000 + i % 1000, [](){});
+        timers.cancel(timer);
+    }
+    uint64_t pair_used = sylar::GetCurrentUS() - start;
+
+    start = sylar::GetCurrentUS();
+    for (auto& i : pending) {
+        SYLAR_ASSERT(timers.cancel(i));
+    }
+    uint64_t cancel_used = sylar::GetCurrentUS() - start;
+    SYLAR_ASSERT(!timers.hasTimer());
+    SYLAR_LOG_INFO(g_logger) << "wheel=" << wheel << " pending=" << s_pending
+        << " add=" << add_used * 1000 / s_pending << "ns"
+        << " add+cancel=" << pair_used * 1000 / s_pairs << "ns"
+        << " cancel=" << cancel_used * 1000 / s_pending << "ns";
+}
+
+int main() {
+    test_fire(false);
+    test_fire(true);
+    bench(false);
+    bench(true);
+    set_wheel(false);
+    return 0;
+}
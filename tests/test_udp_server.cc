@@ -0,0 +1,111 @@
+#include "address.h"
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "socket.h"
+#include "udp_server.h"
+#include "util.h"
+
+#include <atomic>
+#include <set>
+#include <string.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static const int s_clients = 4;
+static const int s_rounds = 500;
+static const int s_window = 8;
+static const size_t s_size = 200;
+
+class Echo : public sylar::UdpServer {
+public:
+    Echo(sylar::IOManager* iom) : sylar::UdpServer(iom, iom) {}
+
+protected:
+    void handleDatagram(sylar::Datagram::ptr dgram) override {
+        // a gro datagram carries several of the client's, answer each one
+        size_t segment = dgram->segment ? dgram->segment : dgram->length;
+        for (size_t off = 0; off < dgram->length; off += segment) {
+            size_t len = std::min(segment, dgram->length - off);
+            SYLAR_ASSERT(reply(*dgram, dgram->data + off, len));
+        }
+    }
+};
+
+// each client keeps a window of datagrams in flight and checks every echo
+void test_echo(uint32_t batch, bool gso, bool gro) {
+    static uint64_t used = 0;
+    sylar::Config::Lookup<uint32_t>("udp_server.batch")->setValue(batch);
+    sylar::Config::Lookup<bool>("udp_server.gso")->setValue(gso);
+    sylar::Config::Lookup<bool>("udp_server.gro")->setValue(gro);
+    std::shared_ptr<Echo> server;
+    {
+        sylar::IOManager iom(2, false, "udp");
+        server.reset(new Echo(&iom));
+        sylar::Config::Lookup<uint32_t>("udp_server.batch")->setValue(32);
+        sylar::Config::Lookup<bool>("udp_server.gso")->setValue(false);
+        sylar::Config::Lookup<bool>("udp_server.gro")->setValue(false);
+        iom.schedule([server](){
+            SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+            SYLAR_ASSERT(server->start());
+            sylar::Address::ptr addr = server->getSocks()[0]->getLocalAddress();
+            std::shared_ptr<std::atomic<int>> left = std::make_shared<std::atomic<int>>(s_clients);
+            uint64_t start = sylar::GetCurrentUS();
+            for (int c = 0; c < s_clients; ++c) {
+                sylar::IOManager::GetThis()->schedule([server, addr, left, start, c](){
+                    sylar::Socket::ptr sock = sylar::Socket::CreateUDP(addr);
+                    SYLAR_ASSERT(sock->connect(addr));
+                    sock->setRecvTimeout(2000);
+                    char buf[s_size];
+                    for (int r = 0; r < s_rounds; ++r) {
+                        std::set<int> pending;
+                        for (int k = 0; k < s_window; ++k) {
+                            int id = (c << 24) | (r << 8) | k;
+                            memset(buf, 'a' + k, s_size);
+                            memcpy(buf, &id, sizeof(id));
+                            SYLAR_ASSERT(sock->send(buf, s_size) == (int)s_size);
+                            pending.insert(id);
+                        }
+                        while (!pending.empty()) {
+                            SYLAR_ASSERT(sock->recv(buf, s_size) == (int)s_size);
+                            int id;
+                            memcpy(&id, buf, sizeof(id));
+                            SYLAR_ASSERT(pending.erase(id) == 1);
+                            SYLAR_ASSERT(buf[s_size - 1] == 'a' + (id & 0xff));
+                        }
+                    }
+                    sock->close();
+                    if (--*left == 0) {
+                        used = sylar::GetCurrentUS() - start;
+                        server->stop();
+                    }
+                });
+            }
+        });
+    }
+    uint64_t total = (uint64_t)s_clients * s_rounds * s_window;
+    SYLAR_LOG_INFO(g_logger) << "batch=" << server->getBatch() << " gso=" << server->isGso()
+        << " gro=" << server->isGro() << " datagrams=" << total
+        << " used=" << used / 1000 << "ms datagrams/s=" << total * 1000000 / (used ? used : 1)
+        << " recvmmsg=" << server->getRecvCalls() << " sendmmsg=" << server->getSendCalls();
+    SYLAR_ASSERT(server->getBatch() == batch);
+    SYLAR_ASSERT(server->getSendCount() == total);
+    SYLAR_ASSERT(server->getDropCount() == 0);
+    if (!server->isGro()) {
+        SYLAR_ASSERT(server->getRecvCount() == total);
+    }
+    if (batch == 1) {
+        SYLAR_ASSERT(server->getSendCalls() == total);
+    } else {
+        // a window of requests shares the syscalls
+        SYLAR_ASSERT(server->getRecvCalls() < total);
+        SYLAR_ASSERT(server->getSendCalls() < total);
+    }
+}
+
+int main() {
+    test_echo(1, false, false);
+    test_echo(32, false, false);
+    test_echo(32, true, true);
+    return 0;
+}
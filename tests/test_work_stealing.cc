@@ -0,0 +1,70 @@
+#include "log.h"
+#include "scheduler.h"
+#include "util.h"
+
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static std::atomic<uint64_t> s_done {0};
+static std::atomic<uint64_t> s_wrong_thread {0};
+
+void spawn(int depth) {
+    volatile uint64_t sum = 0;
+    for (int i = 0; i < 200; ++i) {
+        sum += i;
+    }
+    ++s_done;
+    if (depth > 0) {
+        // fan out from inside a worker, idle threads have to steal to help
+        sylar::Scheduler::GetThis()->schedule(std::bind(&spawn, depth - 1));
+        sylar::Scheduler::GetThis()->schedule(std::bind(&spawn, depth - 1));
+    }
+}
+
+void pinned(pid_t thread, int count) {
+    if (sylar::GetThreadID() != thread) {
+        ++s_wrong_thread;
+    }
+    ++s_done;
+    if (count > 0) {
+        sylar::Scheduler::GetThis()->schedule(std::bind(&pinned, thread, count - 1), thread);
+    }
+}
+
+void pin_all() {
+    pid_t thread = sylar::GetThreadID();
+    sylar::Scheduler::GetThis()->schedule(std::bind(&pinned, thread, 1000), thread);
+}
+
+void bench(size_t threads) {
+    s_done = 0;
+    s_wrong_thread = 0;
+    int depth = 16;
+    // scheduler tickle/idle logs would dominate the run
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    uint64_t start = sylar::GetCurrentMS();
+    {
+        sylar::Scheduler sc(threads, false, "ws");
+        sc.start();
+        sc.schedule(std::bind(&spawn, depth));
+        for (size_t i = 0; i < threads; ++i) {
+            sc.schedule(&pin_all);
+        }
+        sc.stop();
+    }
+    uint64_t used = sylar::GetCurrentMS() - start;
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    uint64_t expect = (2ull << depth) - 1 + threads * 1001;
+    SYLAR_ASSERT(s_done == expect);
+    SYLAR_ASSERT(s_wrong_thread == 0);
+    SYLAR_LOG_INFO(g_logger) << "threads=" << threads << " tasks=" << s_done << " used=" << used
+        << "ms tasks/s=" << (used ? s_done * 1000 / used : 0);
+}
+
+int main() {
+    for (size_t i = 1; i <= 4; i *= 2) {
+        bench(i);
+    }
+    return 0;
+}
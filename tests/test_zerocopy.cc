@@ -0,0 +1,179 @@
+#include "address.h"
+#include "iomanager.h"
+#include "log.h"
+#include "socket.h"
+#include "socket_stream.h"
+#include "util.h"
+#include "tests/tcp_pair.h"
+
+#include <atomic>
+#include <string>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("root");
+
+static const size_t s_size = 1024 * 1024;
+static const uint64_t s_threshold = 64 * 1024;
+
+static std::string make_data(size_t size, int seed) {
+    std::string data(size, 0);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = 'a' + (i * 13 + seed) % 26;
+    }
+    return data;
+}
+
+static std::atomic<int> s_released {0};
+
+// the buffer of one send, counts when the socket lets go of it
+struct Owned {
+    Owned(std::string&& v) : data(std::move(v)) {}
+    ~Owned() { ++s_released; }
+    std::string data;
+};
+
+// echo in both directions at once, the reader and the zerocopy sender share the fd
+void test_echo() {
+    static const int s_rounds = 16;
+    static const uint32_t s_window = 2;
+    sylar::IOManager iom(2, false, "zerocopy");
+    iom.schedule([](){
+        auto pair = tcp_pair();
+        sylar::Socket::ptr server = pair.first;
+        sylar::Socket::ptr client = pair.second;
+        sylar::IOManager::GetThis()->schedule([server](){
+            std::string buf(64 * 1024, 0);
+            int rt;
+            while ((rt = server->recv(&buf[0], buf.size())) > 0) {
+                SYLAR_ASSERT(sylar::SocketStream(server, false).writeFixSize(buf.c_str(), rt) == rt);
+            }
+            server->close();
+        });
+        sylar::IOManager::GetThis()->schedule([client](){
+            std::string buf(s_size, 0);
+            sylar::SocketStream stream(client, false);
+            for (int r = 0; r < s_rounds; ++r) {
+                SYLAR_ASSERT(stream.readFixSize(&buf[0], s_size) == (int)s_size);
+                SYLAR_ASSERT(buf == make_data(s_size, r));
+            }
+            SYLAR_ASSERT(stream.readFixSize(&buf[0], 1024) == 1024);
+            SYLAR_ASSERT(client->recv(&buf[0], 1) == 0);
+            client->close();
+        });
+        sylar::SocketStream stream(client, false);
+        client->setZeroCopyWindow(s_window);
+        for (int r = 0; r < s_rounds; ++r) {
+            // loopback copies anyway and the socket turns zerocopy off, ask again
+            client->setZeroCopyThreshold(s_threshold);
+            // the socket keeps the only reference until the kernel is done
+            auto owned = std::make_shared<Owned>(make_data(s_size, r));
+            const char* data = owned->data.c_str();
+            SYLAR_ASSERT(stream.sendZeroCopy(data, s_size, std::move(owned)) == (int64_t)s_size);
+            SYLAR_ASSERT(client->getZeroCopyInFlight() <= s_window);
+            SYLAR_ASSERT(s_released + (int)client->getZeroCopyInFlight() == r + 1);
+        }
+        SYLAR_ASSERT(client->getZeroCopySends() >= s_rounds);
+        // below the threshold the copy path is used
+        uint32_t sends = client->getZeroCopySends();
+        client->setZeroCopyThreshold(s_threshold);
+        std::string small(1024, 'x');
+        SYLAR_ASSERT(client->sendZeroCopy(small.c_str(), small.size(), nullptr) == (int)small.size());
+        SYLAR_ASSERT(client->getZeroCopySends() == sends);
+        SYLAR_ASSERT(::shutdown(client->getSocket(), SHUT_WR) == 0);
+        SYLAR_LOG_WARN(g_logger) << "zerocopy echo ok sends=" << sends
+            << " in flight=" << client->getZeroCopyInFlight()
+            << " threshold after loopback=" << client->getZeroCopyThreshold();
+    });
+}
+
+// loopback copies a send into the peer's receive buffer, once that is full
+// the send stays in flight until the peer reads
+void test_window() {
+    static const size_t s_chunk = 64 * 1024;
+    static const uint32_t s_window = 3;
+    sylar::IOManager iom(1, false, "window");
+    iom.schedule([](){
+        auto pair = tcp_pair();
+        sylar::Socket::ptr server = pair.first;
+        sylar::Socket::ptr client = pair.second;
+        client->setSendTimeout(200);
+        client->setZeroCopyWindow(s_window);
+        auto data = std::make_shared<std::string>(make_data(s_chunk, 0));
+        // sends return at once until the window is full
+        int rounds = 0;
+        while (true) {
+            SYLAR_ASSERT(++rounds < 1024);
+            client->setZeroCopyThreshold(s_threshold);
+            uint64_t start = sylar::GetCurrentMS();
+            int rt = client->sendZeroCopy(data->c_str(), s_chunk, data);
+            if (rt == -1) {
+                SYLAR_ASSERT(errno == ETIMEDOUT);
+                break;
+            }
+            SYLAR_ASSERT(rt == (int)s_chunk);
+            SYLAR_ASSERT(sylar::GetCurrentMS() - start < 100);
+        }
+        SYLAR_ASSERT(client->getZeroCopyInFlight() == s_window);
+        SYLAR_ASSERT(data.use_count() == 1 + s_window);
+        int sent = rounds - 1;
+        sylar::IOManager::GetThis()->schedule([server, sent](){
+            std::string buf(s_chunk, 0);
+            sylar::SocketStream stream(server, false);
+            for (int i = 0; i <= sent; ++i) {
+                SYLAR_ASSERT(stream.readFixSize(&buf[0], s_chunk) == (int)s_chunk);
+                SYLAR_ASSERT(buf == make_data(s_chunk, 0));
+            }
+            SYLAR_ASSERT(server->recv(&buf[0], 1) == 0);
+            server->close();
+        });
+        // the reader frees the window
+        client->setZeroCopyThreshold(s_threshold);
+        SYLAR_ASSERT(client->sendZeroCopy(data->c_str(), s_chunk, data) == (int)s_chunk);
+        // close waits for the rest and lets go of every reference
+        client->close();
+        SYLAR_ASSERT(client->getZeroCopyInFlight() == 0);
+        SYLAR_ASSERT(data.use_count() == 1);
+        SYLAR_LOG_WARN(g_logger) << "zerocopy window ok sends=" << sent + 1;
+    });
+}
+
+void bench_send(bool zero_copy) {
+    static const int s_rounds = 512;
+    static const size_t s_chunk = 512 * 1024;
+    static uint64_t used = 0;
+    {
+        sylar::IOManager iom(1, false, "bench");
+        iom.schedule([zero_copy](){
+            auto pair = tcp_pair();
+            sylar::Socket::ptr reader = pair.second;
+            sylar::IOManager::GetThis()->schedule([reader](){
+                std::string buf(256 * 1024, 0);
+                while (reader->recv(&buf[0], buf.size()) > 0) {
+                }
+            });
+            sylar::SocketStream stream(pair.first);
+            // never changes, every send shares it
+            auto data = std::make_shared<std::string>(make_data(s_chunk, 0));
+            uint64_t start = sylar::GetCurrentUS();
+            for (int r = 0; r < s_rounds; ++r) {
+                pair.first->setZeroCopyThreshold(zero_copy ? s_threshold : 0);
+                SYLAR_ASSERT(stream.sendZeroCopy(data->c_str(), s_chunk, data) == (int64_t)s_chunk);
+            }
+            used = sylar::GetCurrentUS() - start;
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << (zero_copy ? "MSG_ZEROCOPY" : "copy") << " "
+        << s_rounds * s_chunk / 1024 / 1024 << "MiB in " << s_chunk / 1024 << "KiB sends used="
+        << used / 1000 << "ms " << (uint64_t)s_rounds * s_chunk / (used ? used : 1) << "MB/s";
+}
+
+int main() {
+    g_logger->setLevel(sylar::LogLevel::WARN);
+    test_echo();
+    test_window();
+    // close() waited for the sends in flight and dropped their owners
+    SYLAR_ASSERT(s_released == 16);
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    bench_send(false);
+    bench_send(true);
+    return 0;
+}